@@ -1,17 +1,247 @@
+#ifdef __linux__
+#define _GNU_SOURCE  // fopencookie for the asynchronous output sink
+#endif
 #include <stdio.h>   // include stdio for file I/O and printf
 #include <stdlib.h>  // include stdlib for malloc/free and exit codes
 #include <string.h>  // include string.h for strncpy, strcmp, strlen, etc.
 #include <ctype.h>   // include ctype.h for isalpha, isdigit, isspace functions
+#include <time.h>    // clock() for the --batch throughput figures
+#ifndef _MSC_VER
+#include <pthread.h> // one host thread per simulated hart (--hart-threads)
+#define HAVE_PTHREADS 1
+#endif
+#if defined(__linux__) && defined(HAVE_PTHREADS)
+#include <stdint.h>  // uintptr_t for the io_uring buffer address
+#include <fcntl.h>   // open and its flags
+#include <unistd.h>  // pwrite, close
+#include <sys/mman.h> // mmap of the io_uring rings
+#include <sys/syscall.h> // raw io_uring system calls
+#define HAVE_ASYNC_OUT 1 // --async-out: buffers written by io_uring or a writer thread
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h> // io_uring structures and opcodes
+#define HAVE_IO_URING 1 // --async-out=uring: kernel-side writes
+#endif
+#endif
+#endif
+
+#ifdef WITH_ZLIB
+#include <zlib.h>    // gzip outputs (--gzip) and inputs; build with -DWITH_ZLIB ... -lz
+#endif
+#ifndef _WIN32
+#include <fcntl.h>   // open and its flags
+#include <unistd.h>  // dup, dup2, getpid
+#include <dirent.h>  // opendir for eviction
+#include <utime.h>   // utime: a hit marks its entry used
+#include <sys/stat.h> // mkdir, stat
+#define HAVE_RESULT_CACHE 1 // --cache=DIR: stored results keyed by program and options
+#endif
+#if defined(__has_include) && !defined(NO_USDT)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h> // USDT probes: a NOP per probe until bpftrace / perf attaches
+#define HAVE_USDT 1  // probes compiled in
+#endif
+#endif
+
+/* Static tracepoints of the cycle loop, provider "extended_simulator" (argument layouts in README):
+   cycle(hart, cycle), hazard(hart, cycle, idx, bubbles), stall(hart, cycle, kind),
+   retire(hart, cycle, idx, instructions), advance(cycle, if, id, ex, mem, wb) */
+#ifdef HAVE_USDT
+#define PROBE2(name, a, b)                DTRACE_PROBE2(extended_simulator, name, a, b)
+#define PROBE3(name, a, b, c)             DTRACE_PROBE3(extended_simulator, name, a, b, c)
+#define PROBE4(name, a, b, c, d)          DTRACE_PROBE4(extended_simulator, name, a, b, c, d)
+#define PROBE6(name, a, b, c, d, e, f)    DTRACE_PROBE6(extended_simulator, name, a, b, c, d, e, f)
+#else
+#define PROBE2(name, a, b)                ((void)0)
+#define PROBE3(name, a, b, c)             ((void)0)
+#define PROBE4(name, a, b, c, d)          ((void)0)
+#define PROBE6(name, a, b, c, d, e, f)    ((void)0)
+#endif
 
 #define MAX_INSTR  4096  // maximum number of instructions supported
 #define MAX_LINE   4096  // maximum length of a single input line
+#define REGS_PER_FILE 32 // x0..x31 integer, f0..f31 FP, v0..v31 vector registers
+#define NUM_REGS   (3*REGS_PER_FILE) // register ids: x<n> is n, f<n> is 32+n, v<n> is 64+n
+#define MAX_SRCS   3     // most source registers of one instruction (fmadd, vfmacc)
+#define MAX_FP_LAT 64    // longest configurable FP unit latency
+#define MAX_SB     64    // most store-buffer entries
+#define MAX_RF_PORTS 64  // most register-file read or write ports per bank
+#define ACCESS_BYTES 8   // ld/sd/fld/fsd move 8 bytes
+#define MAX_TLB    2048  // most entries of one TLB
+#define MAX_HARTS  8     // most cores in a multicore run
+#define LINE_BYTES 64    // coherence granule
+
+/* Optional decode-stage optimizations (bit flags, off by default) */
+#define OPT_MOVE_ELIM   1  // mov rd, rs: rd aliases rs's producer, the mov itself depends on nothing
+#define OPT_ZERO_IDIOM  2  // sub rd, rs, rs: recognized as a zero-write with no dependency
+
+/* Input files: with zlib, gzip-compressed and plain files are both read through a gzFile. */
+#ifdef WITH_ZLIB
+typedef gzFile InFile;                                 // transparent .gz reader
+#define in_open(path)        gzopen(path, "rb")
+#define in_gets(buf, len, f) gzgets(f, buf, (int)(len))
+#define in_seek(f, off)      gzseek(f, off, SEEK_SET)
+#define in_close(f)          gzclose(f)
+#else
+typedef FILE *InFile;                                  // plain text only
+#define in_open(path)        fopen(path, "r")
+#define in_gets(buf, len, f) fgets(buf, (int)(len), f)
+#define in_seek(f, off)      fseek(f, off, SEEK_SET)
+#define in_close(f)          fclose(f)
+#endif
+
+typedef enum { OP_ADD, OP_SUB, OP_MOV, OP_LD, OP_SD,             // integer opcodes
+               OP_FADD, OP_FMUL, OP_FDIV, OP_FMADD, OP_FLD, OP_FSD, // floating-point opcodes
+               OP_VSETVLI, OP_VSETIVLI, OP_VLE, OP_VSE,              // vector configuration and memory
+               OP_VADD, OP_VMUL, OP_VFMACC,                          // vector arithmetic
+               OP_BAD } Op;                                          // opcode enum for our small ISA
+
+/* Vector functional units; each processes one element group (lanes elements) per cycle */
+enum { VU_NONE, VU_LSU, VU_ALU, VU_FMA, VU_COUNT };    // VU_NONE: scalar op
+static const char *vu_names[VU_COUNT] = { "", "load/store", "alu", "fma" }; // names for reports
+
+/* Operand signature per opcode: 'x' integer register, 'f' FP register, 'v' vector register,
+   'V' vector register that is both destination and source, 'm' memory operand "imm(xB)",
+   'i' immediate, 'e' element width (e8/e16/e32/e64). The first operand is the destination,
+   except for stores where it is the data. */
+typedef struct {                                       // static description of one opcode
+    const char *name;                                  // mnemonic
+    const char *operands;                              // operand signature
+    int  fp_unit;                                      // 1: executes on the pipelined FP unit instead of EX
+    int  vec_unit;                                     // VU_* unit it is dispatched to from EX
+} OpInfo;                                              // end OpInfo
+static const OpInfo op_info[OP_BAD] = {                // indexed by Op
+    { "add",   "xxx",  0, VU_NONE }, { "sub",   "xxx",  0, VU_NONE }, { "mov",   "xx",   0, VU_NONE }, // integer ALU
+    { "ld",    "xm",   0, VU_NONE }, { "sd",    "xm",   0, VU_NONE },                               // integer memory
+    { "fadd",  "fff",  1, VU_NONE }, { "fmul",  "fff",  1, VU_NONE }, { "fdiv",  "fff",  1, VU_NONE }, // FP arithmetic
+    { "fmadd", "ffff", 1, VU_NONE },                                                                // fused multiply-add
+    { "fld",   "fm",   0, VU_NONE }, { "fsd",   "fm",   0, VU_NONE },                               // FP memory (address in EX)
+    { "vsetvli", "xxe", 0, VU_NONE }, { "vsetivli", "xie", 0, VU_NONE },                            // set vl (scalar ops)
+    { "vle",   "vm",   0, VU_LSU  }, { "vse",   "vm",   0, VU_LSU  },                               // unit-stride vector memory
+    { "vadd",  "vvv",  0, VU_ALU  }, { "vmul",  "vvv",  0, VU_ALU  }, { "vfmacc", "Vvv", 0, VU_FMA }, // vector arithmetic
+};
+#define IS_STORE(op)  ((op)==OP_SD || (op)==OP_FSD || (op)==OP_VSE) // first operand is data, no destination
+#define IS_MEM(op)    ((op)==OP_LD || (op)==OP_SD || (op)==OP_FLD || (op)==OP_FSD) // accesses memory in MEM
+#define IS_FP_REG(r)  ((r) >= REGS_PER_FILE && (r) < 2*REGS_PER_FILE) // register id lives in the FP file
+#define IS_VEC_REG(r) ((r) >= 2*REGS_PER_FILE)         // register id lives in the vector file
+
+/* Macro-op fusion rule table: a dependent pair (second reads first's rd) matching an enabled
+   rule is combined between IF and ID into one pipeline slot that executes as a single EX
+   operation (the mov is a wire into the ALU; two chained adds become a 3-input add). */
+typedef struct {                                       // one fusion rule
+    const char *name;                                  // name used on the command line
+    Op   first, second;                                // opcodes of the pair, in program order
+    int  same_rd;                                      // 1: second must also overwrite first's rd
+} FuseRule;                                            // end FuseRule
+static const FuseRule fuse_rules[] = {                 // rule table (bit r of a mask enables rule r)
+    { "mov-add", OP_MOV, OP_ADD, 0 },                  // mov rA, rB ; add rC, rA, rD
+    { "mov-sub", OP_MOV, OP_SUB, 0 },                  // mov rA, rB ; sub rC, rA, rD
+    { "add-add", OP_ADD, OP_ADD, 1 },                  // add rA, rB, rC ; add rA, rA, rD
+    { "add-sub", OP_ADD, OP_SUB, 1 },                  // add rA, rB, rC ; sub rA, rA, rD
+    { "sub-add", OP_SUB, OP_ADD, 1 },                  // sub rA, rB, rC ; add rA, rA, rD
+    { "sub-sub", OP_SUB, OP_SUB, 1 },                  // sub rA, rB, rC ; sub rA, rA, rD
+};
+#define NUM_FUSE_RULES ((int)(sizeof(fuse_rules)/sizeof(fuse_rules[0]))) // number of rules
+
+enum { FUSED_NONE, FUSED_HEAD, FUSED_TAIL };          // role of an instruction in a fused pair
+
+/* Vector unit configuration; latencies are cycles from an element group entering a unit
+   until its result can be read */
+typedef struct {                                       // vector unit shape
+    int vlen;                                          // bits per vector register
+    int lanes;                                         // elements processed per cycle by each unit
+    int chain;                                         // 1: consumers start once the first element group is produced
+    const int *lat;                                    // per opcode (points at Resources.unit_lat)
+} VecConfig;                                           // end VecConfig
+
+/* Address translation. TLBs with 0 entries are not modelled (translation is free). */
+enum { TLB_I, TLB_D, TLB_L2, TLB_COUNT };              // L1 instruction, L1 data, shared second level
+typedef struct {                                       // TLB geometry and miss costs
+    int entries[TLB_COUNT];                            // entries per TLB (0 = not modelled)
+    int ways[TLB_COUNT];                               // associativity (entries = fully associative)
+    int l2_lat;                                        // extra cycles for an L1 miss that hits the L2 TLB
+    int walk_lat;                                      // cycles per page-table level (0 = one data-cache access)
+    int data_page_shift;                               // data page size: 12 (4 KiB), 21 (2 MiB) or 30 (1 GiB)
+} TlbConfig;                                           // end TlbConfig
+
+/* Multicore memory: private L1Ds kept coherent with MESI through a directory at the shared L2. */
+typedef struct {                                       // coherence latencies and data layout
+    int harts;                                         // cores running the program (0 = single-core model)
+    int l2_lat;                                        // cycles for an L1D miss served by the shared L2
+    int c2c_lat;                                       // cycles for a miss served by another core's modified copy
+    int upgrade_lat;                                   // cycles for S -> M (invalidate the other sharers)
+    int hart_stride;                                   // bytes between the data of consecutive harts
+    int threads;                                       // 1: one host thread per hart
+} CohConfig;                                           // end CohConfig
+
+/* Structural resources. The defaults (all zero) model unlimited resources, as before. */
+typedef struct {                                       // configurable structural resources
+    int unified_mem;                                   // 1: IF and MEM share one single-ported memory (MEM wins)
+    int rf_read_ports;                                 // register-file read ports per bank (0 = unlimited)
+    int rf_write_ports;                                // register-file write ports per bank (0 = unlimited)
+    int rf_banks;                                      // register banks per file; register r lives in bank r % rf_banks
+    int unit_lat[OP_BAD];                              // FP / vector unit latency per opcode
+    VecConfig vec;                                     // vector unit shape
+    int dcache_lat;                                    // cycles until a data-cache access answers (pipelined, one per cycle)
+    int sb_entries;                                    // store-buffer entries (0 = stores write the cache from MEM)
+    int sb_drain;                                      // SB_EAGER or SB_FULL
+    TlbConfig tlb;                                     // address translation
+    CohConfig coh;                                     // multicore coherence
+} Resources;                                           // end Resources
+
+enum { SB_EAGER, SB_FULL };                            // store-buffer drain policies
+
+/* Activity events for the energy model */
+enum { EV_FETCH, EV_DECODE, EV_ALU, EV_FPU, EV_VELEM, EV_RF_READ, EV_RF_WRITE, EV_DCACHE, EV_SB, EV_TLB, EV_BUBBLE, EV_COUNT };
+static const char *ev_names[EV_COUNT] = { "fetch", "decode", "alu", "fpu", "velem", "rfread", "rfwrite",
+                                          "dcache", "sb", "tlb", "bubble" };
 
-typedef enum { OP_ADD, OP_SUB, OP_MOV, OP_BAD } Op;  // opcode enum for our small ISA
+/* Vector unit activity of one run */
+typedef struct {                                       // vector counters
+    int  ops, chained;                                 // vector ops, and starts overlapping a producer still running
+    long busy[VU_COUNT];                               // cycles each unit accepted an element group
+    long elems;                                        // elements processed
+    long wait;                                         // cycles ops waited after dispatch for operands or a free unit
+} VecStats;                                            // end VecStats
+
+/* Stall accounting for one run of the cycle loop */
+typedef struct {                                       // per-run counters
+    long stalls;                                       // all lost cycles: EX bubbles, WB freezes, fetch bubbles
+    long rf_read;                                      // of which: ID waiting for register read ports
+    long rf_write;                                     // of which: WB waiting for register write ports
+    long mem_port;                                     // of which: IF losing the unified memory port to MEM
+    long raw_int;                                      // of which: RAW bubbles waiting on an integer producer
+    long raw_fp;                                       // of which: RAW bubbles waiting on an FP producer
+    long fp_issue;                                     // of which: ID held back by FP unit WAW / MEM-slot conflicts
+    long mem_cache;                                    // of which: MEM waiting for a data-cache access
+    long sb_full;                                      // of which: a store waiting for a free store-buffer entry
+    long sb_partial;                                   // of which: a load waiting for a partially overlapping store to drain
+    long loads, forwards;                              // loads executed, and loads served by the store buffer
+    long sb_occupancy;                                 // sum over cycles of store-buffer entries (for the average)
+    int  sb_peak;                                      // most entries in use at once
+    long itlb;                                         // of which: IF waiting for an instruction translation
+    long dtlb;                                         // of which: MEM waiting for a data translation
+    long tlb_hits[TLB_COUNT], tlb_misses[TLB_COUNT];   // lookups per TLB
+    long walks, walk_cycles;                           // page-table walks and their total latency
+    long coh;                                          // of which: MEM waiting for an L1D miss or upgrade (multicore)
+    long act[EV_COUNT];                                // activity counted in the loop (see activity())
+    VecStats vec;                                      // vector unit activity (not part of the stalls above)
+} RunStats;                                            // end RunStats
 typedef struct {  // instruction structure to hold parsed instruction information
-    Op   op;               // opcode of the instruction (add/sub/mov)
-    char rd[16];           // destination register name string (e.g., "x1")
-    char rs[2][16];        // up to two source register name strings
-    int  rs_count;         // number of source registers (1 for mov, 2 for add/sub)
+    Op   op;               // opcode of the instruction (see op_info)
+    char rd[16];           // destination register name string (e.g., "x1"; empty for stores)
+    char rs[MAX_SRCS][16]; // source register name strings (stores: base, data)
+    int  rs_count;         // number of source registers
+    int  rd_id, rs_id[MAX_SRCS]; // numeric register ids of rd and sources (-1 if unused)
+    long imm;              // memory address offset, or vsetivli's AVL
+    int  sew;              // vsetvli/vsetivli element width in bits
+    int  vl;               // vector ops: number of elements, set by the preceding vsetvli
+    int  vstart, vend;     // vector ops: first cycle in the vector unit, cycle the last result is written
+    int  addr_key;         // memory ops: the value of the base register (its last writer, or -1-reg if never written)
+    int  elim;             // 1 if removed at rename (eliminated mov or zero idiom): no RF reads/writes
+    int  prod[MAX_SRCS];   // index of the instruction producing each source after renaming (-1 = ready)
+    int  fused;            // FUSED_HEAD/FUSED_TAIL when part of a fused pair, else FUSED_NONE
+    int  slot;             // pipeline slot number; both halves of a fused pair share one slot
     char text[128];        // textual representation of the instruction for tracing/CSV
     int  finished;         // runtime flag: set to 1 when instruction completes WB
 } Instr;                  // end of Instr struct definition
@@ -47,7 +277,7 @@ static int is_blank_ascii(const char *s) {              // function checks if li
     return 1;                                          // all characters were whitespace -> true
 }                                                      // end is_blank_ascii
 
-/* Find opcode token "add"/"sub"/"mov" ignoring case; return corresponding enum */
+/* Find the first word that names a known opcode, ignoring case; return corresponding enum */
 static Op find_opcode(const char *s) {                  // scan the line for a known opcode word
     const char *p = s;                                  // pointer used to walk the string
     while (*p) {                                        // loop until end of string
@@ -58,37 +288,81 @@ static Op find_opcode(const char *s) {                  // scan the line for a k
         while (*q && isalpha((unsigned char)*q) && j<15) // copy up to 15 letters
             w[j++] = (char)tolower((unsigned char)*q), q++;
         w[j]='\0';                                      // null-terminate the word
-        if (strcmp(w,"add")==0) return OP_ADD;          // match "add"
-        if (strcmp(w,"sub")==0) return OP_SUB;          // match "sub"
-        if (strcmp(w,"mov")==0) return OP_MOV;          // match "mov"
+        for (int o=0;o<OP_BAD;o++)                      // compare against every mnemonic
+            if (strcmp(w, op_info[o].name)==0) return (Op)o;
         p = q;                                          // continue search after the word
     }                                                   // end while
     return OP_BAD;                                      // no opcode found
 }                                                       // end find_opcode
 
-/* Scan next ASCII register token of form x[0-9]+ anywhere in the string.
-   Returns pointer after the matched digits, and writes digits into out[].
-   Returns NULL if no register found. */
-static const char* find_next_reg(const char *p, char out[16]) { // find next register occurrence
+/* Scan next ASCII register token of form [xfv][0-9]+ anywhere in the string.
+   Returns pointer after the matched digits, writes digits into out[] and the register
+   file letter ('x', 'f' or 'v') into *kind. Returns NULL if no register found. */
+static const char* find_next_reg(const char *p, char out[16], char *kind) { // find next register occurrence
     while (*p) {                                        // walk characters until null
-        if (*p=='x' || *p=='X') {                      // potential register start detected
-            const char *q = p+1;                       // q will scan the digits after 'x'
+        char c = (char)tolower((unsigned char)*p);      // case-insensitive file letter
+        if (c=='x' || c=='f' || c=='v') {              // potential register start detected
+            const char *q = p+1;                       // q will scan the digits after the letter
             int j=0;                                   // digit buffer index
             while (*q && isdigit((unsigned char)*q)) { // collect contiguous digits
                 if (j<14) out[j++] = *q;               // store at most 14 digits (safety)
                 q++;
             }
-            if (j>0) { out[j]='\0'; return q; }        // if digits found, return pointer after them
+            if (j>0) { out[j]='\0'; *kind=c; return q; } // if digits found, return pointer after them
         }
         p++;                                           // otherwise advance and keep searching
     }
     return NULL;                                        // no register found
 }                                                      // end find_next_reg
 
+/* Fill ins from operands in signature order: regs[k] is the text of operand k, ids[k] its register
+   id (-1 for an immediate or element width). Shared by parse_line and the binary trace reader. */
+static void build_instr(Instr *ins, Op op, char regs[][16], const int *ids, long imm, int sew) { // decoded fields
+    const char *sig = op_info[op].operands;             // operand signature
+    int nops = (int)strlen(sig);                        // number of operands
+    ins->op = op;                                       // set opcode in parsed instruction
+    ins->finished = 0;                                  // clear finished flag at parse time
+    ins->imm = imm;                                     // memory offset (0 for register ops)
+    ins->sew = sew;                                     // element width (vsetvli only)
+    ins->vl = 0;                                        // decided later by assign_vl
+    ins->elim = 0;                                      // decided later by resolve_producers
+    for (int k=0;k<MAX_SRCS;k++) { ins->rs_id[k] = -1; ins->rs[k][0] = '\0'; } // clear unused sources
+    if (IS_STORE(op)) {                                 // stores: sources are base, data; no destination
+        ins->rd[0]='\0';                                // no destination register
+        ins->rd_id = -1;                                // no destination id
+        snprintf(ins->rs[0],sizeof(ins->rs[0]),"%s", regs[1]); ins->rs_id[0] = ids[1]; // base register
+        snprintf(ins->rs[1],sizeof(ins->rs[1]),"%s", regs[0]); ins->rs_id[1] = ids[0]; // data register
+        ins->rs_count=2;                                // base and data
+    } else {                                            // everything else: first operand is rd
+        snprintf(ins->rd,  sizeof(ins->rd),  "%s", regs[0]);        // destination
+        ins->rd_id = ids[0];                            // destination id
+        ins->rs_count=0;                                // sources counted below
+        for (int k=1;k<nops;k++) {                      // remaining register operands are sources
+            if (ids[k] < 0) continue;                   // immediate or element width
+            snprintf(ins->rs[ins->rs_count],sizeof(ins->rs[0]),"%s", regs[k]); // next source text
+            ins->rs_id[ins->rs_count++] = ids[k];       // and its id
+        }
+        if (sig[0]=='V') {                              // accumulator: the destination is read as well
+            snprintf(ins->rs[ins->rs_count],sizeof(ins->rs[0]),"%s", regs[0]); // the accumulator as a source
+            ins->rs_id[ins->rs_count++] = ids[0];       // and its id
+        }
+    }
+    if (strchr(sig, 'm'))                               // textual representation of memory ops
+        snprintf(ins->text,sizeof(ins->text),"%s %s, %ld(%s)",op_info[op].name,regs[0],imm,regs[1]); // "op rd, off(base)"
+    else {                                              // "op rd, rs1, rs2, ..."
+        int len = snprintf(ins->text,sizeof(ins->text),"%s %s",op_info[op].name,regs[0]); // mnemonic and rd
+        for (int k=1;k<nops;k++)                        // then every other operand
+            len += snprintf(ins->text+len,sizeof(ins->text)-len,", %s",regs[k]); // ", operand"
+    }
+}                                                      // end build_instr
+
 /* Parse a single text line into an Instr structure in a tolerant way:
    - find opcode anywhere on the line
-   - collect registers by scanning x[0-9]+ tokens
-   - verify correct register count for each opcode */
+   - collect registers by scanning [xfv][0-9]+ tokens in the order of the operand signature
+   - immediates and element widths ("e32") are read after the next comma
+   - memory operands are "imm(base)": the base is searched inside the parentheses so that a
+     hex offset such as 0x10 is not mistaken for register x10
+   - verify register count and register file for each operand */
 static int parse_line(const char *line_in, Instr *ins, int lineno) { // parse one input line
     char buf[MAX_LINE];                                 // local buffer to manipulate the line
     strncpy(buf, line_in, sizeof(buf)-1); buf[sizeof(buf)-1]='\0'; // safe copy + null-terminate
@@ -103,220 +377,3560 @@ static int parse_line(const char *line_in, Instr *ins, int lineno) { // parse on
         return 0;                                       // skip this line quietly
     }
 
-    char regs[3][16]; int rcount=0;                     // temporary storage for up to 3 registers
+    const char *sig = op_info[op].operands;             // expected operands, in order
+    int nops = (int)strlen(sig);                        // number of register operands
+    char regs[MAX_SRCS+1][16]; int ids[MAX_SRCS+1]; int rcount=0; // parsed operands
     const char *p = buf;                                // scanning pointer
-    while (rcount < 3) {                                // collect up to three register tokens
-        char digits[16];                                // buffer for digits following 'x'
-        const char *np = find_next_reg(p, digits);      // search next register from current position
+    long imm = 0;                                       // memory offset (0 when omitted)
+    int sew = 0;                                        // element width of vsetvli/vsetivli
+    while (rcount < nops) {                             // collect operands in signature order
+        char digits[16], kind;                          // register digits and file letter
+        if (sig[rcount]=='i' || sig[rcount]=='e') {     // non-register operand after the next comma
+            const char *c = strchr(p, ',');             // separator before the operand
+            if (!c) break;                              // missing operand
+            c += strspn(c+1, " \t") + 1;                // skip the comma and blanks
+            char *end;                                  // end of the parsed number
+            if (sig[rcount]=='i') imm = strtol(c, &end, 0); // immediate (decimal or hex)
+            else if (tolower((unsigned char)*c)=='e') sew = (int)strtol(c+1, &end, 10); // "e<bits>"
+            else break;                                 // not an element width
+            if (end==c || (sig[rcount]=='e' && sew!=8 && sew!=16 && sew!=32 && sew!=64)) { // malformed
+                fprintf(stderr, "Parse error on line %d: bad %s for %s  |  line: \"%s\"\n",
+                        lineno, sig[rcount]=='i' ? "immediate" : "element width (e8/e16/e32/e64)", op_info[op].name, buf);
+                return -1;                              // error condition
+            }
+            snprintf(regs[rcount], sizeof(regs[rcount]), "%.*s", (int)(end-c), c); // keep the text for printing
+            ids[rcount++] = -1;                         // not a register
+            p = end;                                    // continue after the operand
+            continue;
+        }
+        if (sig[rcount]=='m') {                         // memory operand: base inside "imm(...)"
+            const char *comma = strchr(buf, ',');       // separator before the memory operand
+            const char *paren = comma ? strchr(comma, '(') : NULL; // start of "(base)"
+            if (!paren) break;                          // malformed memory operand
+            imm = strtol(comma+1, NULL, 0);             // offset in front of '(' (decimal or hex)
+            p = paren;                                  // continue the scan inside the parentheses
+        }
+        const char *np = find_next_reg(p, digits, &kind); // search next register from current position
         if (!np) break;                                 // break if none found
-        snprintf(regs[rcount], sizeof(regs[rcount]), "x%s", digits); // store as "x<digits>"
+        char want = (sig[rcount]=='m' ? 'x' : (char)tolower((unsigned char)sig[rcount])); // memory bases are integer registers
+        if (kind != want) {                             // wrong register file for this operand
+            fprintf(stderr, "Parse error on line %d: operand %d of %s must be an %c register  |  line: \"%s\"\n",
+                    lineno, rcount+1, op_info[op].name, want, buf);
+            return -1;                                  // error condition
+        }
+        if (strlen(digits) > 2 || atoi(digits) >= REGS_PER_FILE) { // only 32 registers per file
+            fprintf(stderr, "Parse error on line %d: register %c%s out of range (%c0..%c%d)  |  line: \"%s\"\n",
+                    lineno, kind, digits, kind, kind, REGS_PER_FILE-1, buf); // diagnostic for out-of-range register
+            return -1;                                  // error condition
+        }
+        snprintf(regs[rcount], sizeof(regs[rcount]), "%c%s", kind, digits); // store as "x<digits>"/"f<digits>"
+        ids[rcount] = atoi(digits) + (kind=='f' ? REGS_PER_FILE : kind=='v' ? 2*REGS_PER_FILE : 0); // unified id for hazard tables
         rcount++;                                       // increment number of regs found
         p = np;                                         // advance scanning pointer beyond the match
     }
 
-    if ((op==OP_ADD || op==OP_SUB) && rcount != 3) {    // add/sub require 3 regs: rd, rs1, rs2
-        fprintf(stderr, "Parse error on line %d: need 3 regs for %s; got %d  |  line: \"%s\"\n",
-                lineno, (op==OP_ADD?"add":"sub"), rcount, buf); // diagnostic message for professor/debugging
-        return -1;                                      // error condition
-    }
-    if (op==OP_MOV && rcount != 2) {                    // mov requires 2 regs: rd, rs
-        fprintf(stderr, "Parse error on line %d: need 2 regs for mov; got %d  |  line: \"%s\"\n",
-                lineno, rcount, buf);                    // diagnostic message for mov
+    if (rcount != nops) {                               // missing operands
+        if (strchr(sig, 'm'))                           // memory ops: show the expected form
+            fprintf(stderr, "Parse error on line %d: need \"reg, imm(base)\" for %s  |  line: \"%s\"\n",
+                    lineno, op_info[op].name, buf);
+        else                                            // register ops: diagnostic message for professor/debugging
+            fprintf(stderr, "Parse error on line %d: need %d regs for %s; got %d  |  line: \"%s\"\n",
+                    lineno, nops, op_info[op].name, rcount, buf);
         return -1;                                      // error condition
     }
 
-    ins->op = op;                                       // set opcode in parsed instruction
-    ins->finished = 0;                                  // clear finished flag at parse time
-    if (op == OP_MOV) {                                 // handle mov formatting into Instr
-        snprintf(ins->rd,  sizeof(ins->rd),  "%s", regs[0]);        // copy destination register
-        snprintf(ins->rs[0],sizeof(ins->rs[0]),"%s", regs[1]);      // copy source register
-        ins->rs[1][0]='\0';                            // clear unused second source
-        ins->rs_count=1;                               // mov has only one source
-        snprintf(ins->text,sizeof(ins->text),"mov %s, %s",ins->rd,ins->rs[0]); // human-readable text
-    } else {                                            // handle add/sub formatting
-        snprintf(ins->rd,  sizeof(ins->rd),  "%s", regs[0]);        // destination
-        snprintf(ins->rs[0],sizeof(ins->rs[0]),"%s", regs[1]);      // source 1
-        snprintf(ins->rs[1],sizeof(ins->rs[1]),"%s", regs[2]);      // source 2
-        ins->rs_count=2;                               // add/sub have two sources
-        snprintf(ins->text,sizeof(ins->text),"%s %s, %s, %s",
-                 (op==OP_ADD?"add":"sub"),ins->rd,ins->rs[0],ins->rs[1]); // textual representation
-    }
+    build_instr(ins, op, regs, ids, imm, sew);          // fill in the decoded fields
     return 1;                                           // parse successful: instruction filled in
 }                                                      // end parse_line
 
-/* Utility: check whether a given register string is present in the instruction's sources */
-static int reg_in_sources(const char *reg, const Instr *ins) { // check RAW dependence
-    if (!reg || !ins) return 0;                        // guard against NULL pointers
-    for (int i=0;i<ins->rs_count;i++)                  // iterate over source registers
-        if (strcmp(reg, ins->rs[i])==0) return 1;      // return true if a match is found
-    return 0;                                          // not found -> false
-}                                                      // end reg_in_sources
+/* Instruction sources: the engines pull decoded instructions through one call per batch, so a
+   run needs neither a text file nor the whole input in memory. The input argument picks the source:
+     FILE            text, one instruction per line (.gz too with zlib)
+     trace:FILE      binary trace written by --trace-out
+     commit:FILE     commit log with disassembly ("core 0: 0x80000000 (0x00b50533) add a0, a0, a1",
+                     as printed by spike -l); ABI register names and compressed forms are accepted,
+                     lines without a modelled instruction are skipped
+     synth:N[:SEED]  N pseudo-random scalar instructions
+     loop:N:SOURCE   the instructions of another source, executed N times in program order
+   next() decodes up to max instructions into buf and returns how many, 0 at the end of the input,
+   or minus an exit code once the error has been reported. */
+#define SOURCE_BATCH 256                                // batch of the scratch buffers (about 80 KiB)
+#define TRACE_MAGIC  "PSIMTRC1"                         // first 8 bytes of a binary trace
+#define TRACE_RECORD 16                                 // bytes per binary trace record
+typedef struct InstrSource {                            // one open input
+    int  (*next)(struct InstrSource *s, Instr *buf, int max); // decode the next batch
+    const char *name;                                   // file name (or the spec) for messages
+    InFile f; FILE *bin;                                // text or commit log; binary trace
+    int  lineno;                                        // lines or records read so far
+    long left;                                          // synth: instructions still to make
+    unsigned long long seed;                            // synth: generator state
+    Instr *kernel; int kn, kpos; long iters;            // loop: the instructions, position, passes still to run
+} InstrSource;                                          // end InstrSource
+
+static int text_next(InstrSource *s, Instr *buf, int max) { // text file, one line at a time
+    char line[MAX_LINE];                                // one input line
+    int got = 0;                                        // instructions decoded in this batch
+    while (got < max && in_gets(line, sizeof(line), s->f)) { // read the file line-by-line
+        int r = parse_line(line, &buf[got], ++s->lineno); // parse the current line
+        if (r < 0) return -2;                           // parse error, already reported
+        got += r;                                       // blank and other lines add nothing
+    }                                                   // end of batch or file
+    return got;                                         // how many were decoded
+}                                                       // end text_next
+
+/* ABI register names, by register number */
+static const char *abi_x[REGS_PER_FILE] = { "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "s0", "s1", // x0..x31
+    "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11", // x10..x27
+    "t3", "t4", "t5", "t6" };                           // x28..x31
+static const char *abi_f[REGS_PER_FILE] = { "ft0", "ft1", "ft2", "ft3", "ft4", "ft5", "ft6", "ft7", "fs0", "fs1", // f0..f31
+    "fa0", "fa1", "fa2", "fa3", "fa4", "fa5", "fa6", "fa7", "fs2", "fs3", "fs4", "fs5", "fs6", "fs7", "fs8", "fs9", // f10..f27
+    "fs10", "fs11", "ft8", "ft9", "ft10", "ft11" };     // f28..f31
+
+/* Rewrite the disassembly of one commit record in the text input's syntax: "c." prefixes
+   dropped, mv as mov, two-operand c.add/c.sub widened, ABI names as x<n>/f<n>. */
+static void commit_text(const char *dis, char *out, size_t size) { // disassembly -> input line
+    char mn[16], ops[MAX_LINE];                         // mnemonic, translated operands
+    int j = 0;                                          // length of the mnemonic
+    size_t len = 0;                                     // length of the operands
+    dis += strspn(dis, " \t");                          // skip leading blanks
+    while (*dis && !isspace((unsigned char)*dis) && j < 15) mn[j++] = (char)tolower((unsigned char)*dis++); // mnemonic, lower case
+    mn[j] = '\0';                                       // terminate the mnemonic
+    int compressed = strncmp(mn, "c.", 2) == 0;         // rd doubles as the first source
+    const char *m = compressed ? mn + 2 : mn;           // mnemonic without "c."
+    if (strcmp(m, "mv") == 0) m = "mov";                // the input's name for a register move
+    for (const char *p = dis; *p && len + 24 < sizeof(ops); ) { // operands, names translated
+        if (isalpha((unsigned char)*p)) {               // identifier: maybe an ABI name
+            char w[16], file = 'x'; int k = 0, r;       // identifier, its register file and number
+            while (isalnum((unsigned char)*p) && k < 15) w[k++] = (char)tolower((unsigned char)*p++); // copy the identifier, lower case
+            w[k] = '\0';                                // terminate the identifier
+            r = strcmp(w, "fp") ? -1 : 8;               // fp: the frame pointer, another name for s0
+            for (int i=0;i<REGS_PER_FILE && r < 0;i++)  // look it up in both ABI tables
+                if (!strcmp(w, abi_x[i]) || !strcmp(w, abi_f[i])) { r = i; file = w[0]=='f' ? 'f' : 'x'; } // match: remember number and file
+            if (r >= 0) len += (size_t)snprintf(ops + len, sizeof(ops) - len, "%c%d", file, r); // register as x<n> or f<n>
+            else len += (size_t)snprintf(ops + len, sizeof(ops) - len, "%s", w); // anything else as written
+        }
+        else if (isdigit((unsigned char)*p))            // number: copy whole so 0x10 stays one token
+            while (isalnum((unsigned char)*p) && len + 1 < sizeof(ops)) ops[len++] = *p++; // copy the digits and hex letters
+        else ops[len++] = *p++;                         // punctuation and blanks as they are
+    }
+    ops[len] = '\0';                                    // terminate the operands
+    const char *o = ops + strspn(ops, " \t"), *comma = strchr(o, ','); // first operand and the comma after it
+    if (compressed && comma && !strchr(comma + 1, ',') && (!strcmp(m, "add") || !strcmp(m, "sub"))) // compressed two-operand add/sub
+        snprintf(out, size, "%s %.*s, %s", m, (int)(comma - o), o, o); // "rd, rs" -> "rd, rd, rs"
+    else snprintf(out, size, "%s %s", m, o);            // everything else: mnemonic and operands
+}                                                       // end commit_text
+
+static int commit_next(InstrSource *s, Instr *buf, int max) { // commit log with disassembly
+    char line[MAX_LINE], text[MAX_LINE];                // raw log line, rewritten instruction
+    int got = 0;                                        // instructions decoded in this batch
+    while (got < max && in_gets(line, sizeof(line), s->f)) { // read the log line-by-line
+        const char *word = strstr(line, "(0x");         // instruction word in front of the disassembly
+        const char *dis = word ? strchr(word, ')') : NULL; // end of the instruction word
+        s->lineno++;                                    // line counter for diagnostics
+        if (!dis || strncmp(line + strspn(line, " \t"), "core", 4)) continue; // not a commit record
+        commit_text(dis + 1, text, sizeof(text));       // rewrite in the input's syntax
+        int r = parse_line(text, &buf[got], s->lineno); // parse the rewritten line
+        if (r < 0) return -2;                           // parse error, already reported
+        got += r;                                       // 0 if the line was skipped
+    }
+    return got;                                         // how many were decoded
+}                                                       // end commit_next
+
+/* Binary trace record: byte 0 the opcode (Op), bytes 1..4 the operands in signature order as
+   register id + 1 (0 for an immediate or element width), byte 5 the element width, bytes 8..15
+   the immediate, little-endian. */
+static void trace_encode(const Instr *in, unsigned char *rec) { // Instr -> record
+    const char *sig = op_info[in->op].operands;         // operand signature
+    int src = 0;                                        // next source to store
+    unsigned long long u = (unsigned long long)in->imm; // immediate as raw bits
+    memset(rec, 0, TRACE_RECORD);                       // unused bytes stay 0
+    rec[0] = (unsigned char)in->op;                     // opcode
+    for (int k=0;sig[k];k++) {                          // parse_line's operand order, reversed
+        int id;                                         // register id of operand k (-1: none)
+        if (sig[k]=='i' || sig[k]=='e') id = -1;        // immediate or element width
+        else if (IS_STORE(in->op)) id = in->rs_id[k == 0 ? 1 : 0]; // data, base
+        else if (k == 0) id = in->rd_id;                // first operand: the destination
+        else id = in->rs_id[src++];                     // the others: sources in order
+        rec[1+k] = (unsigned char)(id + 1);             // stored as id + 1
+    }
+    rec[5] = (unsigned char)in->sew;                    // element width
+    for (int b=0;b<8;b++) rec[8+b] = (unsigned char)(u >> (8*b)); // immediate, little-endian
+}                                                       // end trace_encode
+
+static int trace_decode(const unsigned char *rec, Instr *ins) { // record -> Instr; -1 if malformed
+    if (rec[0] >= OP_BAD) return -1;                    // unknown opcode
+    Op op = (Op)rec[0];                                 // opcode
+    const char *sig = op_info[op].operands;             // operand signature
+    char regs[MAX_SRCS+1][16]; int ids[MAX_SRCS+1];     // operand texts and ids for build_instr
+    unsigned long long u = 0;                           // immediate as raw bits
+    for (int b=7;b>=0;b--) u = u << 8 | rec[8+b];       // little-endian
+    long imm = (long)(long long)u;                      // sign-extended
+    int sew = rec[5];                                   // element width
+    if (imm < -(1L << 31) || imm >= (1L << 31)) return -1; // offsets and AVLs are small
+    for (int k=0;sig[k];k++) {                          // rebuild every operand
+        int id = rec[1+k] - 1;                          // register id (-1: immediate or width)
+        char want = sig[k]=='m' ? 'x' : (char)tolower((unsigned char)sig[k]); // register file of the operand
+        ids[k] = -1;                                    // no register unless one is found below
+        if (sig[k]=='i') snprintf(regs[k], sizeof(regs[k]), "%d", (int)imm); // immediate as text
+        else if (sig[k]=='e') {                         // element width
+            if (sew!=8 && sew!=16 && sew!=32 && sew!=64) return -1; // not a width vsetvli accepts
+            snprintf(regs[k], sizeof(regs[k]), "e%d", sew); // as "e<bits>"
+        }
+        else if (id < 0 || id >= NUM_REGS || "xfv"[id / REGS_PER_FILE] != want) return -1; // not a register of the operand's file
+        else { snprintf(regs[k], sizeof(regs[k]), "%c%d", want, id % REGS_PER_FILE); ids[k] = id; } // register name and id
+    }
+    build_instr(ins, op, regs, ids, imm, sew);          // fill in the decoded fields
+    return 0;                                           // record decoded
+}                                                       // end trace_decode
+
+static int trace_next(InstrSource *s, Instr *buf, int max) { // binary trace
+    unsigned char raw[64 * TRACE_RECORD];               // up to 64 records per read
+    int got = 0;                                        // instructions decoded in this batch
+    while (got < max) {                                 // until the batch is full
+        int want = max - got < 64 ? max - got : 64;     // records still wanted, at most 64
+        size_t bytes = fread(raw, 1, (size_t)want * TRACE_RECORD, s->bin); // may end inside a record
+        int k = (int)(bytes / TRACE_RECORD);            // whole records read
+        for (int i=0;i<k;i++, got++)                    // decode each of them
+            if (trace_decode(raw + i * TRACE_RECORD, &buf[got])) { // decode, checking every field
+                fprintf(stderr, "Error: bad record %d in %s\n", s->lineno + i + 1, s->name); // position of the record
+                return -2;                              // malformed record
+            }
+        s->lineno += k;                                 // records read so far
+        if (bytes % TRACE_RECORD) {                     // the file was cut short
+            fprintf(stderr, "Error: truncated record %d in %s\n", s->lineno + 1, s->name); // position of the partial record
+            return -2;                                  // truncated trace
+        }
+        if (k < want) break;                            // end of the trace
+    }
+    return got;                                         // how many were decoded
+}                                                       // end trace_next
+
+static int synth_next(InstrSource *s, Instr *buf, int max) { // pseudo-random scalar code
+    static const Op mix[16] = { OP_ADD, OP_ADD, OP_ADD, OP_ADD, OP_SUB, OP_MOV, OP_MOV, OP_LD, OP_LD, OP_LD,
+                                OP_SD, OP_SD, OP_FADD, OP_FMUL, OP_FLD, OP_FSD }; // roughly integer code with some FP
+    int got = 0;                                        // instructions made in this batch
+    for (; got < max && s->left > 0; got++, s->left--) { // until the batch is full or N are made
+        char regs[MAX_SRCS+1][16]; int ids[MAX_SRCS+1]; // operand texts and ids for build_instr
+        s->seed ^= s->seed >> 12; s->seed ^= s->seed << 25; s->seed ^= s->seed >> 27; // xorshift64*
+        unsigned long long r = s->seed * 2685821657736338717ull; // scrambled output of the generator
+        Op op = mix[r & 15];                            // opcode: low 4 bits
+        const char *sig = op_info[op].operands;         // operand signature
+        r >>= 4;                                        // the rest picks the operands
+        for (int k=0;sig[k];k++, r >>= 4) {             // x1..x15 and f0..f15; bases x1..x4 so addresses repeat
+            int reg = sig[k]=='m' ? 1 + (int)(r & 3) : sig[k]=='f' ? (int)(r & 15) : 1 + (int)(r % 15); // register number of operand k
+            snprintf(regs[k], sizeof(regs[k]), "%c%d", sig[k]=='f' ? 'f' : 'x', reg); // its name
+            ids[k] = reg + (sig[k]=='f' ? REGS_PER_FILE : 0); // and its id
+        }
+        build_instr(&buf[got], op, regs, ids, 8 * (long)(r & 31), 0); // offsets 0..248 in steps of 8
+    }
+    return got;                                         // how many were made
+}                                                       // end synth_next
+
+static int loop_next(InstrSource *s, Instr *buf, int max) { // the kernel, iters times
+    int got = 0;                                        // instructions copied in this batch
+    while (got < max && s->iters > 0) {                 // until the batch is full or every pass is done
+        int k = s->kn - s->kpos < max - got ? s->kn - s->kpos : max - got; // rest of this pass, or what still fits
+        memcpy(buf + got, s->kernel + s->kpos, sizeof(Instr) * (size_t)k); // copy them
+        got += k; s->kpos += k;                         // advance in the batch and in the kernel
+        if (s->kpos == s->kn) { s->kpos = 0; s->iters--; } // next pass
+    }
+    return got;                                         // how many were copied
+}                                                       // end loop_next
+
+static void source_close(InstrSource *s) {              // release whatever the source holds
+    if (s->f) in_close(s->f);                           // text or commit log
+    if (s->bin) fclose(s->bin);                         // binary trace
+    free(s->kernel);                                    // loop kernel
+    s->f = NULL; s->bin = NULL; s->kernel = NULL;       // closing twice is harmless
+}                                                       // end source_close
+
+/* Open the source named by an input argument (see above); returns 0 or an exit code. */
+static int source_open(InstrSource *s, const char *spec) { // pick and open a source
+    char *end;                                          // end of the numbers in spec
+    memset(s, 0, sizeof(*s));                           // no file, no kernel
+    s->name = spec;                                     // file name for messages
+    if (strncmp(spec, "synth:", 6) == 0) {              // synth:N[:SEED]
+        s->left = strtol(spec + 6, &end, 10);           // N
+        s->seed = *end == ':' ? strtoull(end + 1, &end, 10) : 1; // seed, 1 if none
+        if (s->left < 1 || *end) { fprintf(stderr, "Bad source %s (synth:N[:SEED])\n", spec); return 6; } // need N >= 1 and nothing after the seed
+        s->seed += 0x9E3779B97F4A7C15ull;               // any seed, including 0, gives a nonzero state
+        s->next = synth_next;                           // instructions come from the generator
+        return 0;                                       // opened
+    }
+    if (strncmp(spec, "loop:", 5) == 0) {               // read the kernel once, replay it
+        InstrSource k;                                  // the source of the kernel
+        int cap = 0, got, err;                          // kernel capacity, batch size, exit code
+        s->iters = strtol(spec + 5, &end, 10);          // N
+        if (s->iters < 1 || *end != ':') { fprintf(stderr, "Bad source %s (loop:N:SOURCE)\n", spec); return 6; } // need N >= 1 and a source after it
+        if ((err = source_open(&k, end + 1))) return err; // its errors are reported there
+        do {                                            // read the whole kernel
+            if (s->kn + SOURCE_BATCH > cap) {           // make room for one more batch
+                Instr *w = realloc(s->kernel, sizeof(Instr) * (size_t)(cap += cap + SOURCE_BATCH)); // grow by at least one batch
+                if (!w) { fprintf(stderr, "Out of memory\n"); source_close(&k); source_close(s); return 5; } // release both sources
+                s->kernel = w;                          // the grown kernel
+            }
+            got = k.next(&k, s->kernel + s->kn, SOURCE_BATCH); // next batch of the kernel
+            if (got > 0) s->kn += got;                  // append it
+        } while (got > 0);                              // until the end or an error
+        source_close(&k);                               // kernel is in memory
+        if (got < 0) { source_close(s); return -got; }  // error in the kernel's source
+        s->next = loop_next;                            // instructions come from the kernel
+        return 0;                                       // opened
+    }
+    if (strncmp(spec, "trace:", 6) == 0) {              // binary trace from --trace-out
+        char magic[8];                                  // first 8 bytes of the file
+        s->name = spec + 6;                             // file name without "trace:"
+        if (!(s->bin = fopen(s->name, "rb"))) { fprintf(stderr, "Error: cannot open %s\n", s->name); return 1; } // error if cannot open
+        if (fread(magic, 1, 8, s->bin) != 8 || memcmp(magic, TRACE_MAGIC, 8)) { // check the signature
+            fprintf(stderr, "Error: %s is not a binary trace\n", s->name); // not written by --trace-out
+            source_close(s);                            // close the file again
+            return 2;                                   // same code as a parse error
+        }
+        s->next = trace_next;                           // instructions come from the records
+        return 0;                                       // opened
+    }
+    if (strncmp(spec, "commit:", 7) == 0) s->name = spec + 7; // file name without "commit:"
+    if (!(s->f = in_open(s->name))) { fprintf(stderr, "Error: cannot open %s\n", s->name); return 1; } // error if cannot open
+    s->next = s->name == spec ? text_next : commit_next; // plain text unless commit: was given
+    return 0;                                           // opened
+}                                                       // end source_open
+
+/* --trace-out: copy any source into a binary trace, one batch at a time. */
+static int write_trace(InstrSource *src, const char *path) { // returns an exit code
+    FILE *o = fopen(path, "wb");                        // open the trace for writing
+    if (!o) { fprintf(stderr, "Error: cannot write %s\n", path); return 5; } // error if cannot open
+    Instr *buf = malloc(sizeof(Instr) * SOURCE_BATCH);  // one batch of instructions
+    long total = 0;                                     // instructions written
+    int got = 0, bad = !buf || fwrite(TRACE_MAGIC, 1, 8, o) != 8; // the signature first
+    while (!bad && (got = src->next(src, buf, SOURCE_BATCH)) > 0) { // every batch of the source
+        for (int i=0;i<got;i++) {                       // one record per instruction
+            unsigned char rec[TRACE_RECORD];            // its 16 bytes
+            trace_encode(&buf[i], rec);                 // encode it
+            bad |= fwrite(rec, TRACE_RECORD, 1, o) != 1; // write it
+        }
+        total += got;                                   // count the batch
+    }
+    free(buf);                                          // batch buffer
+    bad |= fclose(o) != 0;                              // a failed close is a failed write
+    if (got < 0) return -got;                           // reading the source failed, already reported
+    if (bad) { fprintf(stderr, "Error: writing %s failed\n", path); return 5; } // output error
+    printf("Wrote %ld instructions to %s\n", total, path); // summary line
+    return 0;                                           // trace written
+}                                                       // end write_trace
+
+/* Utility: "sub rd, rs, rs" always writes zero regardless of rs */
+static int is_zero_idiom(const Instr *ins) {            // recognize the zeroing idiom
+    return ins->op==OP_SUB && ins->rs_id[0]==ins->rs_id[1]; // both sources name the same register
+}                                                      // end is_zero_idiom
+
+/* Whether b consumes a's result and an enabled rule pairs them */
+static int fusable(const Instr *a, const Instr *b, unsigned rules) { // one candidate pair
+    int dep = 0;                                       // second must consume first's result
+    for (int k=0;k<b->rs_count && a->rd_id >= 0;k++) dep |= (b->rs_id[k]==a->rd_id);
+    for (int r=0;r<NUM_FUSE_RULES && dep;r++) {        // look for a matching enabled rule
+        if (!(rules & (1u<<r))) continue;              // rule disabled
+        if (a->op!=fuse_rules[r].first || b->op!=fuse_rules[r].second) continue; // opcodes differ
+        if (fuse_rules[r].same_rd && b->rd_id!=a->rd_id) continue; // needs a shared destination
+        return 1;
+    }
+    return 0;                                          // no rule applies
+}                                                      // end fusable
+
+/* Fusion stage between IF and ID: pair up adjacent instructions that match an enabled rule.
+   The head of a pair occupies the pipeline slot and the tail rides along with it.
+   Returns the number of fused pairs. */
+static int fuse_pairs(Instr *prog, int n, unsigned rules) { // assign slots and fused roles
+    int pairs=0, slot=0;                               // fused pair count and next slot number
+    for (int i=0;i<n;i++) prog[i].fused = FUSED_NONE;  // start with every instruction unfused
+    for (int i=0;i<n;i++) {                            // walk the program in fetch order
+        prog[i].slot = slot++;                         // instruction opens a new slot
+        if (i+1 >= n) break;                           // last instruction has no partner
+        if (fusable(&prog[i], &prog[i+1], rules)) {    // greedy: the earlier pair wins
+            prog[i].fused = FUSED_HEAD;                // head carries the slot through the pipe
+            prog[i+1].fused = FUSED_TAIL;              // tail shares it
+            prog[i+1].slot = prog[i].slot;
+            pairs++; i++;                              // skip the tail in the scan
+        }
+    }
+    return pairs;                                      // number of pairs formed
+}                                                      // end fuse_pairs
+
+/* Parse "--fuse" (all rules) or "--fuse=name,name,..." into a rule mask; -1 on an unknown name */
+static long parse_fuse_rules(const char *arg) {         // command-line helper for fusion rules
+    if (strcmp(arg, "--fuse")==0) return (1L<<NUM_FUSE_RULES)-1; // bare flag enables every rule
+    unsigned mask=0;                                   // accumulated rule bits
+    const char *p = arg + strlen("--fuse=");           // start of the comma-separated list
+    while (*p) {                                       // for each listed name
+        size_t len = strcspn(p, ",");                  // length of this name
+        int found=0;                                   // whether it names a rule
+        for (int r=0;r<NUM_FUSE_RULES;r++)             // search the rule table
+            if (strlen(fuse_rules[r].name)==len && strncmp(p, fuse_rules[r].name, len)==0) { mask |= 1u<<r; found=1; }
+        if (!found) return -1;                         // unknown rule name
+        p += len;                                      // move past the name
+        if (*p==',') p++;                              // and its separator
+    }
+    return mask;                                       // enabled rule mask
+}                                                      // end parse_fuse_rules
+
+/* Rename pass run once before simulation: for every source register, record which earlier
+   instruction actually produces the value. With OPT_MOVE_ELIM a mov produces nothing and its
+   rd aliases the producer of its source; with OPT_ZERO_IDIOM a zeroing sub reads nothing and
+   leaves its rd immediately ready. Without options this is the plain last-writer table. */
+static void resolve_producers(Instr *prog, int n, int opts) { // fill prog[i].prod[]
+    int producer[NUM_REGS];                            // last physical producer per register
+    for (int r=0;r<NUM_REGS;r++) producer[r] = -1;     // initially every register is ready
+    for (int i=0;i<n;i++) {                            // walk the program in order
+        Instr *in = &prog[i];                          // current instruction
+        for (int k=0;k<MAX_SRCS;k++) in->prod[k] = -1; // default: no dependency
+        in->elim = 0;                                  // default: executes normally
+        if ((opts & OPT_ZERO_IDIOM) && !in->fused && is_zero_idiom(in)) { // zero idiom: no inputs, rd ready
+            producer[in->rd_id] = -1;
+            in->elim = 1;
+            continue;
+        }
+        if ((opts & OPT_MOVE_ELIM) && !in->fused && in->op == OP_MOV) { // eliminated mov: alias rd to source producer
+            producer[in->rd_id] = producer[in->rs_id[0]];
+            in->elim = 1;
+            continue;
+        }
+        for (int k=0;k<in->rs_count;k++)               // ordinary instruction: look up each source
+            if (!IS_VEC_REG(in->rs_id[k]))             // (the vector unit tracks vector registers itself)
+                in->prod[k] = producer[in->rs_id[k]];
+        if (in->rd_id >= 0) producer[in->rd_id] = i;   // and become the producer of rd (sd writes none)
+    }
+}                                                      // end resolve_producers
+
+/* vl seen by each vector op: set by the latest vsetvli/vsetivli. The AVL register's value is
+   not known statically, so vsetvli grants VLMAX = VLEN/SEW and vsetivli grants min(imm, VLMAX).
+   Before the first vsetvli, e32 with vl = VLMAX is assumed. */
+static void assign_vl(Instr *prog, int n, int vlen) {  // fill prog[i].vl
+    int vl = vlen / 32;                                // initial vl (e32)
+    for (int i=0;i<n;i++) {                            // program order
+        Instr *in = &prog[i];
+        if (in->op == OP_VSETVLI) vl = vlen / in->sew; // VLMAX for the new element width
+        else if (in->op == OP_VSETIVLI) vl = (in->imm < vlen / in->sew) ? (int)in->imm : vlen / in->sew; // capped AVL
+        in->vl = vl;                                   // vl in effect for this instruction
+    }
+}                                                      // end assign_vl
+
+/* Register values are not simulated, so addresses are symbolic: two accesses are compared
+   byte by byte only when their base registers hold the same value (same last writer). Accesses
+   off different base values are assumed not to overlap. */
+static void assign_addresses(Instr *prog, int n) {     // fill prog[i].addr_key
+    int writer[NUM_REGS];                              // last writer per register (no renaming)
+    for (int r=0;r<NUM_REGS;r++) writer[r] = -1 - r;   // initial value of each register
+    for (int i=0;i<n;i++) {                            // program order
+        if (IS_MEM(prog[i].op)) prog[i].addr_key = writer[prog[i].rs_id[0]]; // rs[0] is the base
+        if (prog[i].rd_id >= 0) writer[prog[i].rd_id] = i;
+    }
+}                                                      // end assign_addresses
+
+/* Text of the slot headed by idx: the instruction itself, or "head + tail" for a fused pair */
+static const char *slot_text(int idx, Instr *prog, char *buf, size_t sz) { // format a slot for output
+    if (prog[idx].fused != FUSED_HEAD) return prog[idx].text; // ordinary slot: one instruction
+    snprintf(buf, sz, "%s + %s", prog[idx].text, prog[idx+1].text); // fused slot: both halves
+    return buf;                                        // caller-provided buffer
+}                                                      // end slot_text
+
+/* Vector unit state. Ops issue in order, at most one per cycle, each to its own unit where it
+   occupies ceil(vl/lanes) cycles. Without chaining a consumer waits for every element group of
+   its vector sources; with chaining it starts once the first group is readable, and then stays
+   behind the producer group by group because both process one group per cycle. */
+typedef struct {                                       // decoupled vector unit
+    int unit_free[VU_COUNT];                           // first cycle each unit can accept a new op
+    int first[REGS_PER_FILE];                          // per vector register: cycle its first element group can be read
+    int done[REGS_PER_FILE];                           // per vector register: cycle all of its groups can be read
+    int last_start;                                    // start cycle of the previous vector op
+} VecState;                                            // end VecState
+
+/* Start a vector op dispatched from EX in cycle `dispatch`; returns the cycle its last result is written */
+static int vector_issue(Instr *in, int dispatch, const VecConfig *vc, VecState *vs, VecStats *st) { // vector issue
+    int unit = op_info[in->op].vec_unit, lat = vc->lat[in->op]; // target unit and pipeline depth
+    int groups = in->vl > vc->lanes ? (in->vl + vc->lanes - 1) / vc->lanes : 1; // ceil(vl/lanes) cycles
+    int start = dispatch, chained = 0;                 // earliest start: the dispatch cycle
+    if (start <= vs->last_start) start = vs->last_start + 1; // in order, one start per cycle
+    if (start < vs->unit_free[unit]) start = vs->unit_free[unit]; // unit still busy with an older op
+    for (int k=0;k<in->rs_count;k++) {                 // vector sources
+        if (!IS_VEC_REG(in->rs_id[k])) continue;       // scalar base registers were read in ID
+        int v = in->rs_id[k] - 2*REGS_PER_FILE;
+        int need = vc->chain ? vs->first[v] : vs->done[v]; // first group (chaining) or whole register
+        if (start < need) start = need;
+    }
+    int vd = (in->rd_id >= 0 && IS_VEC_REG(in->rd_id)) ? in->rd_id - 2*REGS_PER_FILE : -1; // vector destination
+    if (vd >= 0 && start + groups - 1 + lat <= vs->done[vd]) // WAW: finish after the older write
+        start = vs->done[vd] - groups - lat + 2;
+    for (int k=0;k<in->rs_count;k++)                   // overlapped a producer that is still running?
+        if (IS_VEC_REG(in->rs_id[k]) && start < vs->done[in->rs_id[k] - 2*REGS_PER_FILE]) chained = 1;
+    in->vstart = start;                                // first element group enters the unit
+    in->vend = start + groups + lat - 2;               // last element group's result is written
+    vs->unit_free[unit] = start + groups;              // unit occupancy
+    vs->last_start = start;
+    if (vd >= 0) { vs->first[vd] = start + lat; vs->done[vd] = start + groups - 1 + lat; } // readiness of vd
+    st->ops++; st->chained += chained;                 // activity counters
+    st->busy[unit] += groups; st->elems += in->vl; st->wait += start - dispatch;
+    return in->vend;
+}                                                      // end vector_issue
+
+/* Text of the vector ops inside the vector unit in this cycle ("a; b"), searching prog[lo..hi-1] */
+static int vector_column(Instr *prog, int lo, int hi, int cycle, char *buf, size_t sz) { // CSV/trace helper
+    int count = 0, len = 0;                            // ops found, characters written
+    buf[0] = '\0';
+    for (int i=lo;i<hi;i++) {                          // dispatched ops have vstart > 0
+        if (!op_info[prog[i].op].vec_unit || prog[i].vstart <= 0) continue;
+        if (cycle < prog[i].vstart || cycle > prog[i].vend) continue; // not in the unit this cycle
+        if (len < (int)sz) len += snprintf(buf+len, sz-len, "%s%s", count ? "; " : "", prog[i].text);
+        count++;
+    }
+    return count;                                      // 0 when the unit is idle
+}                                                      // end vector_column
+
+/* TLB contents. Register values are not simulated, so a data page is named by the value of the
+   base register (its addr_key) and the page number of the offset within that value's region;
+   instruction pages come from PC = 4 * index. Each TLB is set-associative with LRU replacement. */
+typedef struct {                                       // one TLB
+    int sets, ways;                                    // geometry (0 sets = not modelled)
+    unsigned long long tag[MAX_TLB];                   // tag[set*ways + w]; 0 = invalid
+    unsigned long stamp[MAX_TLB];                      // last use, for LRU
+} Tlb;                                                 // end Tlb
+typedef struct {                                       // translation state of one run
+    Tlb tlb[TLB_COUNT];                                // ITLB, DTLB, L2 TLB
+    unsigned long clock;                               // LRU time
+} Mmu;                                                 // end Mmu
+#define INSTR_KEY (-1000000)                           // addr_key of the code region
+
+/* Look tag up in t; on a miss, install it in place of the LRU way. Returns 1 on a hit. */
+static int tlb_access(Tlb *t, unsigned long long tag, unsigned long now) { // TLB lookup/fill
+    int set = (int)((tag * 0x9E3779B97F4A7C15ULL >> 40) % (unsigned)t->sets); // hashed set index
+    unsigned long long *row = &t->tag[set * t->ways];  // ways of the set
+    unsigned long *age = &t->stamp[set * t->ways];
+    int victim = 0;                                    // least recently used way
+    for (int w=0;w<t->ways;w++) {
+        if (row[w] == tag) { age[w] = now; return 1; } // hit
+        if (age[w] < age[victim]) victim = w;
+    }
+    row[victim] = tag; age[victim] = now;              // install the translation
+    return 0;                                          // miss
+}                                                      // end tlb_access
+
+/* Cycles to translate page `page` of region `key` through L1 TLB `which` and the L2 TLB.
+   A walk reads one page-table entry per level (4 levels for 4 KiB pages, 3 for 2 MiB, 2 for 1 GiB),
+   each through the data cache unless a fixed walk latency is configured. */
+static int translate(Mmu *mmu, const Resources *res, int which, int key, long page, int shift, RunStats *st) { // TLB lookup
+    const TlbConfig *tc = &res->tlb;
+    if (tc->entries[which] == 0) return 0;             // translation not modelled
+    unsigned long long tag = ((unsigned long long)(unsigned)key << 32 ^ (unsigned)page) << 2 | (unsigned)(shift/9 - 1);
+    tag |= 1ULL << 63;                                 // never 0 (invalid)
+    unsigned long now = ++mmu->clock;                  // LRU time
+    if (tlb_access(&mmu->tlb[which], tag, now)) { st->tlb_hits[which]++; return 0; } // L1 hit: free
+    st->tlb_misses[which]++;
+    int lat = 0;                                       // cost of the miss
+    if (tc->entries[TLB_L2]) {                         // shared second level
+        lat = tc->l2_lat;
+        if (tlb_access(&mmu->tlb[TLB_L2], tag, now)) { st->tlb_hits[TLB_L2]++; return lat; }
+        st->tlb_misses[TLB_L2]++;
+    }
+    int levels = 4 - (shift - 12) / 9;                 // huge pages end the walk early
+    int walk = levels * (tc->walk_lat ? tc->walk_lat : res->dcache_lat); // one PTE read per level
+    st->walks++; st->walk_cycles += walk;
+    return lat + walk;
+}                                                      // end translate
+
+/* MESI directory. Each line records every hart's state and the bytes the hart touched since it
+   got the line; an invalidation of a hart that never touched the bytes being written is counted
+   as false sharing. Harts only read the directory while they step; their requests are applied
+   between cycles in hart order, so a run is deterministic however the harts are scheduled. */
+enum { CS_I, CS_S, CS_E, CS_M };                       // MESI states
+typedef struct {                                       // one directory entry
+    unsigned long long tag;                            // line name (0 = free slot)
+    unsigned char state[MAX_HARTS];                    // per-hart MESI state
+    unsigned long long touched[MAX_HARTS];             // bytes each hart accessed since it got the line
+} CohLine;                                             // end CohLine
+typedef struct { int hart, write; unsigned long long tag, mask; } CohReq; // one access to apply
+typedef struct {                                       // shared coherence state
+    CohLine *lines; int cap;                           // open-addressed directory (cap is a power of two)
+    int harts;                                         // cores sharing it
+    long l2_fills, c2c, upgrades;                      // misses served by L2, by another L1D, and S -> M upgrades
+    long invalidations, false_sharing, writebacks;     // copies invalidated, of which falsely shared, dirty lines written back
+} Coherence;                                           // end Coherence
+
+/* Directory slot of tag, or NULL when absent and insert is 0. */
+static CohLine *coh_find(Coherence *co, unsigned long long tag, int insert) { // directory lookup
+    unsigned h = (unsigned)(tag * 0x9E3779B97F4A7C15ULL >> 40) & (unsigned)(co->cap - 1);
+    while (co->lines[h].tag && co->lines[h].tag != tag) h = (h + 1) & (unsigned)(co->cap - 1); // linear probing
+    if (co->lines[h].tag == 0) {                       // not present
+        if (!insert) return NULL;
+        co->lines[h].tag = tag;                        // every hart starts in I
+    }
+    return &co->lines[h];
+}                                                      // end coh_find
+
+/* Line name and byte mask of the access [lo,hi) off base value key (bytes past the line are ignored). */
+static unsigned long long coh_line(int key, long lo, long hi, unsigned long long *mask) { // address -> line
+    long line = lo >= 0 ? lo / LINE_BYTES : -((-lo + LINE_BYTES - 1) / LINE_BYTES); // floor
+    int first = (int)(lo - line * LINE_BYTES);         // byte offset within the line
+    int last = hi - line * LINE_BYTES > LINE_BYTES ? LINE_BYTES : (int)(hi - line * LINE_BYTES);
+    *mask = (last - first == 64 ? ~0ULL : ((1ULL << (last - first)) - 1)) << first;
+    return ((unsigned long long)(unsigned)key << 32 ^ (unsigned)line) | 1ULL << 63; // never 0 (free)
+}                                                      // end coh_line
+
+/* Cycles hart needs for an access to tag, judged from the directory as of the previous cycle. */
+static int coh_latency(Coherence *co, const Resources *res, int hart, unsigned long long tag, int write) { // L1D outcome
+    const CohLine *l = coh_find(co, tag, 0);
+    int own = l ? l->state[hart] : CS_I, dirty_elsewhere = 0; // this hart's copy; another hart holds it modified
+    for (int h=0;l && h<co->harts;h++) dirty_elsewhere |= h != hart && l->state[h] == CS_M;
+    if (own == CS_M || own == CS_E || (own == CS_S && !write)) return res->dcache_lat; // L1D hit
+    if (own == CS_S) return res->coh.upgrade_lat;      // write to a shared copy: invalidate the others
+    return dirty_elsewhere ? res->coh.c2c_lat : res->coh.l2_lat; // miss: another L1D or the L2 answers
+}                                                      // end coh_latency
+
+/* Apply one access to the directory: MESI transitions, invalidations and traffic counters. */
+static void coh_apply(Coherence *co, const CohReq *r) { // directory update
+    CohLine *l = coh_find(co, r->tag, 1);
+    int own = l->state[r->hart], others = 0, dirty = 0; // harts holding a valid copy, one of them modified
+    for (int h=0;h<co->harts;h++) if (h != r->hart && l->state[h] != CS_I) { others++; dirty |= l->state[h] == CS_M; }
+    if (own == CS_I) {                                 // miss: fetch the line
+        if (dirty) { co->c2c++; co->writebacks++; }    // the modified copy supplies it and is written back
+        else co->l2_fills++;
+        l->touched[r->hart] = 0;
+    }
+    if (!r->write) {                                   // read: the other copies drop to S
+        if (own == CS_I) {
+            for (int h=0;h<co->harts;h++) if (h != r->hart && l->state[h] != CS_I) l->state[h] = CS_S;
+            l->state[r->hart] = others ? CS_S : CS_E;
+        }
+    }
+    else {                                             // write: invalidate every other copy
+        if (own == CS_S) co->upgrades++;
+        for (int h=0;h<co->harts;h++) {
+            if (h == r->hart || l->state[h] == CS_I) continue;
+            co->invalidations++;
+            if (!(l->touched[h] & r->mask)) co->false_sharing++; // the line moved only for its neighbours
+            l->state[h] = CS_I; l->touched[h] = 0;
+        }
+        l->state[r->hart] = CS_M;                      // E -> M silently
+    }
+    l->touched[r->hart] |= r->mask;
+}                                                      // end coh_apply
+
+/* Data-memory side of MEM: a pipelined data cache that accepts one access per cycle and
+   answers after dcache_lat cycles, plus an optional FIFO store buffer. Without a store buffer a
+   store waits in MEM for its write like a load; with one it retires into the buffer in one cycle,
+   and the buffer drains one entry per cycle in which MEM is not starting an access itself.
+   Loads check the buffer first: the youngest overlapping store either covers the load (the value
+   is forwarded in one cycle) or overlaps it partially (the load waits until that store drains). */
+typedef struct { int key; long lo, hi; int idx; } SBEntry; // buffered store: [lo,hi) off base value key
+typedef struct {                                       // MEM-stage memory state
+    SBEntry sb[MAX_SB];                                // FIFO ring of buffered stores
+    int sb_head, sb_count;                             // oldest entry and number of entries
+    int mem_idx;                                       // MEM occupant the fields below describe (-1 none)
+    int mem_left;                                      // cycles until the occupant's cache access answers (0 = not started)
+    int mem_done;                                      // 1 once the occupant may move on to WB
+    int why;                                           // reason the occupant is still waiting (MW_*)
+    int tlb_left;                                      // translation cycles the occupant still needs
+    Mmu *mmu;                                          // TLBs shared with instruction fetch
+    Coherence *coh;                                    // multicore directory (NULL for a single core)
+    int hart;                                          // this core's number
+    CohReq req[2];                                     // accesses of this cycle: one from MEM, one drain
+    int nreq;
+} MemState;                                            // end MemState
+enum { MW_CACHE, MW_SB_FULL, MW_PARTIAL, MW_TLB, MW_COH }; // why MEM holds its occupant
+
+/* Latency of an access by this core, queueing it for the directory (dcache_lat for a single core). */
+static int coh_access(MemState *ms, const Resources *res, int key, long lo, long hi, int write, int timed) { // L1D access
+    if (!ms->coh) return res->dcache_lat;              // no coherence model
+    CohReq *r = &ms->req[ms->nreq++];                  // applied after every hart has stepped
+    r->hart = ms->hart; r->write = write;
+    r->tag = coh_line(key, lo, hi, &r->mask);
+    return timed ? coh_latency(ms->coh, res, ms->hart, r->tag, write) : 0;
+}                                                      // end coh_access
+
+/* One cycle of data-memory work for the slot in MEM and the store buffer. `flush` forces drains
+   once every instruction has retired. */
+static void mem_cycle(int mem_idx, Instr *prog, const Resources *res, MemState *ms, RunStats *st,
+                      int cycle, int trace, int flush) { // MEM stage memory access
+    int port_used = 0, force = flush;                  // cache port taken this cycle; drain regardless of policy
+    if (mem_idx != ms->mem_idx) {                      // a new slot entered MEM
+        ms->mem_idx = mem_idx; ms->mem_left = 0; ms->mem_done = 0; ms->tlb_left = 0;
+        if (mem_idx >= 0 && IS_MEM(prog[mem_idx].op)) { // translate the data address first
+            int shift = res->tlb.data_page_shift;
+            ms->tlb_left = translate(ms->mmu, res, TLB_D, prog[mem_idx].addr_key, prog[mem_idx].imm >> shift, shift, st);
+            if (!IS_STORE(prog[mem_idx].op)) st->loads++;
+        }
+    }
+    if (mem_idx >= 0 && !ms->mem_done) {               // the occupant still has work to do
+        const Instr *in = &prog[mem_idx];
+        long lo = in->imm + (long)ms->hart * res->coh.hart_stride, hi = lo + ACCESS_BYTES; // bytes touched off the base value
+        if (!IS_MEM(in->op)) ms->mem_done = 1;         // ALU ops bypass the data cache
+        else if (ms->tlb_left > 0) { ms->tlb_left--; ms->why = MW_TLB; } // DTLB miss being serviced
+        else if (IS_STORE(in->op) && res->sb_entries > 0) { // store retires into the store buffer
+            if (ms->sb_count < res->sb_entries) {
+                SBEntry *e = &ms->sb[(ms->sb_head + ms->sb_count++) % MAX_SB];
+                st->act[EV_SB]++;                      // buffer write
+                e->key = in->addr_key; e->lo = lo; e->hi = hi; e->idx = mem_idx;
+                ms->mem_done = 1;
+                if (ms->sb_count > st->sb_peak) st->sb_peak = ms->sb_count; // peak before any drain
+                if (trace) printf("C%3d: SB     [%2d] %s buffered (%d/%d entries)\n", cycle, mem_idx, in->text,
+                                  ms->sb_count, res->sb_entries);
+            }
+            else ms->why = MW_SB_FULL;                 // wait for a drain
+        }
+        else if (ms->mem_left > 0) {                   // access in flight: wait for the answer
+            if (--ms->mem_left == 0) ms->mem_done = 1;
+        }
+        else {                                         // load (or store without a buffer) about to access
+            int verdict = 0;                           // 1 forwarded, -1 partial overlap
+            if (res->sb_entries > 0 && !IS_STORE(in->op)) st->act[EV_SB]++; // buffer search
+            for (int k=ms->sb_count-1;k>=0 && !IS_STORE(in->op);k--) { // youngest store first
+                const SBEntry *e = &ms->sb[(ms->sb_head + k) % MAX_SB];
+                if (e->key != in->addr_key || e->hi <= lo || hi <= e->lo) continue; // no overlap
+                verdict = (e->lo <= lo && hi <= e->hi) ? 1 : -1; // covered, or only partly
+                break;
+            }
+            if (verdict > 0) {                         // store-to-load forwarding
+                ms->mem_done = 1; st->forwards++;
+                if (trace) printf("C%3d: SB     [%2d] %s forwarded from the store buffer\n", cycle, mem_idx, in->text);
+            }
+            else if (verdict < 0) { ms->why = MW_PARTIAL; force = 1; } // must drain the overlapping store first
+            else {                                     // start the cache access
+                port_used = 1; st->act[EV_DCACHE]++;
+                int lat = coh_access(ms, res, in->addr_key, lo, hi, IS_STORE(in->op), 1);
+                ms->mem_left = lat - 1;                // cycles still to wait after this one
+                if (ms->mem_left == 0) ms->mem_done = 1;
+                else ms->why = lat > res->dcache_lat ? MW_COH : MW_CACHE;
+            }
+        }
+    }
+    if (!port_used && ms->sb_count > 0                 // drain the oldest store when the port is free
+        && (res->sb_drain == SB_EAGER || force || ms->sb_count == res->sb_entries)) {
+        if (trace) printf("C%3d: SB     [%2d] %s drained to the cache\n", cycle, ms->sb[ms->sb_head].idx,
+                          prog[ms->sb[ms->sb_head].idx].text);
+        const SBEntry *e = &ms->sb[ms->sb_head];
+        coh_access(ms, res, e->key, e->lo, e->hi, 1, 0); // the buffer hides the write's latency
+        st->act[EV_DCACHE]++;
+        ms->sb_head = (ms->sb_head + 1) % MAX_SB; ms->sb_count--;
+    }
+    st->sb_occupancy += ms->sb_count;                  // entries held at the end of the cycle
+}                                                      // end mem_cycle
 
 /* Human-readable trace helpers: these functions print the action in the named stage.
    They do not modify pipeline state; they are only for logging/tracing output. */
 static void fetch_trace(int idx, Instr *prog, int cycle) { // log fetch stage activity
-    if (idx >= 0) printf("C%3d: FETCH  [%2d] %s\n", cycle, idx, prog[idx].text); // print IF stage
+    char b[300];                                        // room for a fused pair
+    if (idx >= 0) printf("C%3d: FETCH  [%2d] %s\n", cycle, idx, slot_text(idx, prog, b, sizeof(b))); // print IF stage
 }
 static void decode_trace(int idx, Instr *prog, int cycle) { // log decode stage
-    if (idx >= 0) printf("C%3d: DECODE [%2d] %s\n", cycle, idx, prog[idx].text); // print ID stage
+    char b[300];
+    if (idx >= 0) printf("C%3d: DECODE [%2d] %s\n", cycle, idx, slot_text(idx, prog, b, sizeof(b))); // print ID stage
 }
 static void execute_trace(int idx, Instr *prog, int cycle) { // log execute stage
-    if (idx >= 0) printf("C%3d: EXEC   [%2d] %s\n", cycle, idx, prog[idx].text); // print EX stage
+    char b[300];
+    if (idx >= 0) printf("C%3d: EXEC   [%2d] %s\n", cycle, idx, slot_text(idx, prog, b, sizeof(b))); // print EX stage
+}
+static void memory_trace(int idx, Instr *prog, int cycle) {  // log memory stage (ALU ops bypass it)
+    char b[300];
+    if (idx >= 0) printf("C%3d: MEM    [%2d] %s (%s)\n", cycle, idx, slot_text(idx, prog, b, sizeof(b)),
+                         IS_STORE(prog[idx].op) ? "store" : IS_MEM(prog[idx].op) ? "load" : "bypassed"); // MEM stage trace
 }
-static void memory_trace(int idx, Instr *prog, int cycle) {  // log memory stage (bypassed for now)
-    if (idx >= 0) printf("C%3d: MEM    [%2d] %s (bypassed)\n", cycle, idx, prog[idx].text); // MEM stage trace
+static void fpu_trace(const int *fpu, Instr *prog, int cycle) { // log FP unit occupants
+    for (int q=MAX_FP_LAT-1;q>=0;q--)                   // youngest first, like the stage order above
+        if (fpu[q] >= 0) printf("C%3d: FPU    [%2d] %s (%d to MEM)\n", cycle, fpu[q], prog[fpu[q]].text, q+1);
 }
-static void write_back_action(int idx, Instr *prog, int cycle) { // perform write-back logging
+static void vector_trace(Instr *prog, int lo, int hi, int cycle, const VecConfig *vc) { // log vector unit occupants
+    for (int i=lo;i<hi;i++) {                          // dispatched vector ops inside the unit
+        if (!op_info[prog[i].op].vec_unit || prog[i].vstart <= 0) continue;
+        if (cycle < prog[i].vstart || cycle > prog[i].vend) continue;
+        int groups = prog[i].vl > vc->lanes ? (prog[i].vl + vc->lanes - 1) / vc->lanes : 1; // element groups
+        int g = cycle - prog[i].vstart + 1;            // group entering the unit this cycle
+        if (g <= groups) printf("C%3d: VEC    [%2d] %s (%s, group %d/%d)\n", cycle, i, prog[i].text,
+                                vu_names[op_info[prog[i].op].vec_unit], g, groups);
+        else printf("C%3d: VEC    [%2d] %s (%s, draining)\n", cycle, i, prog[i].text, vu_names[op_info[prog[i].op].vec_unit]);
+    }
+}
+static void write_back_action(int idx, Instr *prog, int cycle, int trace) { // perform write-back logging
     if (idx >= 0) {                                     // only if there is an instruction in WB
-        printf("C%3d: WB     [%2d] %s -> write %s\n", cycle, idx, prog[idx].text, prog[idx].rd); // trace write
+        if (trace) printf("C%3d: WB     [%2d] %s -> write %s\n", cycle, idx, prog[idx].text,
+                          prog[idx].rd_id >= 0 ? prog[idx].rd : "nothing"); // trace write
         prog[idx].finished = 1;                        // mark instruction as finished (WB completed)
+        if (prog[idx].fused == FUSED_HEAD) {           // the fused tail retires in the same cycle
+            if (trace) printf("C%3d: WB     [%2d] %s -> write %s (fused)\n", cycle, idx+1, prog[idx+1].text, prog[idx+1].rd);
+            prog[idx+1].finished = 1;
+        }
     }
 }                                                      // end write_back_action
 
 /* Determine the number of stall bubbles required if an instruction is currently in ID:
    - if the instruction in EX will write a register that ID reads -> need 2 bubbles
    - if the instruction in MEM will write a register that ID reads -> need 1 bubble
-   This matches the no-forwarding RAW stall model used earlier. */
-static int needed_stalls_for_id(int id_idx, int ex_idx, int mem_idx, Instr *prog) { // hazard detection
+   - if the instruction in FP unit position k (k+1 cycles from MEM) writes it -> need k+2 bubbles
+   This matches the no-forwarding RAW stall model used earlier. *fp_src is set when the
+   binding source is an FP register, so the caller can attribute the bubbles. */
+static int needed_stalls_for_id(int id_idx, int ex_idx, int mem_idx, const int *fpu, Instr *prog, int *fp_src) { // hazard detection
+    *fp_src = 0;                                       // integer unless an FP source binds
     if (id_idx < 0) return 0;                          // nothing in ID -> no stalls needed
-    if (ex_idx >= 0 && reg_in_sources(prog[ex_idx].rd, &prog[id_idx])) return 2; // EX producer -> 2 cycles
-    if (mem_idx >= 0 && reg_in_sources(prog[mem_idx].rd, &prog[id_idx])) return 1; // MEM producer -> 1 cycle
-    return 0;                                          // no RAW hazard -> 0 stalls
+    int last = id_idx + (prog[id_idx].fused == FUSED_HEAD); // a fused slot checks both halves' sources
+    int req = 0;                                       // worst case over all sources
+    for (int i=id_idx;i<=last;i++) {
+        for (int k=0;k<prog[i].rs_count;k++) {         // producers of each source (from resolve_producers)
+            int p = prog[i].prod[k], need = 0;
+            if (p < 0) continue;                       // value already available
+            if (ex_idx >= 0 && prog[p].slot == prog[ex_idx].slot) need = 2;          // EX producer -> 2 cycles
+            else if (mem_idx >= 0 && prog[p].slot == prog[mem_idx].slot) need = 1;   // MEM producer -> 1 cycle
+            else for (int q=0;q<MAX_FP_LAT;q++)        // FP unit producer -> distance to MEM + 1
+                if (fpu[q] == p) need = q + 2;
+            if (need > req) { req = need; *fp_src = IS_FP_REG(prog[i].rs_id[k]); }
+        }
+    }
+    return req;                                        // 0 when there is no RAW hazard
 }                                                      // end needed_stalls_for_id
 
-int main(int argc, char **argv) {                       // program entry point
-    const char *infile = (argc>=2? argv[1] : "instructions.txt"); // input filename or default
+/* Cycles the slot spends between ID and MEM: 1 in EX, or its latency on the FP unit */
+static int slot_latency(int idx, Instr *prog, const Resources *res) { // EX-or-FPU occupancy
+    int last = idx + (prog[idx].fused == FUSED_HEAD);  // fused halves share the slot
+    int lat = 1;                                       // integer EX takes one cycle
+    for (int i=idx;i<=last;i++)
+        if (op_info[prog[i].op].fp_unit && res->unit_lat[prog[i].op] > lat) lat = res->unit_lat[prog[i].op];
+    return lat;
+}                                                      // end slot_latency
+
+/* Can the slot in ID leave for EX (latency 1) or the FP unit this cycle? The FP unit is
+   pipelined, so the slot only waits when
+   - its MEM entry cycle is already claimed by an older op (fpu[lat-1] is occupied), or
+   - an older op still in the FP unit writes the same register and would reach WB no earlier (WAW). */
+static int can_issue(int idx, Instr *prog, const int *fpu, const Resources *res) { // FP unit issue check
+    int lat = slot_latency(idx, prog, res);            // MEM is reached after lat cycles
+    if (fpu[lat-1] >= 0) return 0;                     // one result enters MEM per cycle
+    int last = idx + (prog[idx].fused == FUSED_HEAD);
+    for (int q=lat-1;q<MAX_FP_LAT;q++) {               // older ops finishing at or after this one
+        if (fpu[q] < 0) continue;
+        for (int i=idx;i<=last;i++)
+            if (prog[i].rd_id >= 0 && prog[i].rd_id == prog[fpu[q]].rd_id) return 0; // would be overwritten late
+    }
+    return 1;                                          // issue now
+}                                                      // end can_issue
 
-    FILE *f = fopen(infile, "r");                       // open the input file for reading
-    if (!f) { fprintf(stderr, "Error: cannot open %s\n", infile); return 1; } // error if cannot open
+/* EX -> MEM: MEM takes the EX occupant, or the FP op finishing this cycle; the FP unit advances */
+static void advance_execute(int pipe[5], int fpu[MAX_FP_LAT]) { // move one result into MEM
+    if (pipe[2] >= 0) { pipe[3] = pipe[2]; pipe[2] = -1; } // EX -> MEM
+    else if (fpu[0] >= 0) pipe[3] = fpu[0];            // FP unit -> MEM (can_issue keeps these exclusive)
+    memmove(fpu, fpu+1, (MAX_FP_LAT-1)*sizeof(int));    // every FP op moves one step closer to MEM
+    fpu[MAX_FP_LAT-1] = -1;                            // entry position becomes free
+}                                                      // end advance_execute
 
-    Instr prog[MAX_INSTR];                              // array to hold parsed instructions
-    int n=0, lineno=0;                                  // n = count parsed, lineno = input line number
-    char line[MAX_LINE];                                // buffer to read each input line
 
-    while (fgets(line, sizeof(line), f)) {              // read the file line-by-line
-        lineno++;                                       // increment line counter for diagnostics
-        Instr ins;                                      // temporary Instr to parse into
-        int r = parse_line(line, &ins, lineno);         // parse the current line
-        if (r < 0) { fclose(f); return 2; }             // parse error -> exit with code 2
-        if (r == 1) {                                   // r==1 means an instruction was parsed
-            if (n >= MAX_INSTR) { fprintf(stderr, "Too many instructions\n"); fclose(f); return 3; } // overflow guard
-            prog[n++] = ins;                            // store parsed instruction into program array
+/* Cycles needed to move a set of register operands through the register-file ports.
+   Operands are grouped by bank; each bank serves `ports` of them per cycle. */
+static int port_cycles(const int *regs, int count, const Resources *res, int ports) { // port arbitration
+    if (ports <= 0 || count == 0) return 1;            // unlimited ports or nothing to move: one cycle
+    int per_bank[2*REGS_PER_FILE] = { 0 };             // operands queued on each bank of both files
+    int worst = 0;                                     // busiest bank decides
+    int banks = res->rf_banks > 0 ? res->rf_banks : 1; // unbanked file is one bank
+    for (int i=0;i<count;i++) {                        // count operands per bank; each file has its own banks
+        int b = (regs[i] / REGS_PER_FILE) * banks + (regs[i] % REGS_PER_FILE) % banks;
+        if (++per_bank[b] > worst) worst = per_bank[b];
+    }
+    return (worst + ports - 1) / ports;                // ceil(operands on busiest bank / ports)
+}                                                      // end port_cycles
+
+/* Register reads a slot performs in ID (a fused tail's read of its head's result is internal) */
+static int read_regs(int idx, Instr *prog, int *regs) { // scalar-file operands of the slot
+    int count = 0;                                     // sources of both halves
+    int last = idx + (prog[idx].fused == FUSED_HEAD);  // include the tail of a fused pair
+    for (int i=idx;i<=last;i++) {
+        if (prog[i].elim) continue;                    // renamed away: no register-file access
+        for (int k=0;k<prog[i].rs_count;k++)
+            if (!(i > idx && prog[i].rs_id[k] == prog[idx].rd_id) && !IS_VEC_REG(prog[i].rs_id[k]))
+                regs[count++] = prog[i].rs_id[k];      // vector operands use the vector file's ports
+    }
+    return count;
+}                                                      // end read_regs
+static int read_cycles(int idx, Instr *prog, const Resources *res) { // ID cycles spent reading operands
+    int regs[2*MAX_SRCS], count = read_regs(idx, prog, regs);
+    return port_cycles(regs, count, res, res->rf_read_ports);
+}                                                      // end read_cycles
+
+/* Register writes a slot performs in WB (a shared destination of a fused pair is written once) */
+static int write_regs(int idx, Instr *prog, int *regs) { // scalar-file destinations of the slot
+    int count = 0;                                     // at most one destination per half
+    int last = idx + (prog[idx].fused == FUSED_HEAD);  // include the tail of a fused pair
+    for (int i=idx;i<=last;i++) {
+        if (prog[i].elim || prog[i].rd_id < 0 || IS_VEC_REG(prog[i].rd_id)) continue; // nothing to write here
+        if (i > idx && prog[i].rd_id == prog[idx].rd_id) continue; // same register: one write
+        regs[count++] = prog[i].rd_id;
+    }
+    return count;
+}                                                      // end write_regs
+static int write_cycles(int idx, Instr *prog, const Resources *res) { // WB cycles spent writing results
+    int regs[2], count = write_regs(idx, prog, regs);
+    return port_cycles(regs, count, res, res->rf_write_ports);
+}                                                      // end write_cycles
+
+/* Count the work of a retiring slot: its decode, operand reads, result writes and unit ops. */
+static void retire_activity(int idx, Instr *prog, RunStats *st) { // activity of one WB slot
+    int regs[2*MAX_SRCS];
+    st->act[EV_DECODE]++;                              // a fused pair decodes as one slot
+    st->act[EV_RF_READ] += read_regs(idx, prog, regs);
+    st->act[EV_RF_WRITE] += write_regs(idx, prog, regs);
+    int last = idx + (prog[idx].fused == FUSED_HEAD);
+    for (int i=idx;i<=last;i++) {
+        if (prog[i].elim) continue;                    // renamed away: never executes
+        if (op_info[prog[i].op].fp_unit) st->act[EV_FPU]++;
+        else if (!op_info[prog[i].op].vec_unit) st->act[EV_ALU]++; // ALU op or address add (vector work counts per element)
+    }
+}                                                      // end retire_activity
+
+/* Does the slot use the data memory in MEM? */
+static int slot_uses_memory(int idx, Instr *prog) {    // memory op in either half of the slot
+    int last = idx + (prog[idx].fused == FUSED_HEAD);
+    for (int i=idx;i<=last;i++) if (IS_MEM(prog[i].op)) return 1;
+    return 0;
+}                                                      // end slot_uses_memory
+
+/* Write one CSV snapshot row of the pipeline contents after this cycle's movement.
+   fpu is NULL unless the program uses the FP unit; then an FP column lists its occupants.
+   vrange is NULL unless the program uses the vector unit; then a V column lists the vector
+   ops of prog[vrange[0]..vrange[1]-1] that are inside the unit. */
+static void write_csv_row(FILE *csv, int cycle, const int pipe[5], const int *fpu, const int *vrange,
+                          Instr *prog, int stall_counter) {
+    char buf[5][302] = { "", "", "", "", "" };          // quoted text per stage (slot_text's 300 + quotes), empty for bubbles
+    for (int s=0;s<5;s++)                              // IF, ID, EX, MEM, WB
+        if (pipe[s] >= 0) {
+            char b[300];                               // room for a fused pair
+            snprintf(buf[s], sizeof(buf[s]), "\"%s\"", slot_text(pipe[s], prog, b, sizeof(b))); // quote text
         }
-        /* r==0 means blank or non-instruction line -> skip silently */
+    fprintf(csv, "%d,%s,%s,%s,", cycle, buf[0], buf[1], buf[2]); // CSV row: cycle, IF, ID, EX
+    if (fpu) {                                         // FP unit column, oldest (nearest MEM) first
+        const char *sep = "\"";                        // opening quote, then "; " between entries
+        for (int q=0;q<MAX_FP_LAT;q++)
+            if (fpu[q] >= 0) { fprintf(csv, "%s%s", sep, prog[fpu[q]].text); sep = "; "; }
+        fprintf(csv, "%s,", sep[0]=='"' ? "" : "\"");  // close the quote unless the unit is empty
     }
-    fclose(f);                                          // close input file after reading
-    if (n == 0) { fprintf(stderr, "No instructions parsed.\n"); return 4; } // nothing to simulate -> exit
+    if (vrange) {                                      // vector unit column
+        char v[1024];                                  // ops in the unit this cycle
+        if (vector_column(prog, vrange[0], vrange[1], cycle, v, sizeof(v))) fprintf(csv, "\"%s\",", v);
+        else fprintf(csv, ",");                        // idle unit
+    }
+    fprintf(csv, "%s,%s,%d\n", buf[3], buf[4], stall_counter); // MEM, WB and bubbles still to insert
+}                                                      // end write_csv_row
+
+/* Sidecar index of pipeline_cycles.csv. Every `every` cycles a checkpoint records where the next
+   row starts and what the pipeline held at that point, so a query seeks next to any cycle and
+   replays at most `every` rows instead of scanning from the top. Records have a fixed size, so the
+   index is binary-searched in place. */
+#define INDEX_MAGIC "PCYCIDX1"                          // 8-byte file signature
+typedef struct {                                       // one checkpoint
+    long long cycle;                                   // cycle of the row at offset
+    long long offset;                                  // byte offset of that row in the CSV
+    int pipe[5];                                       // IF..WB occupants going into that cycle
+    int stall_counter;                                 // bubbles still to insert
+} IndexEntry;                                          // end IndexEntry
+typedef struct { FILE *f; int every; FILE *csv; } CycleIndex; // index being written, CSV it points into
+
+static int index_open(CycleIndex *ix, const char *path, int every) { // header: magic, interval
+    ix->every = every;
+    if (!(ix->f = fopen(path, "wb"))) return -1;
+    fwrite(INDEX_MAGIC, 1, 8, ix->f);
+    fwrite(&every, sizeof(every), 1, ix->f);
+    return 0;
+}                                                      // end index_open
+
+static void index_checkpoint(CycleIndex *ix, int cycle, long offset, const int *pipe, int stall_counter) { // append one record
+    IndexEntry e;
+    memset(&e, 0, sizeof(e));
+    e.cycle = cycle; e.offset = offset; e.stall_counter = stall_counter;
+    memcpy(e.pipe, pipe, sizeof(e.pipe));
+    fwrite(&e, sizeof(e), 1, ix->f);
+}                                                      // end index_checkpoint
+
+/* Print the CSV rows of cycles first..last using the index: binary search for the last checkpoint
+   at or before first, seek there, replay rows up to last. Returns an exit code. */
+static int query_cycles(const char *csv_path, const char *idx_path, long first, long last) { // --query=
+    char magic[8], line[8192];
+    int every;
+    FILE *ixf = fopen(idx_path, "rb");
+    InFile csv = in_open(csv_path);
+#ifdef WITH_ZLIB
+    if (!csv) {                                        // written with --gzip
+        snprintf(line, sizeof(line), "%s.gz", csv_path);
+        csv = in_open(line);
+    }
+#endif
+    if (!ixf || !csv) { fprintf(stderr, "Error: cannot open %s / %s\n", csv_path, idx_path); return 1; }
+    if (fread(magic, 1, 8, ixf) != 8 || memcmp(magic, INDEX_MAGIC, 8) || fread(&every, sizeof(every), 1, ixf) != 1) {
+        fprintf(stderr, "Error: %s is not a cycle index\n", idx_path); return 1;
+    }
+    long base = ftell(ixf);                            // first record
+    fseek(ixf, 0, SEEK_END);
+    long count = (ftell(ixf) - base) / (long)sizeof(IndexEntry), lo = 0, hi = count - 1;
+    IndexEntry e, best;                                // probe, last checkpoint at or before first
+    memset(&best, 0, sizeof(best));
+    while (lo <= hi) {                                 // O(log n) probes
+        long mid = (lo + hi) / 2;
+        fseek(ixf, base + mid * (long)sizeof(IndexEntry), SEEK_SET);
+        if (fread(&e, sizeof(e), 1, ixf) != 1) break;
+        if (e.cycle <= first) { best = e; lo = mid + 1; } else hi = mid - 1;
+    }
+    fclose(ixf);
+    if (best.cycle == 0) { fprintf(stderr, "Error: cycle %ld is not in the index\n", first); in_close(csv); return 6; }
+    if (in_gets(line, sizeof(line), csv)) fputs(line, stdout); // header row
+    in_seek(csv, (long)best.offset);                  // offsets are uncompressed bytes
+    long replayed = 0, shown = 0;                      // rows read from the checkpoint on, rows printed
+    while (in_gets(line, sizeof(line), csv)) {
+        long cyc = strtol(line, NULL, 10);
+        replayed++;
+        if (cyc > last) break;
+        if (cyc >= first) { fputs(line, stdout); shown++; }
+    }
+    in_close(csv);
+    if (!shown) { fprintf(stderr, "Error: cycle %ld is past the end of the run\n", first); return 6; }
+    printf("(checkpoint at cycle %lld, every %d cycles; %ld row(s) read)\n", best.cycle, every, replayed);
+    return 0;
+}                                                      // end query_cycles
+
+/* Pipeline-viewer logs, written as the engine runs. The stage of every in-flight instruction is
+   compared with the previous cycle: a change becomes a stage end/start, an instruction that keeps
+   its stage is stalled, and one that leaves WB retires. Kanata (Konata) gets one line per event;
+   gem5 O3PipeView gets one record per instruction when it retires. Memory is O(instructions). */
+enum { PS_NONE, PS_IF, PS_ID, PS_EX, PS_FP, PS_MEM, PS_WB, PS_COUNT }; // viewer stages
+static const char *ps_names[PS_COUNT] = { "", "IF", "ID", "EX", "FP", "MEM", "WB" };
+#define MAX_FLIGHT (2*5 + MAX_FP_LAT)                  // fused pairs in every stage plus the FP unit
+typedef struct {                                       // viewer log state
+    FILE *kanata, *o3;                                 // outputs (either may be NULL)
+    int ticks;                                         // O3PipeView ticks per cycle
+    unsigned char *stage, *next;                       // stage of each instruction last cycle / this cycle
+    int *enter;                                        // first cycle in each stage: enter[i*PS_COUNT + stage]
+    int live[MAX_FLIGHT], nlive;                       // instructions in flight last cycle
+} PipeView;                                            // end PipeView
+
+static int pipeview_open(PipeView *pv, const char *kanata, const char *o3, int n) { // start the logs
+    memset(pv, 0, sizeof(*pv));
+    pv->ticks = 1000;                                  // gem5's default for a 1 GHz clock
+    pv->stage = calloc((size_t)n, 1); pv->next = calloc((size_t)n, 1);
+    pv->enter = calloc((size_t)n * PS_COUNT, sizeof(int));
+    if (!pv->stage || !pv->next || !pv->enter) return -1;
+    if (kanata && !(pv->kanata = fopen(kanata, "w"))) return -1;
+    if (o3 && !(pv->o3 = fopen(o3, "w"))) return -1;
+    if (pv->kanata) fprintf(pv->kanata, "Kanata\t0004\nC=\t0\n"); // header, cycle 0
+    return 0;
+}                                                      // end pipeview_open
+
+static void pipeview_close(PipeView *pv) {             // flush and release the logs
+    if (pv->kanata) fclose(pv->kanata);
+    if (pv->o3) fclose(pv->o3);
+    free(pv->stage); free(pv->next); free(pv->enter);
+}                                                      // end pipeview_close
+
+/* gem5 O3PipeView record of retired instruction i (ID doubles as rename, EX/FP as dispatch and issue) */
+static void o3_record(PipeView *pv, const Instr *prog, int i, int cycle) { // one retired instruction
+    const int *e = &pv->enter[i * PS_COUNT];
+    long t = pv->ticks;
+    long issue = (e[PS_EX] ? e[PS_EX] : e[PS_FP]) * t;
+    fprintf(pv->o3, "O3PipeView:fetch:%ld:0x%08x:0:%d:%s\n", e[PS_IF] * t, i * 4, i + 1, prog[i].text);
+    fprintf(pv->o3, "O3PipeView:decode:%ld\nO3PipeView:rename:%ld\n", e[PS_ID] * t, e[PS_ID] * t);
+    fprintf(pv->o3, "O3PipeView:dispatch:%ld\nO3PipeView:issue:%ld\n", issue, issue);
+    fprintf(pv->o3, "O3PipeView:complete:%ld\n", e[PS_MEM] * t);
+    fprintf(pv->o3, "O3PipeView:retire:%ld:store:%ld\n", cycle * t, IS_STORE(prog[i].op) ? e[PS_WB] * t : 0);
+}                                                      // end o3_record
+
+/* Log the transitions of one cycle from the pipeline registers and the FP unit. */
+static void pipeview_cycle(PipeView *pv, const Instr *prog, const int *pipe, const int *fpu, int cycle) { // viewer events
+    static const unsigned char slot_stage[5] = { PS_IF, PS_ID, PS_EX, PS_MEM, PS_WB };
+    int cur[MAX_FLIGHT], ncur = 0;                     // instructions in flight this cycle
+    for (int k=0;k<5;k++) if (pipe[k] >= 0) {          // pipeline registers; a fused tail shares its head's stage
+        cur[ncur++] = pipe[k]; pv->next[pipe[k]] = slot_stage[k];
+        if (prog[pipe[k]].fused == FUSED_HEAD) { cur[ncur++] = pipe[k] + 1; pv->next[pipe[k] + 1] = pv->next[pipe[k]]; }
+    }
+    for (int q=0;q<MAX_FP_LAT;q++) if (fpu[q] >= 0) { cur[ncur++] = fpu[q]; pv->next[fpu[q]] = PS_FP; }
+    if (pv->kanata) fprintf(pv->kanata, "C\t1\n");    // events below happen in this cycle
+    for (int k=0;k<pv->nlive;k++) {                    // stage ends and retirements
+        int i = pv->live[k];
+        if (pv->next[i] == pv->stage[i]) continue;
+        if (pv->kanata) fprintf(pv->kanata, "E\t%d\t0\t%s\n", i, ps_names[pv->stage[i]]);
+        if (pv->next[i] != PS_NONE) continue;
+        if (pv->kanata) fprintf(pv->kanata, "R\t%d\t%d\t0\n", i, i); // in order: retire id = index
+        if (pv->o3) o3_record(pv, prog, i, cycle);
+    }
+    for (int k=0;k<ncur;k++) {                         // stage starts and stalls
+        int i = cur[k];
+        if (pv->stage[i] == PS_NONE && pv->kanata)     // fetched this cycle
+            fprintf(pv->kanata, "I\t%d\t%d\t0\nL\t%d\t0\t%s\n", i, i, i, prog[i].text);
+        if (pv->next[i] == pv->stage[i]) {             // held in its stage (the FP unit is pipelined, not stalled)
+            if (pv->kanata && pv->stage[i] != PS_FP) fprintf(pv->kanata, "L\t%d\t1\tC%d: stalled in %s; \n", i, cycle, ps_names[pv->stage[i]]);
+            continue;
+        }
+        if (pv->kanata) fprintf(pv->kanata, "S\t%d\t0\t%s\n", i, ps_names[pv->next[i]]);
+        pv->enter[i * PS_COUNT + pv->next[i]] = cycle;
+    }
+    for (int k=0;k<pv->nlive;k++) pv->stage[pv->live[k]] = PS_NONE; // this cycle becomes the previous one
+    for (int k=0;k<ncur;k++) { pv->stage[cur[k]] = pv->next[cur[k]]; pv->next[cur[k]] = PS_NONE; }
+    memcpy(pv->live, cur, sizeof(int) * (size_t)ncur); pv->nlive = ncur;
+}                                                      // end pipeview_cycle
+
+/* Asynchronous output sink. The CSV and the timeline trace are ordinary stdio streams whose bytes
+   land in one of nbufs large buffers; a full buffer is handed to the kernel (io_uring) or to a
+   writer thread and the engine carries on filling the next one. It only waits when every buffer
+   is still being written, which is counted as a stall on full. */
+enum { OUT_SYNC, OUT_URING, OUT_THREAD };               // --async-out backends
+static const char *out_modes[] = { "synchronous", "io_uring", "writer thread" }; // their names in the report
+#define MAX_OUT_BUFS 64                                // most buffers per sink
+typedef struct {                                       // one output file
+    int mode;                                          // OUT_*; falls back from io_uring to a thread
+    int nbufs, cur;                                    // buffers, the one being filled
+    size_t size, fill;                                 // bytes per buffer, bytes in buf[cur]
+    char *buf[MAX_OUT_BUFS];                            // the buffers
+    size_t len[MAX_OUT_BUFS];                          // bytes handed over per buffer
+    long long at[MAX_OUT_BUFS];                        // file offset of each handed-over buffer
+    int busy[MAX_OUT_BUFS];                            // still being written
+    long long pos;                                     // bytes accepted so far (the stream position)
+    long writes, stalls;                               // buffers handed over, waits for a free buffer
+    int depth, max_depth;                              // buffers in flight, and the most at once
+    int err;                                           // a write failed
+    int gz;                                            // gzip level, 0: uncompressed
+    long long out_pos;                                 // bytes in the file (compressed size with gz)
+#ifdef HAVE_ASYNC_OUT
+    int fd;                                             // the output file, written by offset
+#ifdef HAVE_IO_URING
+    int ring;                                          // io_uring instance
+    unsigned *sq_tail, *sq_mask, *sq_array, *cq_head, *cq_tail, *cq_mask; // ring fields: submission and completion queues
+    struct io_uring_sqe *sqes;                          // submission queue entries
+    struct io_uring_cqe *cqes;                          // completion queue entries
+    void *ring_map, *sqe_map; size_t ring_size, sqe_size; // mappings to release
+#endif
+    pthread_t tid;                                     // writer thread
+    int inline_write;                                  // the thread failed to start: buffers are written in sink_flush
+    pthread_mutex_t lock; pthread_cond_t cv;            // guard the queue; signal a change
+    int queue[MAX_OUT_BUFS], qhead, qcount, stop;      // buffers waiting for the writer thread
+#endif
+} OutSink;                                             // end OutSink
+
+#ifdef WITH_ZLIB
+/* Compress len bytes into one gzip member; members written back to back form a valid .gz file. */
+static unsigned char *gz_member(const char *buf, size_t len, int level, size_t *out_len) { // NULL on failure
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) return NULL; // 15 + 16: gzip wrapper
+    size_t cap = deflateBound(&z, (uLong)len);
+    unsigned char *out = malloc(cap);
+    z.next_in = (Bytef *)buf; z.avail_in = (uInt)len;
+    z.next_out = out; z.avail_out = (uInt)cap;
+    int rc = out ? deflate(&z, Z_FINISH) : Z_MEM_ERROR;
+    *out_len = cap - z.avail_out;
+    deflateEnd(&z);
+    if (rc != Z_STREAM_END) { free(out); return NULL; }
+    return out;
+}                                                      // end gz_member
+#endif
+
+#ifdef HAVE_ASYNC_OUT
+static void sink_done(OutSink *s, int b, long long res) { // buffer b finished writing
+    if (res != (long long)s->len[b]) s->err = 1;       // short writes do not happen on regular files
+    s->busy[b] = 0; s->depth--;                         // free again
+}                                                      // end sink_done
+
+#ifdef HAVE_IO_URING
+static int uring_setup(OutSink *s) {                   // ring with one entry per buffer
+    struct io_uring_params p;                           // setup parameters, filled in by the kernel
+    memset(&p, 0, sizeof(p));                           // no flags
+    s->ring = (int)syscall(__NR_io_uring_setup, (unsigned)s->nbufs, &p); // one entry per buffer
+    if (s->ring < 0) return -1;                         // no io_uring: use the thread
+    size_t sq = p.sq_off.array + p.sq_entries * sizeof(unsigned), cq = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe); // extent of each ring
+    s->ring_size = sq > cq ? sq : cq;                   // one mapping holds both
+    s->sqe_size = p.sq_entries * sizeof(struct io_uring_sqe); // the submission queue entries
+    s->ring_map = (p.features & IORING_FEAT_SINGLE_MMAP) ? mmap(NULL, s->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, s->ring, IORING_OFF_SQ_RING) : MAP_FAILED; // both rings in one mapping (5.4+)
+    s->sqe_map = mmap(NULL, s->sqe_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, s->ring, IORING_OFF_SQES); // the submission queue entries
+    if (s->ring_map == MAP_FAILED || s->sqe_map == MAP_FAILED) { close(s->ring); return -1; } // old kernel: use the thread
+    char *r = s->ring_map;                              // base of the ring mapping
+    s->sq_tail = (unsigned *)(r + p.sq_off.tail); s->sq_mask = (unsigned *)(r + p.sq_off.ring_mask); // submission queue tail and mask
+    s->sq_array = (unsigned *)(r + p.sq_off.array);     // its index array
+    s->cq_head = (unsigned *)(r + p.cq_off.head); s->cq_tail = (unsigned *)(r + p.cq_off.tail); // completion queue head and tail
+    s->cq_mask = (unsigned *)(r + p.cq_off.ring_mask);  // and mask
+    s->cqes = (struct io_uring_cqe *)(r + p.cq_off.cqes); // completion entries
+    s->sqes = s->sqe_map;                               // submission entries
+    size_t psize = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op); // probe with a slot per opcode
+    struct io_uring_probe *probe = calloc(1, psize);   // IORING_OP_WRITE needs 5.6, like the probe itself
+    int ok = probe && syscall(__NR_io_uring_register, s->ring, IORING_REGISTER_PROBE, probe, 256) == 0 // ask the kernel which opcodes it has
+             && probe->last_op >= IORING_OP_WRITE && (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED); // the write opcode among them
+    free(probe);                                        // probe result no longer needed
+    if (!ok) { munmap(s->sqe_map, s->sqe_size); munmap(s->ring_map, s->ring_size); close(s->ring); return -1; } // 5.1-5.5: use the thread
+    return 0;                                           // ring ready
+}                                                      // end uring_setup
 
+static void uring_reap(OutSink *s, int wait) {         // collect completions, blocking for one if wait
+    if (wait) syscall(__NR_io_uring_enter, s->ring, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0); // block until at least one completes
+    unsigned head = *s->cq_head;                        // next completion to read
+    while (head != __atomic_load_n(s->cq_tail, __ATOMIC_ACQUIRE)) { // every completion the kernel posted
+        struct io_uring_cqe *c = &s->cqes[head & *s->cq_mask]; // completion entry
+        sink_done(s, (int)c->user_data, c->res);        // user_data is the buffer index
+        head++;                                         // consumed
+    }
+    __atomic_store_n(s->cq_head, head, __ATOMIC_RELEASE); // hand the entries back to the kernel
+}                                                      // end uring_reap
+
+static void uring_submit(OutSink *s, int b) {          // one IORING_OP_WRITE at the buffer's offset
+    unsigned tail = *s->sq_tail, i = tail & *s->sq_mask; // next submission slot
+    struct io_uring_sqe *e = &s->sqes[i];               // its entry
+    memset(e, 0, sizeof(*e));                           // unused fields stay 0
+    e->opcode = IORING_OP_WRITE; e->fd = s->fd;         // write to the output file
+    e->addr = (unsigned long long)(uintptr_t)s->buf[b]; e->len = (unsigned)s->len[b]; e->off = (unsigned long long)s->at[b]; // buffer, length and file offset
+    e->user_data = (unsigned long long)b;               // buffer index comes back in the completion
+    s->sq_array[i] = i;                                 // slot i holds entry i
+    __atomic_store_n(s->sq_tail, tail + 1, __ATOMIC_RELEASE); // publish the entry
+    if (syscall(__NR_io_uring_enter, s->ring, 1, 0, 0, NULL, 0) != 1) sink_done(s, b, -1); // submit it; a failed submission is a failed write
+}                                                      // end uring_submit
+#endif
+
+static long long sink_write_buffer(OutSink *s, int b) { // (compress and) pwrite buffer b; bytes of it written, or -1
+    const char *data = s->buf[b];                      // bytes for the file and where they go
+    size_t len = s->len[b];                             // bytes of the buffer
+    long long at = s->at[b], done = 0;                  // file offset, bytes written so far
+#ifdef WITH_ZLIB
+    unsigned char *member = NULL;                      // this buffer as one gzip member
+    if (s->gz) {                                       // members follow each other in queue order
+        member = gz_member(data, len, s->gz, &len);     // compress it
+        data = (const char *)member; at = s->out_pos;   // appended after the previous member
+    }
+    if (!s->gz || member)                               // compression failed: write nothing
+#endif
+    while (done < (long long)len) {                    // pwrite may return early
+        ssize_t w = pwrite(s->fd, data + done, len - (size_t)done, (off_t)(at + done)); // write the rest
+        if (w <= 0) break;                              // error or disk full: stop
+        done += w;                                      // bytes written so far
+    }
+    s->out_pos = at + done;                             // next member starts here
+#ifdef WITH_ZLIB
+    if (s->gz) { done = member && done == (long long)len ? (long long)s->len[b] : -1; free(member); } // the raw size counts, or -1
+#endif
+    return done;                                        // bytes written, or -1
+}                                                      // end sink_write_buffer
+
+static void *sink_thread(void *p) {                    // writer thread: write queued buffers in order
+    OutSink *s = p;                                     // the sink
+    pthread_mutex_lock(&s->lock);                       // queue is shared with the engine
+    for (;;) {                                          // until stopped with an empty queue
+        while (!s->qcount && !s->stop) pthread_cond_wait(&s->cv, &s->lock); // sleep until a buffer or a stop arrives
+        if (!s->qcount) break;                         // stopped and drained
+        int b = s->queue[s->qhead];                     // oldest buffer in the queue
+        pthread_mutex_unlock(&s->lock);                 // write without the lock held
+        long long done = sink_write_buffer(s, b);       // may block for a while
+        pthread_mutex_lock(&s->lock);                   // back under the lock
+        s->qhead = (s->qhead + 1) % MAX_OUT_BUFS; s->qcount--; // pop it
+        sink_done(s, b, done);                          // mark it written
+        pthread_cond_broadcast(&s->cv);                 // wake a waiting engine
+    }
+    pthread_mutex_unlock(&s->lock);                     // release the queue
+    return NULL;                                        // thread exit
+}                                                      // end sink_thread
+
+static int sink_busy(OutSink *s, int b) {             // whether buffer b is still being written
+    int busy;                                           // result read under the lock
+    if (s->mode == OUT_URING) {                         // io_uring: no lock needed
+#ifdef HAVE_IO_URING
+        uring_reap(s, 0);                               // collect finished writes
+#endif
+        return s->busy[b];                              // flag kept up to date by uring_reap
+    }
+    pthread_mutex_lock(&s->lock); busy = s->busy[b]; pthread_mutex_unlock(&s->lock); // the writer thread updates it
+    return busy;                                        // busy or free
+}                                                      // end sink_busy
+
+static void sink_wait(OutSink *s, int b) {             // until buffer b (or every buffer if b < 0) is written
+    if (s->mode == OUT_URING) {                         // io_uring: reap until done
+#ifdef HAVE_IO_URING
+        while (b >= 0 ? s->busy[b] : s->depth > 0) uring_reap(s, 1); // block for completions
+#endif
+        return;                                         // done
+    }
+    pthread_mutex_lock(&s->lock);                       // writer thread: wait on its signal
+    while (b >= 0 ? s->busy[b] : s->depth > 0) pthread_cond_wait(&s->cv, &s->lock); // signalled after every buffer
+    pthread_mutex_unlock(&s->lock);                     // release the queue
+}                                                      // end sink_wait
+
+static void sink_flush(OutSink *s) {                   // hand buf[cur] over and move to the next buffer
+    if (!s->fill) return;                               // nothing buffered
+    int b = s->cur;                                     // buffer being handed over
+    s->len[b] = s->fill; s->at[b] = s->pos - (long long)s->fill; // its length and file offset
+    s->busy[b] = 1; s->writes++;                        // in flight now
+    if (s->mode == OUT_URING) {                         // io_uring: submit it
+#ifdef HAVE_IO_URING
+        uring_reap(s, 0);                              // free what already finished
+        if (++s->depth > s->max_depth) s->max_depth = s->depth; // track the queue depth
+        uring_submit(s, b);                             // write at its offset
+#endif
+    }
+    else if (s->inline_write) {                        // no writer thread: write it now
+        if (++s->depth > s->max_depth) s->max_depth = s->depth; // track the queue depth
+        sink_done(s, b, sink_write_buffer(s, b));       // write it in this thread
+    }
+    else {                                              // writer thread: queue it
+        pthread_mutex_lock(&s->lock);                   // queue is shared with the thread
+        if (++s->depth > s->max_depth) s->max_depth = s->depth; // track the queue depth
+        s->queue[(s->qhead + s->qcount++) % MAX_OUT_BUFS] = b; // append to the queue
+        pthread_cond_broadcast(&s->cv);                 // wake the writer thread
+        pthread_mutex_unlock(&s->lock);                 // release the queue
+    }
+    s->cur = (b + 1) % s->nbufs; s->fill = 0;           // fill the next buffer
+    if (sink_busy(s, s->cur)) { s->stalls++; sink_wait(s, s->cur); } // every buffer in flight
+}                                                      // end sink_flush
+
+static ssize_t sink_write(void *cookie, const char *data, size_t size) { // stdio -> buffers
+    OutSink *s = cookie;                                // the sink
+    for (size_t left = size; left; ) {                  // copy in pieces, one buffer at a time
+        size_t k = s->size - s->fill < left ? s->size - s->fill : left; // what fits in the current buffer
+        memcpy(s->buf[s->cur] + s->fill, data, k);      // copy it
+        s->fill += k; s->pos += (long long)k; data += k; left -= k; // advance every position
+        if (s->fill == s->size) sink_flush(s);          // full buffer: hand it over
+    }
+    return s->err ? -1 : (ssize_t)size;                 // stdio error on a failed write
+}                                                      // end sink_write
+
+static int sink_seek(void *cookie, off64_t *offset, int whence) { // only ftell is supported
+    OutSink *s = cookie;                                // the sink
+    if (whence != SEEK_CUR || *offset != 0) return -1;  // only a query of the position
+    *offset = s->pos;                                   // bytes accepted so far
+    return 0;                                           // answered
+}                                                      // end sink_seek
+
+static int sink_close(void *cookie) {                  // drain, then release everything but the counters
+    OutSink *s = cookie;                                // the sink
+    sink_flush(s);                                      // hand over the partial buffer
+    sink_wait(s, -1);                                   // wait for every write
+    if (s->mode == OUT_URING) {                         // io_uring: release the ring
+#ifdef HAVE_IO_URING
+        munmap(s->sqe_map, s->sqe_size); munmap(s->ring_map, s->ring_size); close(s->ring); // unmap and close
+#endif
+    }
+    else {                                              // writer thread: stop it
+        pthread_mutex_lock(&s->lock); s->stop = 1; pthread_cond_broadcast(&s->cv); pthread_mutex_unlock(&s->lock); // tell the thread to finish
+        if (!s->inline_write) pthread_join(s->tid, NULL); // an inline sink has no thread
+        pthread_mutex_destroy(&s->lock); pthread_cond_destroy(&s->cv); // queue lock and signal
+    }
+    for (int b=0;b<s->nbufs;b++) free(s->buf[b]);       // the buffers
+    if (close(s->fd)) s->err = 1;                       // stdio sees a failed close
+    return s->err ? -1 : 0;                             // 0 if every write succeeded
+}                                                      // end sink_close
+#endif
+
+/* Open path for writing through s; OUT_SYNC, or a platform without the sink, is a plain fopen(path, fmode).
+   gz > 0 compresses each buffer on the writer thread. */
+static FILE *sink_open(OutSink *s, const char *path, const char *fmode, int mode, int nbufs, size_t size, int gz) { // stream onto the sink
+    memset(s, 0, sizeof(*s));                           // counters start at 0
+    s->mode = mode; s->nbufs = nbufs; s->size = size; s->gz = gz;
+#ifdef HAVE_ASYNC_OUT
+    if (gz) s->mode = OUT_THREAD;                      // compressed sizes are only known after the fact
+    if (s->mode == OUT_SYNC) return fopen(path, fmode);
+    s->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666); // written by offset
+    if (s->fd < 0) return NULL;                         // error if cannot open
+    for (int b=0;b<nbufs;b++) if (!(s->buf[b] = malloc(size))) { fprintf(stderr, "Out of memory\n"); exit(5); } // the buffers
+#ifdef HAVE_IO_URING
+    if (s->mode == OUT_URING && uring_setup(s)) s->mode = OUT_THREAD; // no io_uring: writer thread
+#else
+    s->mode = OUT_THREAD;                               // no io_uring support compiled in
+#endif
+    if (s->mode == OUT_THREAD) {                        // writer thread, or inline if it fails
+        pthread_mutex_init(&s->lock, NULL); pthread_cond_init(&s->cv, NULL); // queue lock and signal
+        s->inline_write = pthread_create(&s->tid, NULL, sink_thread, s) != 0; // no thread: synchronous writes
+    }
+    cookie_io_functions_t io = { NULL, sink_write, sink_seek, sink_close }; // stdio calls go to the sink
+    return fopencookie(s, "w", io);                     // NULL if it fails
+#else
+    s->mode = OUT_SYNC; s->gz = 0;                     // main rejects --gzip here
+    return fopen(path, fmode);                          // plain stdio
+#endif
+}                                                      // end sink_open
+
+static void print_sink(const char *name, const OutSink *s) { // counters of one closed sink
+    if (s->mode == OUT_SYNC) { printf("  %s: synchronous writes\n", name); return; } // synchronous: nothing to report
+    printf("  %s: %s, %d x %zu KiB buffers; %lld bytes in %ld writes, max queue depth %d, %ld stall(s) on full",
+           name, out_modes[s->mode], s->nbufs, s->size >> 10, s->pos, s->writes, s->max_depth, s->stalls);
+    if (s->gz) printf("; gzip level %d: %lld bytes (%.1f%%)", s->gz, s->out_pos, s->pos ? 100.0 * s->out_pos / s->pos : 0.0);
+    printf("%s%s\n", s->inline_write ? " (thread failed to start: written inline)" : "", s->err ? " (write error)" : ""); // thread fallback and write errors
+}                                                      // end print_sink
+
+/* Timeline trace for Perfetto and chrome://tracing: one process per hart, one thread track per
+   stage, FP-unit lane and vector unit, and one slice per occupancy or run of bubbles (1 cycle =
+   1 ns). A file named *.json gets Chrome JSON; any other name gets the Perfetto protobuf format,
+   written one TracePacket at a time. */
+typedef struct {                                       // trace output
+    FILE *f;
+    int proto;                                         // 1: protobuf, 0: JSON
+    long packets;                                      // packets / events written
+} TraceOut;                                            // end TraceOut
+
+static void pb_varint(unsigned char **p, unsigned long long v) { // protobuf base-128 varint
+    while (v >= 0x80) { *(*p)++ = (unsigned char)(v | 0x80); v >>= 7; }
+    *(*p)++ = (unsigned char)v;
+}                                                      // end pb_varint
+static void pb_uint(unsigned char **p, int field, unsigned long long v) { // varint field
+    pb_varint(p, (unsigned long long)field << 3); pb_varint(p, v);
+}                                                      // end pb_uint
+static void pb_bytes(unsigned char **p, int field, const void *b, size_t len) { // length-delimited field
+    pb_varint(p, (unsigned long long)field << 3 | 2); pb_varint(p, len);
+    memcpy(*p, b, len); *p += len;
+}                                                      // end pb_bytes
+
+/* Write one TracePacket (field 1 of Trace) holding the given body fields. */
+static void trace_packet(TraceOut *t, const unsigned char *body, size_t len) { // framed packet
+    unsigned char head[16], *p = head;
+    pb_varint(&p, 1 << 3 | 2); pb_varint(&p, len);
+    fwrite(head, 1, (size_t)(p - head), t->f); fwrite(body, 1, len, t->f);
+    t->packets++;
+}                                                      // end trace_packet
+
+/* JSON string without characters that would need escaping */
+static void json_name(FILE *f, const char *s) {        // quoted, sanitized name
+    fputc('"', f);
+    for (;*s;s++) fputc((*s == '"' || *s == '\\' || (unsigned char)*s < 32) ? ' ' : *s, f);
+    fputc('"', f);
+}                                                      // end json_name
+
+static int trace_open(TraceOut *t, const char *path, OutSink *sink, int mode, int nbufs, size_t size, int gz) { // start a trace file
+    size_t len = strlen(path);
+    if (gz && len > 3) len -= 3;                       // x.json.gz is compressed JSON
+    t->proto = !(len >= 5 && strncmp(path + len - 5, ".json", 5) == 0);
+    t->packets = 0;
+    t->f = sink_open(sink, path, t->proto ? "wb" : "w", mode, nbufs, size, gz);
+    if (!t->f) return -1;
+    if (!t->proto) fprintf(t->f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    return 0;
+}                                                      // end trace_open
+
+static void trace_close(TraceOut *t) {                 // finish the trace file
+    if (!t->proto) fprintf(t->f, "\n]}\n");
+    fclose(t->f);
+}                                                      // end trace_close
+
+/* Name a process (pid > 0) or one of its thread tracks (tid > 0). */
+static void trace_track(TraceOut *t, int pid, int tid, const char *name) { // track descriptor
+    if (!t->proto) {
+        fprintf(t->f, "%s\n{\"name\":\"%s_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", t->packets++ ? "," : "",
+                tid ? "thread" : "process", pid, tid);
+        json_name(t->f, name);
+        fprintf(t->f, "}}");
+        if (tid) fprintf(t->f, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"sort_index\":%d}}", pid, tid, tid);
+        return;
+    }
+    unsigned char desc[256], body[320], *d = desc, *b = body;
+    unsigned char who[160], *w = who;                  // ProcessDescriptor or ThreadDescriptor
+    size_t nlen = strlen(name) < 100 ? strlen(name) : 100;
+    pb_uint(&w, 1, (unsigned long long)pid);
+    if (tid) { pb_uint(&w, 2, (unsigned long long)tid); pb_bytes(&w, 5, name, nlen); } // pid, tid, thread_name
+    else pb_bytes(&w, 6, name, nlen);                  // pid, process_name
+    pb_uint(&d, 1, (unsigned long long)pid << 16 | (unsigned)tid); // TrackDescriptor.uuid
+    pb_bytes(&d, tid ? 4 : 3, who, (size_t)(w - who)); // .thread / .process
+    if (t->packets == 0) pb_uint(&b, 13, 1);           // SEQ_INCREMENTAL_STATE_CLEARED
+    pb_uint(&b, 10, 1);                                // trusted_packet_sequence_id
+    pb_bytes(&b, 60, desc, (size_t)(d - desc));        // track_descriptor
+    trace_packet(t, body, (size_t)(b - body));
+}                                                      // end trace_track
+
+/* One slice [begin,end) on thread track tid of process pid. */
+static void trace_slice(TraceOut *t, int pid, int tid, const char *name, int begin, int end) { // occupancy slice
+    if (!t->proto) {
+        fprintf(t->f, "%s\n{\"name\":", t->packets++ ? "," : "");
+        json_name(t->f, name);
+        fprintf(t->f, ",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", pid, tid, begin / 1000.0, (end - begin) / 1000.0);
+        return;
+    }
+    for (int k=0;k<2;k++) {                            // SLICE_BEGIN, then SLICE_END
+        unsigned char ev[320], body[400], *e = ev, *b = body;
+        pb_uint(&e, 9, (unsigned long long)(k + 1));   // TrackEvent.type
+        pb_uint(&e, 11, (unsigned long long)pid << 16 | (unsigned)tid); // .track_uuid
+        if (k == 0) pb_bytes(&e, 23, name, strlen(name) < 250 ? strlen(name) : 250); // .name
+        pb_uint(&b, 8, (unsigned long long)(k ? end : begin)); // timestamp (ns)
+        pb_uint(&b, 10, 1);                            // trusted_packet_sequence_id
+        pb_bytes(&b, 11, ev, (size_t)(e - ev));        // track_event
+        trace_packet(t, body, (size_t)(b - body));
+    }
+}                                                      // end trace_slice
+
+/* Per-core trace state. Slices are collected while the core steps and written between cycles in
+   hart order, so harts on their own threads never share the file. */
+#define TR_FP      8                                   // thread id of FP-unit lane 0
+#define TR_VEC     (TR_FP + MAX_FP_LAT)                // thread id of vector unit 1
+#define TR_TRACKS  (TR_VEC + VU_COUNT)                 // thread ids 1..TR_TRACKS-1
+#define TR_BUBBLE  (-2)                                // occupant of a stalled empty stage
+typedef struct { int tid, idx, begin, end; } TraceSlice; // finished slice (idx -1: bubble)
+typedef struct {                                       // one core's trace state
+    TraceOut *out; int pid;                            // destination and process id (hart + 1)
+    int cur[TR_TRACKS], since[TR_TRACKS];              // open slice per track: occupant and first cycle
+    unsigned char named[TR_TRACKS];                    // track descriptor written
+    long stalls_seen;                                  // stall count at the previous cycle
+    int vec_next;                                      // first vector op not yet traced
+    TraceSlice done[TR_TRACKS + 2]; int ndone;         // slices finished this cycle
+} CoreTrace;                                           // end CoreTrace
+
+static void core_trace_init(CoreTrace *ct, TraceOut *out, int hart) { // open the hart's process
+    char name[32];
+    memset(ct, 0, sizeof(*ct));
+    ct->out = out; ct->pid = hart + 1;
+    for (int k=0;k<TR_TRACKS;k++) ct->cur[k] = -1;
+    snprintf(name, sizeof(name), "hart %d", hart);
+    trace_track(out, ct->pid, 0, name);
+}                                                      // end core_trace_init
+
+/* Set the occupant of track tid for this cycle, finishing the previous slice if it changed. */
+static void core_trace_set(CoreTrace *ct, int tid, int who, int cycle) { // track occupancy
+    if (ct->cur[tid] == who) return;
+    if (ct->cur[tid] != -1) {
+        TraceSlice *s = &ct->done[ct->ndone++];
+        s->tid = tid; s->idx = ct->cur[tid] == TR_BUBBLE ? -1 : ct->cur[tid]; s->begin = ct->since[tid]; s->end = cycle;
+    }
+    ct->cur[tid] = who; ct->since[tid] = cycle;
+}                                                      // end core_trace_set
+
+/* Write the slices finished so far (at the end of the run, finish the open ones first). */
+static void core_trace_flush(CoreTrace *ct, Instr *prog, int final_cycle) { // emit in hart order
+    static const char *stage_names[] = { "", "IF", "ID", "EX", "MEM", "WB" };
+    if (final_cycle) for (int k=1;k<TR_TRACKS;k++) {   // close every open slice
+        core_trace_set(ct, k, -1, final_cycle + 1);
+        if (ct->ndone) core_trace_flush(ct, prog, 0);
+    }
+    for (int k=0;k<ct->ndone;k++) {
+        const TraceSlice *s = &ct->done[k];
+        char name[300];
+        if (!ct->named[s->tid]) {                      // first slice on this track
+            char tname[32];
+            if (s->tid < TR_FP) snprintf(tname, sizeof(tname), "%s", stage_names[s->tid]);
+            else if (s->tid < TR_VEC) snprintf(tname, sizeof(tname), "FP lane %d", s->tid - TR_FP);
+            else snprintf(tname, sizeof(tname), "V %s", vu_names[s->tid - TR_VEC]);
+            trace_track(ct->out, ct->pid, s->tid, tname);
+            ct->named[s->tid] = 1;
+        }
+        trace_slice(ct->out, ct->pid, s->tid, s->idx < 0 ? "bubble" : slot_text(s->idx, prog, name, sizeof(name)), s->begin, s->end);
+    }
+    ct->ndone = 0;
+}                                                      // end core_trace_flush
+
+/* Record one cycle: the five stages (an empty IF or EX in a stall cycle is a bubble), the FP-unit
+   lanes and the vector units. */
+static void core_trace_cycle(CoreTrace *ct, const Instr *prog, const int *pipe, const int *fpu,
+                             const int *vrange, int vlanes, long stalls, int cycle) { // record a cycle
+    int stalled = stalls > ct->stalls_seen;            // this cycle lost work
+    ct->stalls_seen = stalls;
+    for (int k=0;k<5;k++)                              // IF..WB are threads 1..5
+        core_trace_set(ct, k + 1, pipe[k] >= 0 ? pipe[k] : (stalled && (k == 0 || k == 2)) ? TR_BUBBLE : -1, cycle);
+    for (int l=0;l<MAX_FP_LAT;l++) {                   // FP ops keep their lane until they leave
+        int still = 0;
+        for (int q=0;q<MAX_FP_LAT && ct->cur[TR_FP + l] >= 0;q++) still |= fpu[q] == ct->cur[TR_FP + l];
+        if (!still) core_trace_set(ct, TR_FP + l, -1, cycle);
+    }
+    for (int q=0;q<MAX_FP_LAT;q++) {                   // new FP ops take the lowest free lane
+        int l, seen = 0;
+        if (fpu[q] < 0) continue;
+        for (l=0;l<MAX_FP_LAT && !seen;l++) seen = ct->cur[TR_FP + l] == fpu[q];
+        for (l=0;l<MAX_FP_LAT && !seen && ct->cur[TR_FP + l] != -1;l++) ;
+        if (!seen && l < MAX_FP_LAT) core_trace_set(ct, TR_FP + l, fpu[q], cycle);
+    }
+    for (;ct->vec_next < vrange[1];ct->vec_next++) {   // vector ops dispatched since the last cycle
+        const Instr *in = &prog[ct->vec_next];
+        if (!op_info[in->op].vec_unit) continue;
+        if (in->vl == 0) continue;                     // no element groups
+        TraceSlice *s = &ct->done[ct->ndone++];        // busy interval is known at dispatch
+        s->tid = TR_VEC + op_info[in->op].vec_unit; s->idx = ct->vec_next;
+        s->begin = in->vstart; s->end = in->vstart + (in->vl + vlanes - 1) / vlanes;
+    }
+}                                                      // end core_trace_cycle
+
+/* Observers of an engine run. A sink fills in only the events it wants and core_attach files it
+   under each of them, so an event nobody listens to costs a loop over an empty list:
+     retired(idx)    a slot left WB; idx is its first instruction
+     stall(kind)     a cycle was lost, SK_* says where (MEM waits: see c->ms.why)
+     cycle_end       the cycle's movement is done; c->pipe and c->fpu hold the new state
+     run_end         the core has no work left; c->cycle is its cycle count */
+enum { SK_RF_WRITE, SK_MEM, SK_BUBBLE, SK_FP_ISSUE, SK_MEM_PORT, SK_ITLB, SK_COUNT }; // stall kinds
+static const char *sk_names[SK_COUNT] = { "rf_write", "mem", "bubble", "fp_issue", "mem_port", "itlb" };
+#define MAX_SINKS 8                                     // sinks per core
+struct Core;
+typedef struct EngineSink {                             // callbacks may be NULL
+    void (*retired)(struct EngineSink *s, const struct Core *c, int idx);
+    void (*stall)(struct EngineSink *s, const struct Core *c, int kind);
+    void (*cycle_end)(struct EngineSink *s, const struct Core *c);
+    void (*run_end)(struct EngineSink *s, const struct Core *c);
+    void *ctx;                                          // the sink's own state
+} EngineSink;                                           // end EngineSink
+
+/* State of one pipeline: everything the cycle loop carries from one cycle to the next. */
+typedef struct Core {                                   // one simulated core
+    Instr *prog; int n;                                 // program (per-run fields live in prog[])
+    int base;                                           // program index of prog[0] (a streaming run slides its window)
+    const Resources *res;                               // structural resources
+    int trace;                                          // text trace on stdout (0 when silent)
+    RunStats *st;                                       // stall accounting
     /* pipeline registers: hold indices into prog[] or -1 for bubble/empty */
-    int pipe[5] = { -1, -1, -1, -1, -1 };               // mapping: pipe[0]=IF, [1]=ID, [2]=EX, [3]=MEM, [4]=WB
-    int pc = 0;                                         // program counter: next instruction index to fetch
-    int completed = 0;                                  // count of instructions that finished WB
-    long total_stalls = 0;                              // count of bubble cycles inserted overall
-    int cycle = 0;                                      // current cycle number (increments each loop)
-    int stall_counter = 0;                              // remaining bubble cycles to insert for current hazard
+    int pipe[5];                                        // mapping: pipe[0]=IF, [1]=ID, [2]=EX, [3]=MEM, [4]=WB
+    int pc;                                             // program counter: next instruction index to fetch
+    int completed;                                      // count of instructions that finished WB
+    int cycle;                                          // current cycle number (increments each step)
+    int stall_counter;                                  // remaining bubble cycles to insert for current hazard
+    int wb_left;                                        // write-port cycles still needed by the slot in WB
+    int fpu[MAX_FP_LAT];                                // pipelined FP unit: fpu[k] enters MEM after k+1 more cycles
+    const int *fp_col;                                  // CSV gets an FP column only for FP programs
+    VecState vs;                                        // decoupled vector unit behind EX
+    int vrange[2];                                      // vector ops that may be in the unit: prog[vrange[0]..vrange[1]-1]
+    const int *v_col;                                   // CSV gets a V column only for vector programs
+    int vec_end;                                        // last cycle a vector result is written
+    MemState ms;                                        // data-cache port and store buffer
+    Mmu mmu;                                            // TLB contents
+    int itlb_pc, itlb_left;                             // instruction whose fetch address was translated, cycles left
+    CoreTrace *tr;                                      // timeline trace, flushed between cycles (NULL when off)
+    EngineSink *on_retire[MAX_SINKS], *on_stall[MAX_SINKS], *on_cycle[MAX_SINKS], *on_end[MAX_SINKS];
+    int n_retire, n_stall, n_cycle, n_end;              // listeners per event
+} Core;                                                 // end Core
+
+/* Reset c to run prog[0..n-1] from cycle 0. */
+static void core_init(Core *c, Instr *prog, int n, const Resources *res, int trace, RunStats *st) { // fresh core
+    memset(c, 0, sizeof(*c));                           // counters, vector unit, store buffer and TLBs start empty
+    c->prog = prog; c->n = n; c->res = res; c->trace = trace; c->st = st;
+    for (int k=0;k<5;k++) c->pipe[k] = -1;              // empty pipeline
+    c->itlb_pc = -1;                                    // nothing translated yet
+    memset(st, 0, sizeof(*st));                         // fresh counters for this run
+    c->ms.mem_idx = -1;                                 // MEM holds nothing
+    c->ms.mmu = &c->mmu;
+    for (int t=0;t<TLB_COUNT;t++) if (res->tlb.entries[t]) {
+        c->mmu.tlb[t].ways = res->tlb.ways[t];
+        c->mmu.tlb[t].sets = res->tlb.entries[t] / res->tlb.ways[t];
+    }
+    for (int q=0;q<MAX_FP_LAT;q++) c->fpu[q] = -1;      // FP unit starts empty
+    for (int i=0;i<n;i++) {
+        prog[i].finished = 0;                           // allow the loop to be re-run on the same program
+        prog[i].vstart = 0;                             // not dispatched to the vector unit yet
+        if (op_info[prog[i].op].fp_unit) c->fp_col = c->fpu; // program uses the FP unit
+        if (op_info[prog[i].op].vec_unit) c->v_col = c->vrange; // program uses the vector unit
+    }
+}                                                       // end core_init
 
-    FILE *csv = fopen("pipeline_cycles.csv", "w");      // open CSV output for writing
-    if (!csv) { fprintf(stderr, "Error: cannot write pipeline_cycles.csv\n"); return 5; } // error if cannot open
-    fprintf(csv, "cycle,IF,ID,EX,MEM,WB,stalls_pending\n"); // CSV header row describing columns
+static void core_attach(Core *c, EngineSink *s) {      // file s under the events it handles
+    if (c->n_retire == MAX_SINKS || c->n_stall == MAX_SINKS || c->n_cycle == MAX_SINKS || c->n_end == MAX_SINKS) {
+        fprintf(stderr, "Too many output sinks\n"); exit(6);
+    }
+    if (s->retired) c->on_retire[c->n_retire++] = s;
+    if (s->stall) c->on_stall[c->n_stall++] = s;
+    if (s->cycle_end) c->on_cycle[c->n_cycle++] = s;
+    if (s->run_end) c->on_end[c->n_end++] = s;
+}                                                       // end core_attach
 
-    printf("Starting cycle-by-cycle simulation (no-forwarding model)\n"); // human-readable header
-    printf("Total instructions: %d\n\n", n);             // print number of instructions parsed
+static void core_stall(Core *c, int kind) {             // count a lost cycle and tell the sinks
+    c->st->stalls++;
+    PROBE3(stall, c->ms.hart, c->cycle, kind);          // hart, cycle, SK_* kind
+    for (int k=0;k<c->n_stall;k++) c->on_stall[k]->stall(c->on_stall[k], c, kind);
+}                                                       // end core_stall
 
-    while (completed < n) {                             // run until all instructions complete WB
-        cycle++;                                       // advance to next cycle number
-
-        /* --- Handle write-back for instruction already in WB at start of this cycle --- */
-        if (pipe[4] >= 0) {                             // if there is an instruction in WB slot
-            write_back_action(pipe[4], prog, cycle);   // perform write-back action/logging
-            completed++;                               // increment completed count
-            pipe[4] = -1;                              // clear WB slot after write-back
-        }
-
-        /* --- If we are currently inserting stalls (stall_counter > 0) then:
-              - advance MEM->WB and EX->MEM
-              - place a bubble in EX (pipe[2] = -1)
-              - keep ID and IF unchanged (they are stalled)
-              This models inserting a NOP into EX for each stall cycle. */
-        if (stall_counter > 0) {                        // check if bubble cycles remain to be inserted
-            if (pipe[3] >= 0) { pipe[4] = pipe[3]; pipe[3] = -1; } // MEM -> WB move
-            if (pipe[2] >= 0) { pipe[3] = pipe[2]; pipe[2] = -1; } // EX -> MEM move, EX becomes bubble
-            /* ID and IF remain in their slots (stalled) */
-            total_stalls++;                             // count this bubble cycle in totals
-            stall_counter--;                            // one less stall to insert
-
-            /* produce human-readable traces for stages that have content this cycle */
-            if (pipe[3] >= 0) memory_trace(pipe[3], prog, cycle); // trace MEM stage if occupied
-            if (pipe[2] >= 0) execute_trace(pipe[2], prog, cycle); // typically -1 here
-            if (pipe[1] >= 0) decode_trace(pipe[1], prog, cycle); // ID is stalled -> show it
-            if (pipe[0] >= 0) fetch_trace(pipe[0], prog, cycle);  // IF is stalled -> show it
-
-            /* write a CSV snapshot of the pipeline after this cycle's movement */
-            char buf_if[256] = "", buf_id[256] = "", buf_ex[256] = "", buf_mem[256] = "", buf_wb[256] = "";
-            if (pipe[0] >= 0) snprintf(buf_if, sizeof(buf_if), "\"%s\"", prog[pipe[0]].text); // quote text
-            if (pipe[1] >= 0) snprintf(buf_id, sizeof(buf_id), "\"%s\"", prog[pipe[1]].text);
-            if (pipe[2] >= 0) snprintf(buf_ex, sizeof(buf_ex), "\"%s\"", prog[pipe[2]].text);
-            if (pipe[3] >= 0) snprintf(buf_mem, sizeof(buf_mem), "\"%s\"", prog[pipe[3]].text);
-            if (pipe[4] >= 0) snprintf(buf_wb, sizeof(buf_wb), "\"%s\"", prog[pipe[4]].text);
-            fprintf(csv, "%d,%s,%s,%s,%s,%s,%d\n", cycle, // write CSV row: cycle and stage contents
-                    buf_if, buf_id, buf_ex, buf_mem, buf_wb, stall_counter);
-            continue;                                   // move to next cycle iteration
-        }
-
-        /* --- Normal advancement when no stall insertion is required:
-              advance pipeline right-to-left: MEM->WB, EX->MEM, ID->EX, IF->ID, then fetch a new IF. */
-
-        if (pipe[3] >= 0) { pipe[4] = pipe[3]; pipe[3] = -1; } // move MEM to WB
-        if (pipe[2] >= 0) { pipe[3] = pipe[2]; pipe[2] = -1; } // move EX to MEM
-        if (pipe[1] >= 0) { pipe[2] = pipe[1]; pipe[1] = -1; } // move ID to EX
-        if (pipe[0] >= 0) { pipe[1] = pipe[0]; pipe[0] = -1; } // move IF to ID
-        if (pc < n) { pipe[0] = pc++; } else pipe[0] = -1;      // fetch new instruction into IF if available
-
-        /* After movement, detect RAW hazards for instruction now in ID and set stall_counter if needed.
-           Producers we consider are the instructions currently in EX and MEM (after movement above). */
-        {
-            int id_idx = pipe[1];                       // instruction index now in ID
-            int ex_idx = pipe[2];                       // instruction index now in EX
-            int mem_idx = pipe[3];                      // instruction index now in MEM
-            int req = needed_stalls_for_id(id_idx, ex_idx, mem_idx, prog); // determine required stalls
-            if (req > 0) {                              // if stalls needed
-                if (pipe[2] == id_idx) {                // if we moved ID->EX earlier and must undo
-                    pipe[1] = pipe[2];                  // move it back to ID so ID stays
-                    pipe[2] = -1;                       // set EX to bubble
-                }
-                stall_counter = req;                    // set stall counter so bubbles will be inserted next cycles
-                /* Note: actual bubble insertion happens at the top of the next iterations */
+static void core_finish(Core *c) {                      // run_end for every sink
+    for (int k=0;k<c->n_end;k++) c->on_end[k]->run_end(c->on_end[k], c);
+}                                                       // end core_finish
+
+/* Whether c still has work: instructions to retire, vector results to write or stores to drain. */
+static int core_busy(const Core *c) {                   // loop condition of one core
+    return c->completed < c->n || c->cycle <= c->vec_end || c->ms.sb_count > 0;
+}                                                       // end core_busy
+
+/* Advance c by one cycle. */
+static void core_advance(Core *c) {                     // one cycle of the pipeline
+    Instr *prog = c->prog; int n = c->n;                // shorthands for the loop body
+    const Resources *res = c->res; RunStats *st = c->st;
+    int trace = c->trace;
+    int *pipe = c->pipe, *fpu = c->fpu, *vrange = c->vrange;
+
+    c->cycle++;                                        // advance to next cycle number
+    PROBE2(cycle, c->ms.hart, c->cycle);                // hart, cycle
+    while (vrange[0] < vrange[1] && (!op_info[prog[vrange[0]].op].vec_unit || prog[vrange[0]].vend < c->cycle))
+        vrange[0]++;                                    // oldest op that can still be in the vector unit
+
+    /* --- Write-port arbitration: a slot needing more write cycles than the ports allow
+          stays in WB and freezes the whole pipeline behind it for this cycle. --- */
+    if (pipe[4] >= 0 && c->wb_left > 1) {               // more writes pending than ports this cycle
+        c->wb_left--;                                   // one more cycle of writes done
+        core_stall(c, SK_RF_WRITE); st->rf_write++;     // lost cycle charged to the write ports
+        if (trace) printf("C%3d: WB     [%2d] waiting for a register write port\n", c->cycle, pipe[4]);
+        mem_cycle(pipe[3], prog, res, &c->ms, st, c->cycle, trace, 0); // the data cache keeps working
+        return;                                         // nothing else moves this cycle
+    }
+
+    /* --- Handle write-back for instruction already in WB at start of this cycle --- */
+    if (pipe[4] >= 0) {                                 // if there is an instruction in WB slot
+        write_back_action(pipe[4], prog, c->cycle, trace);  // perform write-back action/logging
+        retire_activity(pipe[4], prog, st);             // energy events of the slot
+        for (int k=0;k<c->n_retire;k++) c->on_retire[k]->retired(c->on_retire[k], c, pipe[4]);
+        c->completed += 1 + (prog[pipe[4]].fused == FUSED_HEAD);  // a fused slot retires two instructions
+        PROBE4(retire, c->ms.hart, c->cycle, pipe[4], 1 + (prog[pipe[4]].fused == FUSED_HEAD)); // hart, cycle, slot, instructions retired
+        pipe[4] = -1;                                  // clear WB slot after write-back
+    }
+
+    /* --- Data-memory wait: a slot whose cache access or store-buffer entry is not finished
+          stays in MEM and freezes the pipeline behind it for this cycle. --- */
+    if (pipe[3] >= 0 && !c->ms.mem_done) {              // MEM occupant not done yet
+        static const char *why[] = { "the data cache", "a free store-buffer entry",
+                                     "a partially overlapping store to drain", "a DTLB miss",
+                                     "an L1D miss or upgrade" };
+        core_stall(c, SK_MEM);                          // lost cycle, charged by reason
+        if (c->ms.why == MW_CACHE) st->mem_cache++;
+        else if (c->ms.why == MW_SB_FULL) st->sb_full++;
+        else if (c->ms.why == MW_TLB) st->dtlb++;
+        else if (c->ms.why == MW_COH) st->coh++;
+        else st->sb_partial++;
+        if (trace) printf("C%3d: MEM    [%2d] waiting for %s\n", c->cycle, pipe[3], why[c->ms.why]);
+        mem_cycle(pipe[3], prog, res, &c->ms, st, c->cycle, trace, c->completed >= n); // keep working on it
+        return;                                         // everything behind MEM is frozen
+    }
+
+    /* --- If we are currently inserting stalls (stall_counter > 0) then:
+          - advance MEM->WB and EX->MEM
+          - place a bubble in EX (pipe[2] = -1)
+          - keep ID and IF unchanged (they are stalled)
+          This models inserting a NOP into EX for each stall cycle. */
+    if (c->stall_counter > 0) {                         // check if bubble cycles remain to be inserted
+        if (pipe[3] >= 0) { pipe[4] = pipe[3]; pipe[3] = -1; c->wb_left = write_cycles(pipe[4], prog, res); }  // MEM -> WB move
+        advance_execute(pipe, fpu);                     // EX/FP unit -> MEM move, EX becomes bubble
+        mem_cycle(pipe[3], prog, res, &c->ms, st, c->cycle, trace, c->completed >= n); // data-cache work of the new MEM occupant
+        /* ID and IF remain in their slots (stalled) */
+        core_stall(c, SK_BUBBLE);                       // count this bubble cycle in totals
+        c->stall_counter--;                             // one less stall to insert
+
+        /* produce human-readable traces for stages that have content this cycle */
+        if (trace) {
+            if (pipe[3] >= 0) memory_trace(pipe[3], prog, c->cycle);  // trace MEM stage if occupied
+            if (pipe[2] >= 0) execute_trace(pipe[2], prog, c->cycle);  // typically -1 here
+            fpu_trace(fpu, prog, c->cycle);             // FP ops keep advancing during bubbles
+            vector_trace(prog, vrange[0], vrange[1], c->cycle, &res->vec);  // so does the vector unit
+            if (pipe[1] >= 0) decode_trace(pipe[1], prog, c->cycle);  // ID is stalled -> show it
+            if (pipe[0] >= 0) fetch_trace(pipe[0], prog, c->cycle);   // IF is stalled -> show it
+        }
+        return;                                         // move to next cycle iteration
+    }
+
+    /* --- Normal advancement when no stall insertion is required:
+          advance pipeline right-to-left: MEM->WB, EX->MEM, ID->EX, IF->ID, then fetch a new IF. */
+
+    if (pipe[3] >= 0) { pipe[4] = pipe[3]; pipe[3] = -1; c->wb_left = write_cycles(pipe[4], prog, res); }  // move MEM to WB
+    advance_execute(pipe, fpu);                         // move EX (or the finishing FP op) to MEM
+    mem_cycle(pipe[3], prog, res, &c->ms, st, c->cycle, trace, c->completed >= n); // data-cache work of the new MEM occupant
+    int issued = pipe[1] < 0 || can_issue(pipe[1], prog, fpu, res);     // FP unit WAW / MEM-slot check
+    if (!issued) {                                      // ID and IF hold, EX gets a bubble
+        core_stall(c, SK_FP_ISSUE); st->fp_issue++;     // lost cycle charged to FP issue
+        if (trace) printf("C%3d: ISSUE  [%2d] waiting for the FP unit (WAW / MEM slot)\n", c->cycle, pipe[1]);
+    }
+    else {                                              // ID leaves for EX or the FP unit
+        if (pipe[1] >= 0 && op_info[prog[pipe[1]].op].fp_unit) {     // move ID to the FP unit
+            fpu[slot_latency(pipe[1], prog, res) - 1] = pipe[1]; pipe[1] = -1;
+        }
+        if (pipe[1] >= 0) { pipe[2] = pipe[1]; pipe[1] = -1; }     // move ID to EX
+        if (pipe[2] >= 0 && op_info[prog[pipe[2]].op].vec_unit) {     // EX dispatches it to the vector unit
+            int e = vector_issue(&prog[pipe[2]], c->cycle, &res->vec, &c->vs, &st->vec);
+            if (e > c->vec_end) c->vec_end = e;
+            vrange[1] = pipe[2] + 1;                    // newest dispatched op
+        }
+        if (pipe[0] >= 0) { pipe[1] = pipe[0]; pipe[0] = -1; }     // move IF to ID
+        int port_taken = res->unified_mem && pipe[3] >= 0 && slot_uses_memory(pipe[3], prog);     // MEM owns the port
+        if (c->pc < n && !port_taken && c->itlb_pc != c->pc) { // translate each fetch address once
+            c->itlb_pc = c->pc;
+            c->itlb_left = translate(c->ms.mmu, res, TLB_I, INSTR_KEY, (c->base + c->pc) * 4L >> 12, 12, st);
+        }
+        if (c->pc < n && port_taken) {                  // fetch loses arbitration: IF gets a bubble
+            pipe[0] = -1;
+            core_stall(c, SK_MEM_PORT); st->mem_port++; // lost fetch cycle charged to the memory port
+            if (trace) printf("C%3d: FETCH  blocked (memory port busy with MEM)\n", c->cycle);
+        }
+        else if (c->pc < n && c->itlb_left > 0) {       // ITLB miss being serviced: IF gets a bubble
+            pipe[0] = -1; c->itlb_left--;
+            core_stall(c, SK_ITLB); st->itlb++;         // lost fetch cycle charged to translation
+            if (trace) printf("C%3d: FETCH  waiting for ITLB (%d more)\n", c->cycle, c->itlb_left);
+        }
+        else if (c->pc < n) { pipe[0] = c->pc++; st->act[EV_FETCH]++; } else pipe[0] = -1; // fetch new instruction into IF if available
+        if (c->pc < n && prog[c->pc].fused == FUSED_TAIL) c->pc++; // a fused tail travels in its head's slot
+    }                                                   // end issue
+
+    /* After movement, detect RAW hazards for instruction now in ID and set stall_counter if needed.
+       Producers we consider are the instructions currently in EX, MEM and the FP unit (after movement above). */
+    if (issued) {                                       // a held ID slot was already checked on entry
+        int id_idx = pipe[1];                           // instruction index now in ID
+        int ex_idx = pipe[2];                           // instruction index now in EX
+        int mem_idx = pipe[3];                          // instruction index now in MEM
+        int fp_src;                                     // whether an FP register decides the stall
+        int req = needed_stalls_for_id(id_idx, ex_idx, mem_idx, fpu, prog, &fp_src);     // determine required stalls
+        if (fp_src) st->raw_fp += req; else st->raw_int += req;     // attribute RAW bubbles to the producer's file
+        if (id_idx >= 0) {                              // operands are read after the hazard clears
+            int extra = read_cycles(id_idx, prog, res) - 1;     // extra ID cycles for lack of read ports
+            req += extra;
+            st->rf_read += extra;                       // bubbles charged to the read ports
+        }
+        if (req > 0) {                                  // if stalls needed
+            PROBE4(hazard, c->ms.hart, c->cycle, id_idx, req); // hart, cycle, slot in ID, bubbles needed
+            if (pipe[2] == id_idx) {                    // if we moved ID->EX earlier and must undo
+                pipe[1] = pipe[2];                      // move it back to ID so ID stays
+                pipe[2] = -1;                           // set EX to bubble
             }
+            c->stall_counter = req;                     // set stall counter so bubbles will be inserted next cycles
+            /* Note: actual bubble insertion happens at the top of the next iterations */
         }
+    }
 
-        /* Print human-readable trace for this cycle after the movement.
-           Note: WB content already handled at the top of the loop this cycle. */
+    /* Print human-readable trace for this cycle after the movement.
+       Note: WB content already handled at the top of the loop this cycle. */
+    if (trace) {
         if (pipe[4] >= 0) {                               // if something is now in WB (pending write next cycle)
-            printf("C%3d: WB-pend [%2d] %s (will write next cycle)\n", cycle, pipe[4], prog[pipe[4]].text);
-        }
-        if (pipe[3] >= 0) memory_trace(pipe[3], prog, cycle); // trace MEM stage
-        if (pipe[2] >= 0) execute_trace(pipe[2], prog, cycle); // trace EX stage
-        if (pipe[1] >= 0) decode_trace(pipe[1], prog, cycle); // trace ID stage
-        if (pipe[0] >= 0) fetch_trace(pipe[0], prog, cycle);  // trace IF stage
-
-        /* write CSV snapshot for this cycle after movement */
-        char buf_if[256] = "", buf_id[256] = "", buf_ex[256] = "", buf_mem[256] = "", buf_wb[256] = "";
-        if (pipe[0] >= 0) snprintf(buf_if, sizeof(buf_if), "\"%s\"", prog[pipe[0]].text); // quote instruction text
-        if (pipe[1] >= 0) snprintf(buf_id, sizeof(buf_id), "\"%s\"", prog[pipe[1]].text);
-        if (pipe[2] >= 0) snprintf(buf_ex, sizeof(buf_ex), "\"%s\"", prog[pipe[2]].text);
-        if (pipe[3] >= 0) snprintf(buf_mem, sizeof(buf_mem), "\"%s\"", prog[pipe[3]].text);
-        if (pipe[4] >= 0) snprintf(buf_wb, sizeof(buf_wb), "\"%s\"", prog[pipe[4]].text);
-        fprintf(csv, "%d,%s,%s,%s,%s,%s,%d\n", cycle, // CSV row: pipeline contents and stalls_pending
-                buf_if, buf_id, buf_ex, buf_mem, buf_wb, stall_counter);
-    }                                                   // end while (simulation loop)
+            char b[300];                                  // room for a fused pair
+            printf("C%3d: WB-pend [%2d] %s (will write next cycle)\n", c->cycle, pipe[4], slot_text(pipe[4], prog, b, sizeof(b)));
+        }
+        if (pipe[3] >= 0) memory_trace(pipe[3], prog, c->cycle);  // trace MEM stage
+        if (pipe[2] >= 0) execute_trace(pipe[2], prog, c->cycle);  // trace EX stage
+        fpu_trace(fpu, prog, c->cycle);                   // trace FP unit occupants
+        vector_trace(prog, vrange[0], vrange[1], c->cycle, &res->vec);  // trace vector unit occupants
+        if (pipe[1] >= 0) decode_trace(pipe[1], prog, c->cycle);  // trace ID stage
+        if (pipe[0] >= 0) fetch_trace(pipe[0], prog, c->cycle);   // trace IF stage
+    }
+}                                                       // end core_advance
+
+static void core_step(Core *c) {                        // one cycle, then its sink events
+    core_advance(c);
+    PROBE6(advance, c->cycle, c->pipe[0], c->pipe[1], c->pipe[2], c->pipe[3], c->pipe[4]); // cycle and stage occupants after the shift
+    for (int k=0;k<c->n_cycle;k++) c->on_cycle[k]->cycle_end(c->on_cycle[k], c);
+}                                                       // end core_step
+
+/* Built-in sinks. Each output of the reported run is one of these, attached in this order:
+   cycle CSV, its index, viewer logs, timeline trace, per-instruction timeline CSV, JSON summary. */
+static void csv_sink_cycle(EngineSink *s, const Core *c) { // one pipeline_cycles.csv row
+    write_csv_row(s->ctx, c->cycle, c->pipe, c->fp_col, c->v_col, c->prog, c->stall_counter);
+}                                                       // end csv_sink_cycle
+
+static void index_sink_cycle(EngineSink *s, const Core *c) { // checkpoint before every `every`-th row
+    CycleIndex *ix = s->ctx;
+    int pipe[5];                                        // program indices, also in a streaming run
+    for (int k=0;k<5;k++) pipe[k] = c->pipe[k] >= 0 ? c->base + c->pipe[k] : -1;
+    if (c->cycle % ix->every == 0) index_checkpoint(ix, c->cycle + 1, ftell(ix->csv), pipe, c->stall_counter);
+}                                                       // end index_sink_cycle
+
+static void pipeview_sink_cycle(EngineSink *s, const Core *c) { // Kanata / O3PipeView events
+    pipeview_cycle(s->ctx, c->prog, c->pipe, c->fpu, c->cycle);
+}                                                       // end pipeview_sink_cycle
+
+static void trace_sink_cycle(EngineSink *s, const Core *c) { // collect timeline slices
+    core_trace_cycle(s->ctx, c->prog, c->pipe, c->fpu, c->vrange, c->res->vec.lanes, c->st->stalls, c->cycle);
+}                                                       // end trace_sink_cycle
+
+/* Triggered tracing: instead of every cycle, the CSV gets only windows around cycles where a
+   trigger fires, and stdout gets one detail line per recorded cycle. The last `before` cycles are
+   kept as snapshots in a ring, so a window can start before its trigger; a quiet cycle costs one
+   snapshot copy and the trigger tests. Triggers:
+     stall>=N[:TEXT]  a hazard leaves N or more bubbles to insert, optionally only while the
+                      instruction in ID contains TEXT
+     cycle=A[..B]     cycles A to B
+     every=N          every Nth cycle */
+enum { TRIG_STALL, TRIG_CYCLE, TRIG_EVERY };            // Trigger.kind
+#define MAX_TRIGGERS 8                                  // --trigger options
+#define MAX_HISTORY  4096                               // longest pre-trigger window
+typedef struct { int kind; long a, b; const char *text, *expr; } Trigger; // one trigger expression
+typedef struct {                                        // one remembered cycle
+    int cycle, stall_counter;                           // cycle number, bubbles still due
+    int pipe[5], fpu[MAX_FP_LAT], vrange[2];            // stage occupants, FP lanes, vector range
+} Snapshot;                                             // end Snapshot
+typedef struct {                                        // state of the trigger sink
+    FILE *csv;                                          // pipeline_cycles.csv
+    Trigger trig[MAX_TRIGGERS]; int ntrig;              // --trigger expressions
+    int before, after;                                  // window around a firing, in cycles
+    Snapshot *hist; int head, count;                    // ring of cycles not written yet (before + 1 slots)
+    int left;                                           // cycles still to record after the last firing
+    long windows, recorded;                             // windows opened, cycles written
+    int last;                                           // last cycle written
+} TriggerSink;                                          // end TriggerSink
+
+static int parse_trigger(const char *arg, Trigger *t) { // "stall>=N[:TEXT]", "cycle=A[..B]", "every=N"; 0 on success
+    char *end;                                          // end of each number
+    t->expr = arg; t->text = NULL;                      // no TEXT unless given
+    if (strncmp(arg, "stall>=", 7) == 0) {              // stall>=N[:TEXT]
+        t->kind = TRIG_STALL; t->a = strtol(arg + 7, &end, 10); // N
+        if (end == arg + 7 || t->a < 1) return -1;      // need N >= 1
+        if (*end == ':' && end[1]) t->text = end + 1;   // only while ID holds TEXT
+        else if (*end) return -1;                       // anything else after N
+        return 0;                                       // parsed
+    }
+    if (strncmp(arg, "cycle=", 6) == 0) {               // cycle=A[..B]
+        t->kind = TRIG_CYCLE; t->a = t->b = strtol(arg + 6, &end, 10); // A, and B = A unless given
+        if (end == arg + 6) return -1;                  // need A
+        if (strncmp(end, "..", 2) == 0) t->b = strtol(end + 2, &end, 10); // B
+        return *end || t->a < 1 || t->b < t->a ? -1 : 0; // need 1 <= A <= B, nothing after
+    }
+    if (strncmp(arg, "every=", 6) == 0) {               // every=N
+        t->kind = TRIG_EVERY; t->a = strtol(arg + 6, &end, 10); // N
+        return *end || t->a < 1 ? -1 : 0;               // need N >= 1, nothing after
+    }
+    return -1;                                          // no such trigger
+}                                                       // end parse_trigger
+
+static const Trigger *trigger_fired(const TriggerSink *ts, const Core *c) { // first trigger that fires this cycle
+    for (int k=0;k<ts->ntrig;k++) {                     // every trigger, in order
+        const Trigger *t = &ts->trig[k];                // trigger k
+        if (t->kind == TRIG_STALL ? c->stall_counter >= t->a && c->pipe[1] >= 0 // stall: enough bubbles due for ID's occupant
+                                    && (!t->text || strstr(c->prog[c->pipe[1]].text, t->text)) // and, with TEXT, only that instruction
+            : t->kind == TRIG_CYCLE ? c->cycle >= t->a && c->cycle <= t->b // cycle: within A..B
+            : c->cycle % t->a == 0) return t;           // every: a multiple of N
+    }
+    return NULL;                                        // none fired
+}                                                       // end trigger_fired
+
+static void trigger_sink_cycle(EngineSink *s, const Core *c) { // remember the cycle, write it if in a window
+    TriggerSink *ts = s->ctx;                           // the sink
+    int slots = ts->before + 1;                         // ring size
+    Snapshot *sn = &ts->hist[(ts->head + ts->count) % slots]; // slot for this cycle
+    if (ts->count == slots) { ts->head = (ts->head + 1) % slots; ts->count--; } // forget the oldest
+    ts->count++;                                        // this cycle is in the ring
+    sn->cycle = c->cycle; sn->stall_counter = c->stall_counter; // cycle number, bubbles still due
+    memcpy(sn->pipe, c->pipe, sizeof(sn->pipe));        // stage occupants
+    if (c->fp_col) memcpy(sn->fpu, c->fpu, sizeof(sn->fpu)); // FP lanes, if there are FP columns
+    memcpy(sn->vrange, c->vrange, sizeof(sn->vrange));  // vector range
+    const Trigger *t = trigger_fired(ts, c);            // test every trigger
+    if (t) {                                            // fired: open or extend a window
+        if (!ts->left && ts->last != c->cycle - 1) {    // a new window, not one running on
+            ts->windows++;                              // count the window
+            printf("Trigger %s fired at cycle %d; recording cycles %d..%d\n", t->expr, c->cycle, // announce it
+                   ts->hist[ts->head].cycle, c->cycle + ts->after);
+        }
+        ts->left = ts->after + 1;                       // this cycle and the ones after it
+    }
+    if (!ts->left) return;                              // outside a window: only remembered
+    for (;ts->count;ts->count--, ts->head = (ts->head + 1) % slots) { // history first, then this cycle
+        Snapshot *h = &ts->hist[ts->head];              // oldest cycle not written yet
+        write_csv_row(ts->csv, h->cycle, h->pipe, c->fp_col ? h->fpu : NULL, c->v_col ? h->vrange : NULL, // CSV row, as the full run writes it
+                      c->prog, h->stall_counter);
+        printf("W%5d:", h->cycle);                      // one detail line per cycle
+        static const char *stage[5] = { "IF", "ID", "EX", "MEM", "WB" }; // stage names
+        for (int k=0;k<5;k++) {                         // every stage
+            if (h->pipe[k] >= 0) printf(" %s [%2d]", stage[k], h->pipe[k]); // occupant
+            else printf(" %s  -- ", stage[k]);          // bubble
+        }
+        printf("  %d bubble(s) pending%s\n", h->stall_counter, h->cycle == c->cycle && t ? " <- trigger" : ""); // bubbles, and where the trigger fired
+        ts->recorded++; ts->last = h->cycle;            // count it; it is written now
+    }
+    ts->left--;                                         // one cycle of the window used
+}                                                       // end trigger_sink_cycle
+
+/* pipeline_timeline.csv in simulator's layout, from the cycle engine: the first cycle each
+   instruction spent in IF, ID, EX (or the FP unit), MEM and WB, and the bubbles and FP-issue
+   stalls it waited through in ID. A fused tail reports its head's cycles. simulator puts stalls
+   before IF, so its IF and ID are later than these whenever an instruction waited in ID. */
+typedef struct {                                        // state of the timeline CSV sink
+    FILE *f;
+    int (*at)[5];                                       // per instruction: first cycle in IF..WB, 0 = not yet
+    int *stalls;                                        // per instruction: stalls charged while in ID
+} StageLog;                                             // end StageLog
+
+static void stagelog_seen(StageLog *sl, int idx, int stage, int cycle) { // first sighting wins
+    if (idx >= 0 && !sl->at[idx][stage]) sl->at[idx][stage] = cycle;
+}                                                       // end stagelog_seen
+
+static void stagelog_cycle(EngineSink *s, const Core *c) { // record stage entries
+    StageLog *sl = s->ctx;
+    for (int k=0;k<5;k++) stagelog_seen(sl, c->pipe[k], k, c->cycle);
+    for (int q=0;q<MAX_FP_LAT;q++) stagelog_seen(sl, c->fpu[q], 2, c->cycle);
+}                                                       // end stagelog_cycle
+
+static void stagelog_stall(EngineSink *s, const Core *c, int kind) { // charge ID-side stalls to the ID slot
+    StageLog *sl = s->ctx;
+    if ((kind == SK_BUBBLE || kind == SK_FP_ISSUE) && c->pipe[1] >= 0) sl->stalls[c->pipe[1]]++;
+}                                                       // end stagelog_stall
+
+static void stagelog_end(EngineSink *s, const Core *c) { // write the whole table
+    StageLog *sl = s->ctx;
+    const Instr *prog = c->prog;
+    fprintf(sl->f, "idx,instruction,IF,ID,EX,MEM,WB,stalls_here%s\n", c->v_col ? ",VSTART,VEND" : "");
+    for (int i=0;i<c->n;i++) {
+        int h = prog[i].fused == FUSED_TAIL ? i - 1 : i; // a tail travels in its head's slot
+        fprintf(sl->f, "%d,%s,%d,%d,%d,%d,%d,%d", i, prog[i].text,
+                sl->at[h][0], sl->at[h][1], sl->at[h][2], sl->at[h][3], sl->at[h][4], h == i ? sl->stalls[i] : 0);
+        if (c->v_col && op_info[prog[i].op].vec_unit) fprintf(sl->f, ",%d,%d", prog[i].vstart, prog[i].vend);
+        else if (c->v_col) fprintf(sl->f, ",,");
+        fprintf(sl->f, "\n");
+    }
+}                                                       // end stagelog_end
+
+/* One JSON object with the run's totals, written at run end. */
+typedef struct { FILE *f; long retired, stalls[SK_COUNT]; } RunSummary; // state of the summary sink
+
+static void summary_retired(EngineSink *s, const Core *c, int idx) { // instructions, fused pairs as two
+    RunSummary *rs = s->ctx;
+    rs->retired += 1 + (c->prog[idx].fused == FUSED_HEAD);
+}                                                       // end summary_retired
+
+static void summary_stall(EngineSink *s, const Core *c, int kind) { // lost cycles by kind
+    (void)c;
+    ((RunSummary *)s->ctx)->stalls[kind]++;
+}                                                       // end summary_stall
+
+static void summary_end(EngineSink *s, const Core *c) { // {"cycles":..,"instructions":..,"cpi":..,"stalls":{..}}
+    RunSummary *rs = s->ctx;
+    fprintf(rs->f, "{\"cycles\":%d,\"instructions\":%ld,\"cpi\":%.4f,\"stalls\":{", c->cycle, rs->retired,
+            rs->retired ? (double)c->cycle / rs->retired : 0.0);
+    for (int k=0;k<SK_COUNT;k++) fprintf(rs->f, "%s\"%s\":%ld", k ? "," : "", sk_names[k], rs->stalls[k]);
+    fprintf(rs->f, "}}\n");
+}                                                       // end summary_end
+
+/* Attach the timeline trace of one hart: slices are collected as a sink and written between cycles. */
+static void core_attach_trace(Core *c, CoreTrace *ct, EngineSink *s, TraceOut *timeline, int hart) { // per-hart trace
+    core_trace_init(ct, timeline, hart);
+    memset(s, 0, sizeof(*s));
+    s->cycle_end = trace_sink_cycle; s->ctx = ct;
+    core_attach(c, s);
+    c->tr = ct;
+}                                                       // end core_attach_trace
+
+/* Run the cycle-by-cycle simulation over prog[0..n-1] with the given structural resources.
+   With no sinks, no timeline and trace 0 the same loop can be re-run silently for comparisons.
+   Returns the number of cycles; stall accounting is stored in *st. */
+static int run_pipeline(Instr *prog, int n, const Resources *res, int trace, RunStats *st,
+                        EngineSink **sinks, int nsinks, TraceOut *timeline) { // cycle engine
+    Core c;                                             // the single core of this run
+    CoreTrace ct;                                       // timeline state of the core
+    EngineSink ts;                                      // its sink
+    core_init(&c, prog, n, res, trace, st);
+    for (int k=0;k<nsinks;k++) core_attach(&c, sinks[k]);
+    if (timeline) core_attach_trace(&c, &ct, &ts, timeline, 0);
+    while (core_busy(&c)) {                             // run until all instructions complete WB and the vector unit and store buffer drain
+        core_step(&c);
+        if (c.tr) core_trace_flush(c.tr, prog, 0);
+    }
+    if (c.tr) core_trace_flush(c.tr, prog, c.cycle);    // close the open slices
+    core_finish(&c);
+    return c.cycle;                                     // total cycles simulated
+}                                                      // end run_pipeline
+
+/* Lockstep multicore run: every hart executes its own copy of the program, one cycle at a time,
+   and the directory applies the accesses of a cycle in hart order once all harts have stepped. */
+typedef struct {                                        // state shared by the hart threads
+    Core *cores; int harts;
+#ifdef HAVE_PTHREADS
+    pthread_mutex_t lock; pthread_cond_t cv;            // cycle barrier
+    int waiting; unsigned long gen;                     // threads at the barrier, barrier generation
+#endif
+    int stop;                                           // set once no hart is busy
+} HartRun;                                              // end HartRun
+
+#ifdef HAVE_PTHREADS
+static void hart_barrier(HartRun *hr) {                 // wait for every hart thread and the main thread
+    pthread_mutex_lock(&hr->lock);
+    unsigned long gen = hr->gen;
+    if (++hr->waiting == hr->harts + 1) { hr->waiting = 0; hr->gen++; pthread_cond_broadcast(&hr->cv); }
+    else while (gen == hr->gen) pthread_cond_wait(&hr->cv, &hr->lock);
+    pthread_mutex_unlock(&hr->lock);
+}                                                      // end hart_barrier
+
+typedef struct { HartRun *hr; int hart; } HartArg;      // thread argument
+static void *hart_thread(void *p) {                     // steps one hart per cycle
+    HartArg *a = p;
+    for (;;) {
+        hart_barrier(a->hr);                            // cycle starts
+        if (a->hr->stop) return NULL;
+        Core *c = &a->hr->cores[a->hart];
+        if (core_busy(c)) core_step(c);                 // reads the directory, writes only its own core
+        hart_barrier(a->hr);                            // cycle ends
+    }
+}                                                      // end hart_thread
+#endif
+
+/* Run harts copies of prog[0..n-1]; the sinks watch hart 0, and every
+   hart is a process of the timeline. Fills st[h] and cycles[h]
+   per hart and returns the cycles until the last hart finished. */
+static int run_harts(const Instr *prog, int n, const Resources *res, int trace, EngineSink **sinks, int nsinks,
+                     TraceOut *timeline, RunStats *st, int *cycles_of, Coherence *co) { // multicore engine
+    int harts = res->coh.harts, mem_ops = 0, cycles = 0;
+    int threads = res->coh.threads;                     // cleared if a hart thread cannot be started
+    for (int i=0;i<n;i++) mem_ops += IS_MEM(prog[i].op);
+    co->harts = harts;
+    for (co->cap = 64; co->cap < 2 * (mem_ops + 1) * harts; co->cap *= 2) ; // every access touches at most one line
+    co->lines = calloc((size_t)co->cap, sizeof(CohLine));
+    Core *cores = malloc(sizeof(Core) * (size_t)harts);
+    CoreTrace *traces = malloc(sizeof(CoreTrace) * (size_t)harts);
+    EngineSink tsinks[MAX_HARTS];                       // the trace sink of every hart
+    Instr *copies = malloc(sizeof(Instr) * (size_t)n * (size_t)harts); // per-run fields live in prog[]
+    if (!co->lines || !cores || !copies || !traces) { fprintf(stderr, "Out of memory\n"); exit(5); }
+    for (int h=0;h<harts;h++) {
+        memcpy(copies + (size_t)h * n, prog, sizeof(Instr) * (size_t)n);
+        core_init(&cores[h], copies + (size_t)h * n, n, res, h ? 0 : trace, &st[h]);
+        cores[h].ms.coh = co; cores[h].ms.hart = h;
+        for (int k=0;k<nsinks && h==0;k++) core_attach(&cores[h], sinks[k]);
+        if (timeline) core_attach_trace(&cores[h], &traces[h], &tsinks[h], timeline, h);
+    }
+    HartRun hr;
+    memset(&hr, 0, sizeof(hr));
+    hr.cores = cores; hr.harts = harts;
+#ifdef HAVE_PTHREADS
+    pthread_t tid[MAX_HARTS]; HartArg args[MAX_HARTS];
+    if (threads) {
+        pthread_mutex_init(&hr.lock, NULL); pthread_cond_init(&hr.cv, NULL);
+        for (int h=0;h<harts && threads;h++) {
+            args[h].hr = &hr; args[h].hart = h;
+            if (pthread_create(&tid[h], NULL, hart_thread, &args[h]) == 0) continue;
+            pthread_mutex_lock(&hr.lock);               // stop the h threads already waiting at the barrier
+            hr.harts = h; hr.stop = 1;
+            pthread_mutex_unlock(&hr.lock);
+            hart_barrier(&hr);
+            for (int k=0;k<h;k++) pthread_join(tid[k], NULL);
+            pthread_mutex_destroy(&hr.lock); pthread_cond_destroy(&hr.cv);
+            hr.harts = harts; hr.stop = 0;
+            threads = 0;                                // step the harts in turn instead
+        }
+    }
+#endif
+    for (;;) {                                          // one iteration per cycle
+        int busy = 0;
+        for (int h=0;h<harts;h++) busy |= core_busy(&cores[h]);
+        if (!busy) break;
+#ifdef HAVE_PTHREADS
+        if (threads) { hart_barrier(&hr); hart_barrier(&hr); } // release the harts, wait for them
+        else
+#endif
+        for (int h=0;h<harts;h++) if (core_busy(&cores[h])) core_step(&cores[h]);
+        for (int h=0;h<harts;h++) {                     // directory updates in hart order
+            for (int k=0;k<cores[h].ms.nreq;k++) coh_apply(co, &cores[h].ms.req[k]);
+            cores[h].ms.nreq = 0;
+            if (cores[h].tr) core_trace_flush(cores[h].tr, cores[h].prog, 0);
+        }
+    }
+#ifdef HAVE_PTHREADS
+    if (threads) {                                      // let the threads see stop and exit
+        hr.stop = 1; hart_barrier(&hr);
+        for (int h=0;h<harts;h++) pthread_join(tid[h], NULL);
+        pthread_mutex_destroy(&hr.lock); pthread_cond_destroy(&hr.cv);
+    }
+#endif
+    for (int h=0;h<harts;h++) {
+        if (cores[h].tr) core_trace_flush(cores[h].tr, cores[h].prog, cores[h].cycle); // close the open slices
+        core_finish(&cores[h]);
+        cycles_of[h] = cores[h].cycle;
+        if (cores[h].cycle > cycles) cycles = cores[h].cycle;
+    }
+    free(copies); free(cores); free(traces); free(co->lines);
+    return cycles;
+}                                                      // end run_harts
+
+/* Speculative segmented run (--segments=K): the program is cut into K pieces, and each piece is
+   simulated on its own thread from a guessed start, an empty pipeline, while piece 0 runs
+   from the true start. Afterwards the main thread walks the pieces in order. The true state at
+   the cycle piece k's first instruction is fetched is stepped forward, and after each cycle it
+   is compared with the first SEG_WINDOW states of piece k's guessed run. Once they match, the
+   rest of the guessed run is exact apart from a cycle offset, so its log is spliced in and its
+   counters are shifted. If no state matches within the window, piece k is re-simulated from the
+   true state. Hazards reach back only a few slots, so a match usually comes within a few cycles.
+   A piece's log holds enough of every cycle to replay it to the sinks, so every output still
+   comes out in cycle order. State that lives longer than the pipeline (vector unit, TLBs, store
+   buffer, other harts) cannot converge like this; runs that use it are not segmented. */
+#define MAX_SEGMENTS 64                                 // --segments
+#define SEG_WINDOW   64                                 // guessed states kept for matching
+typedef struct {                                        // one simulated cycle, enough to replay it to the sinks
+    int cycle;                                          // cycle number in its own run
+    int pipe[5], fpu[MAX_FP_LAT], stall_counter;        // stage occupants, FP lanes, bubbles still due
+    int retired;                                        // slot that left WB this cycle (-1: none)
+    int stall;                                          // SK_* charged this cycle (-1: none)
+} SegCycle;                                             // end SegCycle
+typedef struct { SegCycle *rows; int nrows, cap; SegCycle cur; } SegLog; // cycles of one run, and the one in progress
+typedef struct {                                        // everything that decides a core's future except the cycle number
+    int pipe[5], fpu[MAX_FP_LAT], pc, completed, stall_counter, wb_left, itlb_pc, itlb_left; // stage occupants, fetch and retire state, TLB stalls
+    int mem_idx, mem_left, mem_done, why, tlb_left;     // memory stage of the occupant
+} SegKey;                                               // end SegKey
+typedef struct {                                        // one piece and its guessed run
+    const Instr *prog; int n; const Resources *res;     // the program and the machine
+    int first, stop;                                    // first instruction; the run ends once IF holds stop (n: at the end)
+    Instr *copy;                                        // per-run fields live in prog[]
+    Core core; RunStats st;                             // guessed run, left at its last cycle
+    SegLog log; EngineSink sink;                        // cycle log of the guessed run and its sink
+    SegKey key[SEG_WINDOW + 1]; RunStats at[SEG_WINDOW + 1]; int nkeys; // state and counters after cycle j
+} SegJob;                                               // end SegJob
+typedef struct { const SegLog *log; int from, to, offset; } SegPiece; // log rows [from,to) shifted by offset cycles
+
+static void seglog_retired(EngineSink *s, const Core *c, int idx) { // remember the retiring slot
+    (void)c;                                            // the slot is enough
+    ((SegLog *)s->ctx)->cur.retired = idx;              // logged at the end of the cycle
+}                                                       // end seglog_retired
+
+static void seglog_stall(EngineSink *s, const Core *c, int kind) { // remember the lost cycle
+    (void)c;                                            // the kind is enough
+    ((SegLog *)s->ctx)->cur.stall = kind;               // logged at the end of the cycle
+}                                                       // end seglog_stall
+
+static void seglog_cycle(EngineSink *s, const Core *c) { // append the finished cycle
+    SegLog *lg = s->ctx;                                // the piece's log
+    if (lg->nrows == lg->cap && !(lg->rows = realloc(lg->rows, sizeof(SegCycle) * (size_t)(lg->cap = lg->cap ? 2*lg->cap : 1024)))) { // grow the log
+        fprintf(stderr, "Out of memory\n"); exit(5);    // no room for the log
+    }
+    SegCycle *r = &lg->rows[lg->nrows++];               // next row
+    *r = lg->cur;                                       // retired slot and stall of the cycle
+    r->cycle = c->cycle; r->stall_counter = c->stall_counter; // cycle number and bubbles
+    memcpy(r->pipe, c->pipe, sizeof(r->pipe));          // stage occupants
+    memcpy(r->fpu, c->fpu, sizeof(r->fpu));             // FP lanes
+    lg->cur.retired = lg->cur.stall = -1;               // nothing yet for the next cycle
+}                                                       // end seglog_cycle
+
+static void seglog_attach(Core *c, SegLog *lg, EngineSink *s) { // log every cycle of c
+    memset(s, 0, sizeof(*s));                           // no other callbacks
+    s->retired = seglog_retired; s->stall = seglog_stall; s->cycle_end = seglog_cycle; s->ctx = lg; // three callbacks into lg
+    lg->cur.retired = lg->cur.stall = -1;               // nothing yet for the first cycle
+    core_attach(c, s);                                  // add it to c's sinks
+}                                                       // end seglog_attach
+
+static void seg_key(const Core *c, SegKey *k) {         // the comparable part of c
+    memset(k, 0, sizeof(*k));                           // unused fields compare equal
+    memcpy(k->pipe, c->pipe, sizeof(k->pipe));          // stage occupants
+    memcpy(k->fpu, c->fpu, sizeof(k->fpu));             // FP lanes
+    k->pc = c->pc; k->completed = c->completed; k->stall_counter = c->stall_counter; k->wb_left = c->wb_left; // fetch, retire, bubbles, write-back
+    k->itlb_pc = c->itlb_pc; k->itlb_left = c->itlb_left; // ITLB stall
+    k->mem_idx = c->ms.mem_idx; k->mem_done = c->ms.mem_done; // memory stage occupant
+    if (c->ms.mem_idx >= 0 && !c->ms.mem_done) {        // the rest is stale once the occupant is done
+        k->mem_left = c->ms.mem_left; k->why = c->ms.why; k->tlb_left = c->ms.tlb_left; // its remaining latency and cause
+    }
+}                                                       // end seg_key
+
+/* Step c until IF holds stop (or the program ends). */
+static void seg_run_to(Core *c, int stop) {             // finish a piece
+    while (core_busy(c)) {                              // until the program ends
+        core_step(c);                                   // one cycle
+        if (c->pipe[0] == stop) break;                  // the next piece starts here
+    }
+}                                                       // end seg_run_to
+
+static void *seg_thread(void *p) {                      // guessed run of one piece
+    SegJob *j = p;                                      // the piece
+    memcpy(j->copy, j->prog, sizeof(Instr) * (size_t)j->n); // private copy: the run writes prog[]
+    core_init(&j->core, j->copy, j->n, j->res, 0, &j->st); // empty pipeline at cycle 0
+    j->core.pc = j->first; j->core.completed = j->first; // everything before the piece has retired
+    seglog_attach(&j->core, &j->log, &j->sink);         // log every cycle
+    seg_key(&j->core, &j->key[0]); j->at[0] = j->st; j->nkeys = 1; // state and counters before the first cycle
+    while (core_busy(&j->core)) {                       // until the next piece or the end
+        core_step(&j->core);                            // one cycle
+        if (j->nkeys <= SEG_WINDOW) { seg_key(&j->core, &j->key[j->nkeys]); j->at[j->nkeys++] = j->st; } // the first SEG_WINDOW states and counters
+        if (j->core.pipe[0] == j->stop) break;          // the next piece starts here
+    }
+    return NULL;                                        // thread exit
+}                                                       // end seg_thread
+
+static void seg_shift(RunStats *t, const RunStats *fin, const RunStats *at) { // t += fin - at
+#define SHIFT(f) t->f += fin->f - at->f                 // one counter
+    SHIFT(stalls); SHIFT(rf_read); SHIFT(rf_write); SHIFT(mem_port); SHIFT(raw_int); SHIFT(raw_fp); SHIFT(fp_issue); // stall causes
+    SHIFT(mem_cache); SHIFT(sb_full); SHIFT(sb_partial); SHIFT(loads); SHIFT(forwards); SHIFT(sb_occupancy); // memory and store buffer
+    SHIFT(itlb); SHIFT(dtlb); SHIFT(walks); SHIFT(walk_cycles); SHIFT(coh); // TLBs and coherence
+    for (int k=0;k<TLB_COUNT;k++) { SHIFT(tlb_hits[k]); SHIFT(tlb_misses[k]); } // per-TLB hits and misses
+    for (int k=0;k<EV_COUNT;k++) SHIFT(act[k]);         // energy events
+#undef SHIFT
+}                                                       // end seg_shift
+
+/* Whether a run can be segmented: only pipeline-local state may differ between a guess and the truth. */
+static int seg_possible(const Instr *prog, int n, const Resources *res) { // see the comment above
+    if (res->coh.harts || res->sb_entries || res->tlb.entries[TLB_I] || res->tlb.entries[TLB_D] || res->tlb.entries[TLB_L2]) return 0; // long-lived state: no
+    for (int i=0;i<n;i++) if (op_info[prog[i].op].vec_unit) return 0; // vector unit: no
+    return 1;                                           // pipeline-local state only
+}                                                       // end seg_possible
+
+/* Drop-in for run_pipeline without the text trace; prints how the pieces were reconciled. */
+static int run_segments(Instr *prog, int n, const Resources *res, RunStats *st, EngineSink **sinks, int nsinks,
+                        TraceOut *timeline, int segs) { // speculative parallel engine
+    if (segs > n) segs = n;                             // at least one instruction per piece
+    SegJob *jobs = calloc((size_t)segs, sizeof(SegJob)); // one job per piece
+    SegPiece *pieces = malloc(sizeof(SegPiece) * (size_t)(2 * segs)); // at most two pieces of log per piece
+    if (!jobs || !pieces) { fprintf(stderr, "Out of memory\n"); exit(5); } // no room for the jobs
+    for (int k=0;k<segs;k++) {                          // set up each piece
+        SegJob *j = &jobs[k];                           // the piece
+        j->prog = prog; j->n = n; j->res = res;         // the program and the machine
+        j->first = (int)((long)n * k / segs);           // even split by instruction count
+        while (j->first < n && prog[j->first].fused == FUSED_TAIL) j->first++; // never split a fused pair
+        if (k) jobs[k-1].stop = j->first;               // previous piece ends where this one starts
+        if (!(j->copy = malloc(sizeof(Instr) * (size_t)n))) { fprintf(stderr, "Out of memory\n"); exit(5); } // private copy for the thread
+    }
+    jobs[segs-1].stop = n;                              // the last piece runs to the end
+#ifdef HAVE_PTHREADS
+    pthread_t tid[MAX_SEGMENTS];                        // one thread per piece
+    int started[MAX_SEGMENTS];                          // whether each thread started
+    for (int k=0;k<segs;k++)                            // a piece whose thread cannot start runs here
+        if (!(started[k] = pthread_create(&tid[k], NULL, seg_thread, &jobs[k]) == 0)) seg_thread(&jobs[k]); // start it, or run it here
+    for (int k=0;k<segs;k++) if (started[k]) pthread_join(tid[k], NULL); // wait for every guessed run
+#else
+    for (int k=0;k<segs;k++) seg_thread(&jobs[k]);      // no threads: still exact, just not faster
+#endif
+
+    /* Reconcile: t is the true core, handed from piece to piece. */
+    Core t;                                             // true core
+    RunStats tst;                                       // its counters
+    SegLog tlog;                                        // cycles the true core re-simulated
+    EngineSink tsink;                                   // its log sink
+    memset(&tlog, 0, sizeof(tlog));                     // empty log
+    int npieces = 0, spliced = 0, resim = 0;            // log pieces, confirmed guesses, re-simulated cycles
+    pieces[npieces++] = (SegPiece){ &jobs[0].log, 0, jobs[0].log.nrows, 0 }; // piece 0 started from the true state
+    for (int k=1;k<segs;k++) {                          // every later piece
+        SegJob *prev = &jobs[k-1], *j = &jobs[k];       // the piece before and this one
+        t = prev->core;                                 // true state: piece k-1's last cycle
+        tst = prev->st;                                 // true counters at that point
+        t.prog = prog; t.st = &tst; t.ms.mmu = &t.mmu;  // own counters, own MMU
+        t.n_retire = t.n_stall = t.n_cycle = t.n_end = 0; // drop the previous piece's sinks
+        seglog_attach(&t, &tlog, &tsink);               // log what the true core re-simulates
+        int from = tlog.nrows, match = -1;              // first re-simulated row, matching guessed state
+        for (int steps=0;;steps++) {                    // step the truth until it meets the guess
+            SegKey key;                                 // true state now
+            seg_key(&t, &key);                          // comparable part of it
+            for (int g=0;g<j->nkeys && match<0;g++) if (memcmp(&key, &j->key[g], sizeof(key)) == 0) match = g; // find it among the guessed states
+            if (match >= 0 || steps == SEG_WINDOW || !core_busy(&t) || (steps && t.pipe[0] == j->stop)) break; // matched, window used up, or piece done
+            core_step(&t);                              // one more true cycle
+        }
+        if (match < 0) {                                // no convergence: the true core finishes the piece
+            if (!(tlog.nrows > from && t.pipe[0] == j->stop)) seg_run_to(&t, j->stop); // finish the piece unless it already is
+            pieces[npieces++] = (SegPiece){ &tlog, from, tlog.nrows, 0 }; // re-simulated cycles
+            resim += tlog.nrows - from;                 // count them
+            j->core = t; j->st = tst;                   // the true state at the end of piece k
+            continue;                                   // next piece
+        }
+        resim += tlog.nrows - from;                     // cycles stepped before the match
+        int offset = t.cycle - match;                   // guessed cycle + offset = true cycle
+        if (tlog.nrows > from) pieces[npieces++] = (SegPiece){ &tlog, from, tlog.nrows, 0 }; // re-simulated cycles before the match
+        pieces[npieces++] = (SegPiece){ &j->log, match, j->log.nrows, offset }; // the rest of the guessed run, shifted
+        seg_shift(&tst, &j->st, &j->at[match]);         // true counters at the end of piece k
+        j->core.cycle += offset;                        // the guessed run's end is the true end of piece k
+        j->st = tst;                                    // piece k's counters are now true
+        spliced++;                                      // count the match
+    }
+    int cycle = segs > 1 ? jobs[segs-1].core.cycle : jobs[0].core.cycle; // total cycles
+    *st = jobs[segs-1].st;                              // counters of the whole run
+
+    /* Replay every cycle, in order, to the sinks of the reported run. */
+    Core r;                                             // replaying core
+    RunStats rst;                                       // its counters
+    CoreTrace ct;                                       // timeline state
+    EngineSink ts;                                      // timeline sink
+    core_init(&r, prog, n, res, 0, &rst);               // empty pipeline, the whole program
+    for (int k=0;k<nsinks;k++) core_attach(&r, sinks[k]); // the run's sinks
+    if (timeline) core_attach_trace(&r, &ct, &ts, timeline, 0); // and the timeline
+    for (int p=0;p<npieces;p++) {                       // every log piece
+        for (int i=pieces[p].from;i<pieces[p].to;i++) { // every row of it
+            const SegCycle *row = &pieces[p].log->rows[i]; // the logged cycle
+            r.cycle = row->cycle + pieces[p].offset;    // true cycle number
+            memcpy(r.pipe, row->pipe, sizeof(r.pipe));  // stage occupants
+            memcpy(r.fpu, row->fpu, sizeof(r.fpu));     // FP lanes
+            r.stall_counter = row->stall_counter;       // bubbles still due
+            if (row->retired >= 0) for (int k=0;k<r.n_retire;k++) r.on_retire[k]->retired(r.on_retire[k], &r, row->retired); // retire callbacks
+            if (row->stall >= 0) {                      // stall callbacks
+                rst.stalls++;                           // counted again for the report
+                for (int k=0;k<r.n_stall;k++) r.on_stall[k]->stall(r.on_stall[k], &r, row->stall); // tell every sink
+            }
+            for (int k=0;k<r.n_cycle;k++) r.on_cycle[k]->cycle_end(r.on_cycle[k], &r); // end-of-cycle callbacks
+            if (r.tr) core_trace_flush(r.tr, prog, 0);  // timeline up to this cycle
+        }
+    }
+    r.cycle = cycle;                                    // end of the run
+    if (r.tr) core_trace_flush(r.tr, prog, r.cycle);    // close the last timeline slices
+    core_finish(&r);                                    // end-of-run callbacks
+    printf("Segments: %d, %d guessed start(s) confirmed, %d re-simulated cycle(s) of %d\n", // how the pieces were reconciled
+           segs, spliced, resim, cycle);
+    for (int k=0;k<segs;k++) { free(jobs[k].copy); free(jobs[k].log.rows); } // copies and logs
+    free(tlog.rows); free(jobs); free(pieces);          // true log, jobs, pieces
+    return cycle;                                       // total cycles
+}                                                       // end run_segments
+
+/* Streaming run (--stream): instead of the whole program, the core sees a small window of it that
+   slides along as the run goes. The window is refilled from the input so that fetch always finds
+   the next two instructions decoded, a batch from the source at a time; the decode passes (vl, symbolic addresses, fusion, renaming)
+   run on each instruction as it arrives. When the window is full, the instructions older than
+   everything still in flight (pipeline, FP unit, MEM, store buffer, vector unit) are dropped and
+   every index the core holds is shifted down; if that frees too little, the window doubles. The
+   pipeline holds a handful of instructions, so the window stays at STREAM_WINDOW entries and memory
+   does not grow with the input. Renaming keeps program-wide indices, so a producer that has left
+   the window is simply ready, and address keys are the same as in a whole-program run. */
+#define STREAM_WINDOW 64                                // initial window entries (about 18 KiB)
+typedef struct {                                        // input feeding one streaming run
+    InstrSource src; int eof;                           // where the instructions come from
+    Instr *win; int cap, filled, read;                  // window: base..base+filled-1 decoded, the rest up to read-1 fetched
+    int opts; unsigned rules; int vlen;                 // decode settings of the run
+    int producer[NUM_REGS], writer[NUM_REGS];           // renaming and address tables, program indices
+    int vl, slot, pairs;                                // vl in effect, next slot number, fused pairs so far
+} Stream;                                               // end Stream
+
+/* Rename win[j] once its fused role is final (resolve_producers for one instruction). */
+static void stream_rename(Stream *s, const Core *c, int j) { // fill win[j].prod[] and elim
+    Instr *in = &s->win[j];
+    for (int k=0;k<MAX_SRCS;k++) in->prod[k] = -1;
+    in->elim = 0;
+    if ((s->opts & OPT_ZERO_IDIOM) && !in->fused && is_zero_idiom(in)) { s->producer[in->rd_id] = -1; in->elim = 1; return; }
+    if ((s->opts & OPT_MOVE_ELIM) && !in->fused && in->op == OP_MOV) {
+        s->producer[in->rd_id] = s->producer[in->rs_id[0]];
+        in->elim = 1;
+        return;
+    }
+    for (int k=0;k<in->rs_count;k++) {                  // producers still in the window, others are ready
+        int p = s->producer[in->rs_id[k]];
+        if (!IS_VEC_REG(in->rs_id[k]) && p >= c->base) in->prod[k] = p - c->base;
+    }
+    if (in->rd_id >= 0) s->producer[in->rd_id] = c->base + j;
+}                                                       // end stream_rename
+
+/* Make room: drop what nothing in flight refers to, or double the window. */
+static int stream_slide(Stream *s, Core *c) {           // 0, or -1 when out of memory
+    int drop = c->pc;                                   // oldest instruction still needed
+    for (int k=0;k<5;k++) if (c->pipe[k] >= 0 && c->pipe[k] < drop) drop = c->pipe[k];
+    for (int q=0;q<MAX_FP_LAT;q++) if (c->fpu[q] >= 0 && c->fpu[q] < drop) drop = c->fpu[q];
+    if (c->ms.mem_idx >= 0 && c->ms.mem_idx < drop) drop = c->ms.mem_idx;
+    for (int k=0;k<c->ms.sb_count;k++) if (c->ms.sb[(c->ms.sb_head + k) % MAX_SB].idx < drop) drop = c->ms.sb[(c->ms.sb_head + k) % MAX_SB].idx;
+    if (c->vrange[0] < c->vrange[1] && c->vrange[0] < drop) drop = c->vrange[0];
+    if (drop < s->cap / 4) {                            // too much in flight: grow instead
+        Instr *w = realloc(s->win, sizeof(Instr) * (size_t)s->cap * 2);
+        if (!w) return -1;
+        s->win = c->prog = w; s->cap *= 2;
+        return 0;
+    }
+    memmove(s->win, s->win + drop, sizeof(Instr) * (size_t)(s->read - drop)); // drop the retired front of the window
+    s->filled -= drop; s->read -= drop; c->base += drop; // and shift the indexes with it
+    for (int j=0;j<s->filled;j++)
+        for (int k=0;k<MAX_SRCS;k++) if (s->win[j].prod[k] >= 0) s->win[j].prod[k] = s->win[j].prod[k] >= drop ? s->win[j].prod[k] - drop : -1;
+    for (int k=0;k<5;k++) if (c->pipe[k] >= 0) c->pipe[k] -= drop;
+    for (int q=0;q<MAX_FP_LAT;q++) if (c->fpu[q] >= 0) c->fpu[q] -= drop;
+    if (c->ms.mem_idx >= 0) c->ms.mem_idx -= drop;
+    for (int k=0;k<c->ms.sb_count;k++) c->ms.sb[(c->ms.sb_head + k) % MAX_SB].idx -= drop;
+    if (c->itlb_pc >= 0) c->itlb_pc -= drop;            // may go negative: then it never matches pc again
+    for (int k=0;k<2;k++) c->vrange[k] = c->vrange[k] > drop ? c->vrange[k] - drop : 0; // an empty range stays empty
+    c->pc -= drop; c->completed -= drop;
+    return 0;
+}                                                       // end stream_slide
+
+/* Decode until fetch has two renamed instructions ahead of it (or the input ends); c->n counts the
+   renamed ones. Returns 0, or an exit code. */
+static int stream_fill(Stream *s, Core *c) {            // keep the window ahead of fetch
+    while (!s->eof && s->filled < c->pc + 3) {
+        if (s->filled == s->read) {                     // all fetched ones decoded: one batch into the free space
+            if (s->read == s->cap && stream_slide(s, c)) { fprintf(stderr, "Out of memory\n"); return 5; } // window full: retire its front first
+            int got = s->src.next(&s->src, s->win + s->read, s->cap - s->read); // next batch of the source
+            if (got < 0) return -got;                   // parse error or the like
+            if (got == 0) {                             // end of input: the last instruction is final
+                s->eof = 1;                             // no more input
+                if (s->filled) stream_rename(s, c, s->filled - 1); // the last one's role is final now
+                break;                                  // nothing left to decode
+            }
+            s->read += got;                             // decoded, not renamed yet
+        }
+        Instr *in = &s->win[s->filled];                 // next instruction to rename
+        int g = c->base + s->filled;                    // program index of the new instruction
+        if (in->op == OP_VSETVLI) s->vl = s->vlen / in->sew; // assign_vl
+        else if (in->op == OP_VSETIVLI) s->vl = (in->imm < s->vlen / in->sew) ? (int)in->imm : s->vlen / in->sew;
+        in->vl = s->vl;
+        if (IS_MEM(in->op)) in->addr_key = s->writer[in->rs_id[0]]; // assign_addresses
+        if (in->rd_id >= 0) s->writer[in->rd_id] = g;
+        in->finished = 0; in->vstart = 0;
+        in->fused = FUSED_NONE; in->slot = s->slot++;   // fuse_pairs, one pair at a time
+        if (s->filled && in[-1].fused == FUSED_NONE && fusable(&in[-1], in, s->rules)) {
+            in[-1].fused = FUSED_HEAD; in->fused = FUSED_TAIL;
+            in->slot = in[-1].slot; s->slot--;
+            s->pairs++;
+        }
+        if (s->filled) stream_rename(s, c, s->filled - 1); // the previous one's role is settled now
+        s->filled++;
+    }
+    c->n = s->eof ? s->filled : s->filled - 1;
+    return 0;
+}                                                       // end stream_fill
+
+/* Streaming drop-in for run_pipeline without the text trace or a timeline. has_fpu / has_vec pick
+   the CSV columns, which a whole-program run derives from prog[]. Returns the cycles, or minus an
+   exit code. */
+static int run_stream(const char *spec, int opts, unsigned rules, int has_fpu, int has_vec, const Resources *res,
+                      RunStats *st, EngineSink **sinks, int nsinks, int *pairs) { // streaming cycle engine
+    Stream s;
+    Core c;
+    memset(&s, 0, sizeof(s));
+    s.opts = opts; s.rules = rules; s.vlen = res->vec.vlen; s.vl = res->vec.vlen / 32;
+    for (int r=0;r<NUM_REGS;r++) { s.producer[r] = -1; s.writer[r] = -1 - r; }
+    s.cap = STREAM_WINDOW;
+    if (!(s.win = malloc(sizeof(Instr) * (size_t)s.cap))) { fprintf(stderr, "Out of memory\n"); return -5; }
+    int err = source_open(&s.src, spec);                // open the input again
+    if (err) { free(s.win); return -err; }              // not opened: drop the window
+    core_init(&c, s.win, 0, res, 0, st);
+    if (has_fpu) c.fp_col = c.fpu;                      // same columns as the whole-program run
+    if (has_vec) c.v_col = c.vrange;
+    for (int k=0;k<nsinks;k++) core_attach(&c, sinks[k]);
+    while (!(err = stream_fill(&s, &c)) && core_busy(&c)) core_step(&c);
+    if (!err) core_finish(&c);
+    source_close(&s.src);                               // close the input
+    free(s.win);
+    if (pairs) *pairs = s.pairs;
+    return err ? -err : c.cycle;
+}                                                       // end run_stream
+
+/* One silent comparison run with the given decode settings, over prog[] or streamed from src.
+   Exits on an error: the input has been parsed once already, so only reading it again can fail. */
+static int run_config(Instr *prog, int n, const char *src, int opts, unsigned rules, int has_fpu, int has_vec,
+                      const Resources *res, RunStats *st) { // cycles of one configuration
+    if (src) {
+        int cycles = run_stream(src, opts, rules, has_fpu, has_vec, res, st, NULL, 0, NULL);
+        if (cycles < 0) exit(-cycles);
+        return cycles;
+    }
+    fuse_pairs(prog, n, rules);
+    resolve_producers(prog, n, opts);
+    return run_pipeline(prog, n, res, 0, st, NULL, 0, NULL);
+}                                                       // end run_config
+
+/* Lockstep batch engine (--batch=LIST): many short, independent programs on the base pipeline
+   (unlimited resources, no decode-stage options), up to MAX_BATCH_LANES at a time. The state
+   of every lane lives in one array per field, and a cycle is one pass over the lanes with
+   selects instead of branches, so the compiler can keep the lanes in vector registers. A lane
+   whose program retires is refilled from the queue before the next cycle. Only the integer
+   pipeline runs in lockstep: in the base model every ALU op and memory access takes one cycle,
+   and a RAW hazard is a producer one (EX) or two (MEM) slots ahead of ID. Programs that use
+   the FP or vector unit go through run_pipeline instead. */
+#define MAX_BATCH_LANES 16                              // --batch-lanes
+typedef struct {                                        // one program of the batch
+    char path[MAX_LINE];                                // program path from the list
+    Instr *prog; int n;                                 // parsed program, ready for run_pipeline
+    unsigned char *near;                                // per instruction: 1 if it reads the result of i-1, 2 if of i-2
+    int lockstep;                                       // 0: FP or vector ops, run by the scalar engine
+    int cycles, stalls;                                 // result of the batch run
+} BatchJob;                                             // end BatchJob
+typedef struct {                                        // pipeline state of every lane, one array per field
+    int pipe[5][MAX_BATCH_LANES];                       // IF, ID, EX, MEM, WB per lane (-1: bubble)
+    int pc[MAX_BATCH_LANES], n[MAX_BATCH_LANES];        // next fetch, program length (0: idle lane)
+    int completed[MAX_BATCH_LANES], cycle[MAX_BATCH_LANES]; // retired instructions, cycle count
+    int stall[MAX_BATCH_LANES], stalls[MAX_BATCH_LANES]; // bubbles still to insert, bubbles inserted
+    int need[MAX_BATCH_LANES];                          // hazard lookup of the instruction now in ID
+    const unsigned char *near[MAX_BATCH_LANES];         // BatchJob.near of each lane's program
+    int job[MAX_BATCH_LANES];                           // job in the lane (-1: idle)
+} BatchLanes;                                           // end BatchLanes
+
+/* Read one program of the batch; returns 0 on success, like simulate's exit codes otherwise. */
+static int batch_load(BatchJob *j) {                    // parse and prepare one job
+    InstrSource in;                                     // the job's input
+    int cap = 0, got, err = source_open(&in, j->path);  // any source works as a batch job
+    j->prog = NULL; j->n = 0; j->lockstep = 1;          // nothing loaded yet; lockstep unless shown otherwise
+    if (err) return err;                                // not opened, already reported
+    do {                                                // read the whole program
+        if (j->n + SOURCE_BATCH > cap && !(j->prog = realloc(j->prog, sizeof(Instr) * (size_t)(cap += cap + SOURCE_BATCH)))) { // make room for one more batch
+            fprintf(stderr, "Out of memory\n"); source_close(&in); return 5; // out of memory: give up the job
+        }
+        got = in.next(&in, j->prog + j->n, SOURCE_BATCH); // next batch of the program
+        for (int i=0;i<got;i++)                         // every op of the batch
+            if (op_info[j->prog[j->n + i].op].fp_unit || op_info[j->prog[j->n + i].op].vec_unit) j->lockstep = 0; // FP or vector ops: not a lockstep job
+        if (got > 0) j->n += got;                       // append it
+    } while (got > 0);                                  // until the end or an error
+    source_close(&in);                                  // close the job's input
+    if (got < 0) { fprintf(stderr, "  in %s\n", j->path); return -got; } // name the job the error came from
+    if (j->n == 0) { fprintf(stderr, "No instructions parsed in %s.\n", j->path); return 4; } // nothing to simulate
+    assign_vl(j->prog, j->n, 512);                      // what simulate does for a default run
+    assign_addresses(j->prog, j->n);                    // memory addresses
+    fuse_pairs(j->prog, j->n, 0);                       // no fusion in the base model
+    resolve_producers(j->prog, j->n, 0);                // producer of every source
+    if (!(j->near = calloc((size_t)j->n, 1))) { fprintf(stderr, "Out of memory\n"); return 5; } // hazard bits per instruction
+    for (int i=0;i<j->n;i++)                            // every instruction
+        for (int k=0;k<j->prog[i].rs_count;k++) {       // every source
+            int d = i - j->prog[i].prod[k];             // distance to the producer
+            if (j->prog[i].prod[k] >= 0 && d <= 2) j->near[i] |= (unsigned char)d; // producer one or two slots ahead
+        }
+    return 0;                                           // job ready
+}                                                       // end batch_load
+
+static void batch_fill(BatchLanes *b, int l, BatchJob *jobs, int job) { // start job in lane l (-1: idle)
+    for (int k=0;k<5;k++) b->pipe[k][l] = -1;           // empty pipeline
+    b->pc[l] = b->completed[l] = b->cycle[l] = b->stall[l] = b->stalls[l] = b->need[l] = 0; // counters start at 0
+    b->job[l] = job;                                    // the job, or -1
+    b->n[l] = job >= 0 ? jobs[job].n : 0;               // its length (0: idle lane)
+    b->near[l] = job >= 0 ? jobs[job].near : NULL;      // its hazard bits
+}                                                       // end batch_fill
+
+/* One cycle of every lane: core_advance of the base model with every branch turned into a select.
+   b->need must hold each lane's hazard lookup for its instruction in IF. Returns the number of
+   lanes whose program retired its last instruction this cycle. */
+static int batch_step(BatchLanes *b, int lanes) {       // advance all lanes together
+    int finished = 0;                                   // lanes done this cycle
+    int *if_ = b->pipe[0], *id = b->pipe[1], *ex = b->pipe[2], *mem = b->pipe[3], *wb = b->pipe[4]; // stage columns
+    for (int l=0;l<lanes;l++) {                         // every lane
+        int on = b->completed[l] < b->n[l];             // idle and finished lanes keep their state
+        int bubble = on & (b->stall[l] > 0);            // insert a bubble into EX, hold ID and IF
+        int move = on & !bubble;                        // normal advancement
+        int fetch = move & (b->pc[l] < b->n[l]);        // a free IF slot and instructions left
+        b->cycle[l] += on;                              // count the cycle
+        b->completed[l] += on & (wb[l] >= 0);           // WB retires
+        wb[l] = on ? mem[l] : wb[l];                    // MEM -> WB
+        mem[l] = on ? ex[l] : mem[l];                   // EX -> MEM
+        ex[l] = bubble ? -1 : move ? id[l] : ex[l];     // ID -> EX, or a bubble
+        id[l] = move ? if_[l] : id[l];                  // IF -> ID
+        if_[l] = fetch ? b->pc[l] : move ? -1 : if_[l]; // fetch
+        b->pc[l] += fetch;                              // next instruction to fetch
+        b->stall[l] -= bubble; b->stalls[l] += bubble;  // one bubble inserted
+        int near = move ? b->need[l] : 0;               // RAW hazard of the new ID occupant
+        int req = ex[l] >= 0 && (near & (id[l] - ex[l])) ? 2 : mem[l] >= 0 && (near & (id[l] - mem[l])) ? 1 : 0; // producer in EX: 2 bubbles, in MEM: 1
+        b->stall[l] = move && req ? req : b->stall[l];  // start the stall
+        finished += on & (b->completed[l] == b->n[l]);  // retired its last instruction
+    }
+    return finished;                                    // lanes finished this cycle
+}                                                       // end batch_step
+
+/* Run every lockstep job of jobs[0..njobs-1] through `lanes` lanes; fills cycles and stalls. */
+static void batch_run(BatchJob *jobs, int njobs, int lanes) { // lockstep engine
+    BatchLanes b;                                       // lane state
+    int next = 0, live = 0;                             // queue position, busy lanes
+    for (int l=0;l<lanes;l++) {                         // fill every lane
+        while (next < njobs && !jobs[next].lockstep) next++; // skip jobs the scalar engine runs
+        batch_fill(&b, l, jobs, next < njobs ? next++ : -1); // next job, or idle
+        live += b.job[l] >= 0;                          // count the busy lane
+    }
+    while (live) {                                      // until every lane is idle
+        for (int l=0;l<lanes;l++)                       // gather: hazard bits of the instruction IF hands to ID
+            b.need[l] = b.pipe[0][l] >= 0 ? b.near[l][b.pipe[0][l]] : 0; // hazard bits, 0 for a bubble
+        if (!batch_step(&b, lanes)) continue;           // nothing finished: next cycle
+        for (int l=0;l<lanes;l++) {                     // retire finished lanes and refill them
+            if (b.job[l] < 0 || b.completed[l] < b.n[l]) continue; // lane still busy, or idle
+            jobs[b.job[l]].cycles = b.cycle[l]; jobs[b.job[l]].stalls = b.stalls[l]; // result of the job
+            while (next < njobs && !jobs[next].lockstep) next++; // skip jobs the scalar engine runs
+            batch_fill(&b, l, jobs, next < njobs ? next++ : -1); // next job, or idle
+            live -= b.job[l] < 0;                       // no job left for the lane
+        }
+    }
+}                                                       // end batch_run
+
+/* --batch=LIST: one program path per line; '#' starts a comment. Writes batch_results.csv and
+   prints the throughput. With bench set, also times run_pipeline on the same jobs and checks
+   that both engines agree on every cycle count. */
+static int run_batch(const char *list, int lanes, int bench, const Resources *res) { // batch driver
+    FILE *lf = fopen(list, "r");                        // open the list
+    if (!lf) { fprintf(stderr, "Error: cannot open %s\n", list); return 1; } // error if cannot open
+    BatchJob *jobs = NULL;                              // loaded programs
+    int njobs = 0, cap = 0, rc = 0, scalar_only = 0;    // jobs, capacity, exit code, jobs on the scalar engine
+    char line[MAX_LINE];                                // one line of the list
+    while (fgets(line, sizeof(line), lf)) {             // one program per line
+        strip_comment(line); rtrim_ascii(line);         // drop comments and trailing blanks
+        char *p = line;                                 // path
+        while (isspace((unsigned char)*p)) p++;         // skip leading blanks
+        if (!*p) continue;                              // blank line
+        if (njobs == cap && !(jobs = realloc(jobs, sizeof(BatchJob) * (size_t)(cap = cap ? 2*cap : 64)))) { // grow the job list
+            fprintf(stderr, "Out of memory\n"); fclose(lf); return 5; // no room for the jobs
+        }
+        memset(&jobs[njobs], 0, sizeof(BatchJob));      // empty job
+        snprintf(jobs[njobs].path, sizeof(jobs[njobs].path), "%s", p); // its path
+        if ((rc = batch_load(&jobs[njobs++]))) break;   // parse it; stop at the first error
+        scalar_only += !jobs[njobs-1].lockstep;         // FP or vector ops
+    }
+    fclose(lf);                                         // list read
+    if (!rc && njobs == 0) { fprintf(stderr, "No programs in %s.\n", list); rc = 4; } // empty list
+    if (rc) {                                           // nothing runs
+        for (int k=0;k<njobs;k++) { free(jobs[k].prog); free(jobs[k].near); } // programs and hazard bits
+        free(jobs);                                     // job list
+        return rc;                                      // exit code of the failed job
+    }
+
+    /* Each engine repeats the whole batch until it has run for at least 0.2 s. */
+    RunStats st;                                        // counters of a scalar run
+    int rounds = 0;                                     // passes over the batch
+    clock_t t0 = clock(), t1;                           // start, end of the timing
+    do {                                                // repeat the batch
+        batch_run(jobs, njobs, lanes);                  // every lockstep job
+        for (int k=0;k<njobs;k++) if (!jobs[k].lockstep) { // the others on the scalar engine
+            jobs[k].cycles = run_pipeline(jobs[k].prog, jobs[k].n, res, 0, &st, NULL, 0, NULL); // one scalar run
+            jobs[k].stalls = st.stalls;                 // its bubbles
+        }
+        rounds++;                                       // count the pass
+    } while ((t1 = clock()) - t0 < CLOCKS_PER_SEC / 5); // at least 0.2 s
+    double lock_rate = (double)njobs * rounds / ((double)(t1 - t0) / CLOCKS_PER_SEC); // programs per second
+
+    FILE *out = fopen("batch_results.csv", "w");        // one row per program
+    if (!out) { fprintf(stderr, "Error: cannot write batch_results.csv\n"); rc = 5; } // output error
+    else {                                              // file open
+        fprintf(out, "program,instructions,cycles,stalls,engine\n"); // header row
+        for (int k=0;k<njobs;k++)                       // every program
+            fprintf(out, "\"%s\",%d,%d,%d,%s\n", jobs[k].path, jobs[k].n, jobs[k].cycles, jobs[k].stalls, // path, size, result, engine
+                    jobs[k].lockstep ? "lockstep" : "scalar");
+        fclose(out);                                    // results written
+    }
+    printf("Batch of %d programs from %s, %d lanes (%d on the scalar engine: FP or vector ops)\n", // summary
+           njobs, list, lanes, scalar_only);
+    printf("Lockstep engine: %.0f programs/s\n", lock_rate); // throughput of the lockstep engine
+    if (bench && !rc) {                                 // also time the scalar engine
+        int mismatches = 0;                             // programs where the engines disagree
+        rounds = 0; t0 = clock();                       // restart the timing
+        do {                                            // repeat the batch
+            for (int k=0;k<njobs;k++) {                 // every program, scalar
+                int cycles = run_pipeline(jobs[k].prog, jobs[k].n, res, 0, &st, NULL, 0, NULL); // one scalar run
+                if (rounds == 0 && (cycles != jobs[k].cycles || (int)st.stalls != jobs[k].stalls)) { // first pass: compare with the lockstep result
+                    if (mismatches++ < 10) fprintf(stderr, "Mismatch on %s: lockstep %d cycles, scalar %d\n", // report the first 10
+                                                   jobs[k].path, jobs[k].cycles, cycles);
+                }
+            }
+            rounds++;                                   // count the pass
+        } while ((t1 = clock()) - t0 < CLOCKS_PER_SEC / 5); // at least 0.2 s
+        double scalar_rate = (double)njobs * rounds / ((double)(t1 - t0) / CLOCKS_PER_SEC); // programs per second
+        printf("Scalar engine:   %.0f programs/s (lockstep is %.2fx)\n", scalar_rate, lock_rate / scalar_rate); // throughput and speedup
+        if (mismatches) { printf("Cycle counts differ on %d programs\n", mismatches); rc = 7; } // engines disagree: exit 7
+        else printf("Cycle counts agree on all %d programs\n", njobs); // they agree
+    }
+    printf("Results written to batch_results.csv\n");   // where the results went
+    for (int k=0;k<njobs;k++) { free(jobs[k].prog); free(jobs[k].near); } // programs and hazard bits
+    free(jobs);                                         // job list
+    return rc;                                          // 0, or an exit code
+}                                                       // end run_batch
+
+/* Parse "N" (every FP/vector-unit op) or "op:N,op:N" into res->unit_lat; returns 0 on success */
+static int parse_unit_latencies(const char *list, Resources *res) { // --lat= argument
+    while (*list) {                                     // one "op:N" or "N" item per iteration
+        char *end;
+        int op = -1;                                    // -1: applies to every FP-unit op
+        for (int o=0;o<OP_BAD && op<0;o++) {            // optional "op:" prefix
+            size_t len = strlen(op_info[o].name);
+            if (strncmp(list, op_info[o].name, len)==0 && list[len]==':') {
+                if (!op_info[o].fp_unit && !op_info[o].vec_unit) return -1; // integer ops always take one EX cycle
+                op = o; list += len+1;
+            }
+        }
+        long v = strtol(list, &end, 10);                // latency value
+        if (end==list || v < 1 || v > MAX_FP_LAT) return -1; // must fit the FP unit model
+        for (int o=0;o<OP_BAD;o++)                      // store for the named op, or all unit ops
+            if ((op_info[o].fp_unit || op_info[o].vec_unit) && (op<0 || o==op)) res->unit_lat[o] = (int)v;
+        list = end;
+        if (*list==',') list++;                         // next item
+        else if (*list) return -1;                      // trailing garbage
+    }
+    return 0;                                           // all items valid
+}                                                      // end parse_unit_latencies
+
+/* Energy model: picojoules per activity event plus a static cost per cycle at a clock frequency. */
+typedef struct {                                        // energy table
+    double pj[EV_COUNT];                                // dynamic energy per event
+    double static_pj;                                   // leakage and clock tree per cycle
+    double ghz;                                         // clock frequency for time and power
+} EnergyTable;                                          // end EnergyTable
+
+/* Event counts of a run: counters kept by the loop plus those derived from other statistics. */
+static void activity(const RunStats *st, long *ev) {    // per-event totals
+    memcpy(ev, st->act, sizeof(st->act));
+    ev[EV_VELEM] = st->vec.elems;                       // vector lanes do work per element
+    for (int t=0;t<TLB_COUNT;t++) ev[EV_TLB] += st->tlb_hits[t] + st->tlb_misses[t];
+    ev[EV_BUBBLE] = st->stalls;                         // latches clocked without work
+}                                                      // end activity
+
+/* Total energy of a run in pJ; *dyn receives the dynamic part. */
+static double run_energy(const RunStats *st, int cycles, const EnergyTable *et, double *dyn) { // energy of one run
+    long ev[EV_COUNT];
+    activity(st, ev);
+    *dyn = 0;
+    for (int e=0;e<EV_COUNT;e++) *dyn += ev[e] * et->pj[e];
+    return *dyn + cycles * et->static_pj;
+}                                                      // end run_energy
+
+/* Print energy, time, average power and energy-delay product of one run. */
+static void print_energy(const char *label, const RunStats *st, int cycles, const EnergyTable *et) { // energy summary line
+    double dyn, e = run_energy(st, cycles, et, &dyn);
+    double ns = cycles / et->ghz;                       // run time
+    printf("  %-12s %10.1f pJ (%4.1f%% static), %8.1f ns, %7.2f mW, EDP %.4g pJ*ns\n",
+           label, e, e > 0 ? 100.0 * (e - dyn) / e : 0.0, ns, e / ns, e * ns); // pJ/ns = mW
+}                                                      // end print_energy
+
+/* Parse "event:pJ,..." (events from ev_names, plus "static") into et. Returns 0 on success. */
+static int parse_energy(const char *list, EnergyTable *et) { // --energy= argument
+    while (*list) {                                     // one "event:pJ" item per iteration
+        const char *colon = strchr(list, ':');
+        if (!colon) return -1;
+        size_t len = (size_t)(colon - list);
+        double *slot = (len == 6 && strncmp(list, "static", 6) == 0) ? &et->static_pj : NULL;
+        for (int e=0;e<EV_COUNT && !slot;e++)
+            if (strlen(ev_names[e]) == len && strncmp(list, ev_names[e], len) == 0) slot = &et->pj[e];
+        if (!slot) return -1;                           // unknown event
+        char *end;
+        double v = strtod(colon+1, &end);
+        if (end == colon+1 || v < 0) return -1;
+        *slot = v;
+        list = end;
+        if (*list==',') list++;                         // next item
+        else if (*list) return -1;                      // trailing garbage
+    }
+    return 0;                                           // all items valid
+}                                                      // end parse_energy
+
+/* Parse a TLB geometry "ENTRIES[:WAYS]" (fully associative without WAYS). Returns 0 on success. */
+static int parse_tlb(const char *spec, TlbConfig *tc, int which) { // --itlb= / --dtlb= / --l2tlb=
+    char *end;                                          // end of each number
+    long e = strtol(spec, &end, 10), w = e;             // entries, ways
+    if (*end == ':') w = strtol(end+1, &end, 10);       // explicit associativity
+    if (*end || e < 1 || e > MAX_TLB || w < 1 || w > e || e % w) return -1; // whole sets only
+    tc->entries[which] = (int)e; tc->ways[which] = (int)w;
+    return 0;                                           // geometry accepted
+}                                                      // end parse_tlb
+
+static int simulate(int argc, char **argv) {           // one run; main() wraps it in the result cache
+    const char *infile = "instructions.txt";            // input filename default
+    int opts = 0;                                       // decode-stage optimization flags
+    unsigned rules = 0;                                 // enabled macro-op fusion rules
+    Resources res = { 0, 0, 0, 1, { 0 }, { 0, 0, 0, NULL }, 1, 0, SB_EAGER, { { 0 }, { 0 }, 7, 0, 12 },
+                      { 0, 12, 20, 8, 0, 0 } }; // unlimited structural resources by default
+    for (int o=0;o<OP_BAD;o++) res.unit_lat[o] = 1;     // non-FP-unit ops take one cycle in EX
+    res.unit_lat[OP_FADD] = 4; res.unit_lat[OP_FMUL] = 4; // pipelined FP unit defaults
+    res.unit_lat[OP_FDIV] = 12; res.unit_lat[OP_FMADD] = 5;
+    res.unit_lat[OP_VLE] = 2; res.unit_lat[OP_VMUL] = 3;  // vector unit defaults
+    res.unit_lat[OP_VFMACC] = 4;
+    res.vec.vlen = 512; res.vec.lanes = 4; res.vec.chain = 1; // 16 x e32 per register, 4 groups
+    res.vec.lat = res.unit_lat;                         // the shared latency table
+    EnergyTable et = { { 10, 2, 1, 8, 4, 1.5, 2, 15, 3, 1, 0.5 }, 20, 1.0 }; // rough per-event costs in pJ
+    int energy = 0;                                     // whether to report energy
+    const char *kanata_file = NULL, *o3_file = NULL;    // pipeline-viewer logs
+    const char *timeline_file = NULL;                   // Perfetto / Chrome trace
+    const char *stage_file = NULL, *summary_file = NULL; // per-instruction timeline CSV, JSON summary
+    TriggerSink triggers;                               // --trigger / --window
+    memset(&triggers, 0, sizeof(triggers));             // no triggers
+    triggers.before = triggers.after = 16;              // default window: 16 cycles on either side
+    int o3_ticks = 1000;                                // O3PipeView ticks per cycle
+    int out_mode = OUT_SYNC, out_bufs = 4, out_kb = 1024; // output sink: backend, buffers, KiB per buffer
+    int gz_level = 0;                                   // gzip level of the CSV (0: plain)
+    int index_every = 4096;                             // cycles between index checkpoints (0: no index)
+    long query_first = 0, query_last = 0;               // --query range (0: simulate)
+    int segments = 1;                                   // --segments: pieces simulated in parallel
+    int stream = 0;                                     // --stream: bounded window fed from the input
+    const char *trace_out = NULL;                       // --trace-out: write the input as a binary trace instead
+    const char *batch_file = NULL;                      // --batch program list
+    int batch_lanes = 8, batch_bench = 0, batch_args = 0; // lanes, --batch-bench, batch options seen
+    int structural = 0;                                 // whether any resource was constrained
+    int memory = 0;                                     // whether the data-cache / store-buffer model was configured
+    for (int a=1;a<argc;a++) {                          // scan command-line arguments
+        if (strcmp(argv[a],"--move-elim")==0) opts |= OPT_MOVE_ELIM;         // enable move elimination
+        else if (strcmp(argv[a],"--zero-idiom")==0) opts |= OPT_ZERO_IDIOM;  // enable zero-idiom recognition
+        else if (strcmp(argv[a],"--fuse")==0 || strncmp(argv[a],"--fuse=",7)==0) { // macro-op fusion rules
+            long m = parse_fuse_rules(argv[a]);         // translate rule names to a mask
+            if (m < 0) {                                // unknown name -> list the valid ones
+                fprintf(stderr, "Unknown fusion rule in %s; rules:", argv[a]);
+                for (int r=0;r<NUM_FUSE_RULES;r++) fprintf(stderr, " %s", fuse_rules[r].name);
+                fprintf(stderr, "\n");
+                return 6;
+            }
+            rules |= (unsigned)m;                       // accumulate enabled rules
+        }
+        else if (strcmp(argv[a],"--unified-mem")==0) { res.unified_mem = 1; structural = 1; } // IF/MEM share a port
+        else if (strncmp(argv[a],"--rf-read-ports=",16)==0 || strncmp(argv[a],"--rf-write-ports=",17)==0) { // 0 = unlimited
+            const char *v = strchr(argv[a], '=') + 1;   // digits after the '='
+            char *end;
+            long n = strtol(v, &end, 10);
+            if (!isdigit((unsigned char)*v) || *end || n > MAX_RF_PORTS) { fprintf(stderr, "Bad %s\n", argv[a]); return 6; }
+            if (argv[a][5]=='r') res.rf_read_ports = (int)n; else res.rf_write_ports = (int)n; // --rf-read vs --rf-write
+            structural = 1;
+        }
+        else if (strncmp(argv[a],"--rf-banks=",11)==0) {      // banked register file
+            res.rf_banks = atoi(argv[a]+11);
+            if (res.rf_banks < 1 || res.rf_banks > REGS_PER_FILE) { fprintf(stderr, "Bad %s\n", argv[a]); return 6; }
+            structural = 1;
+        }
+        else if (strncmp(argv[a],"--vlen=",7)==0) {     // vector register width in bits
+            res.vec.vlen = atoi(argv[a]+7);
+            if (res.vec.vlen < 64 || res.vec.vlen > 65536 || (res.vec.vlen & (res.vec.vlen-1))) { fprintf(stderr, "Bad %s\n", argv[a]); return 6; }
+        }
+        else if (strncmp(argv[a],"--lanes=",8)==0) {    // elements per cycle per vector unit
+            res.vec.lanes = atoi(argv[a]+8);
+            if (res.vec.lanes < 1) { fprintf(stderr, "Bad %s\n", argv[a]); return 6; }
+        }
+        else if (strcmp(argv[a],"--no-chain")==0) res.vec.chain = 0; // consumers wait for whole vectors
+        else if (strncmp(argv[a],"--dcache-lat=",13)==0) { // data-cache access time
+            res.dcache_lat = atoi(argv[a]+13);
+            if (res.dcache_lat < 1 || res.dcache_lat > 1000) { fprintf(stderr, "Bad %s\n", argv[a]); return 6; }
+            memory = 1;
+        }
+        else if (strncmp(argv[a],"--sb=",5)==0) {       // store-buffer entries
+            res.sb_entries = atoi(argv[a]+5);
+            if (res.sb_entries < 0 || res.sb_entries > MAX_SB) { fprintf(stderr, "Bad %s\n", argv[a]); return 6; }
+            memory = 1;
+        }
+        else if (strcmp(argv[a],"--sb-drain=eager")==0) res.sb_drain = SB_EAGER; // drain whenever the port is idle
+        else if (strcmp(argv[a],"--sb-drain=full")==0) res.sb_drain = SB_FULL;   // drain only when full (or a load needs it)
+        else if (strncmp(argv[a],"--itlb=",7)==0 || strncmp(argv[a],"--dtlb=",7)==0) { // L1 TLB geometry
+            if (parse_tlb(argv[a]+7, &res.tlb, argv[a][2] == 'i' ? TLB_I : TLB_D)) { fprintf(stderr, "Bad %s\n", argv[a]); return 6; }
+        }
+        else if (strncmp(argv[a],"--l2tlb=",8)==0) {    // shared second-level TLB geometry
+            if (parse_tlb(argv[a]+8, &res.tlb, TLB_L2)) { fprintf(stderr, "Bad %s\n", argv[a]); return 6; }
+        }
+        else if (strncmp(argv[a],"--l2tlb-lat=",12)==0) { // L1 TLB miss, L2 TLB hit
+            res.tlb.l2_lat = atoi(argv[a]+12);
+            if (res.tlb.l2_lat < 0 || res.tlb.l2_lat > 1000) { fprintf(stderr, "Bad %s\n", argv[a]); return 6; }
+        }
+        else if (strncmp(argv[a],"--walk-lat=",11)==0) { // fixed cost per page-table level
+            res.tlb.walk_lat = atoi(argv[a]+11);
+            if (res.tlb.walk_lat < 1 || res.tlb.walk_lat > 1000) { fprintf(stderr, "Bad %s\n", argv[a]); return 6; }
+        }
+        else if (strcmp(argv[a],"--page=4k")==0) res.tlb.data_page_shift = 12; // base pages
+        else if (strcmp(argv[a],"--page=2m")==0) res.tlb.data_page_shift = 21; // huge pages
+        else if (strcmp(argv[a],"--page=1g")==0) res.tlb.data_page_shift = 30; // gigantic pages
+        else if (strncmp(argv[a],"--harts=",8)==0) {    // cores running the program
+            res.coh.harts = atoi(argv[a]+8);
+            if (res.coh.harts < 1 || res.coh.harts > MAX_HARTS) { fprintf(stderr, "Bad %s\n", argv[a]); return 6; }
+        }
+        else if (strncmp(argv[a],"--hart-stride=",14)==0) res.coh.hart_stride = atoi(argv[a]+14); // per-hart data offset
+        else if (strcmp(argv[a],"--hart-threads")==0) res.coh.threads = 1; // one host thread per hart
+        else if (strncmp(argv[a],"--l2-lat=",9)==0 || strncmp(argv[a],"--c2c-lat=",10)==0 || strncmp(argv[a],"--upgrade-lat=",14)==0) {
+            const char *eq = strchr(argv[a], '=');      // coherence latencies
+            int v = atoi(eq+1);
+            if (v < 1 || v > 1000) { fprintf(stderr, "Bad %s\n", argv[a]); return 6; }
+            if (argv[a][2] == 'l') res.coh.l2_lat = v; else if (argv[a][2] == 'c') res.coh.c2c_lat = v; else res.coh.upgrade_lat = v;
+        }
+        else if (strncmp(argv[a],"--kanata=",9)==0) kanata_file = argv[a]+9;   // Konata log
+        else if (strncmp(argv[a],"--perfetto=",11)==0) timeline_file = argv[a]+11; // timeline trace
+        else if (strncmp(argv[a],"--trigger=",10)==0) { // record windows around matching cycles
+            if (triggers.ntrig == MAX_TRIGGERS || parse_trigger(argv[a]+10, &triggers.trig[triggers.ntrig])) { // too many, or one that does not parse
+                fprintf(stderr, "Bad %s\n", argv[a]); return 6; // rejected
+            }
+            triggers.ntrig++;                           // accepted
+        }
+        else if (strncmp(argv[a],"--window=",9)==0) {   // cycles before[:after] a firing
+            char *end;                                  // end of each number
+            triggers.before = triggers.after = (int)strtol(argv[a]+9, &end, 10); // BEFORE, and AFTER = BEFORE unless given
+            if (*end == ':') triggers.after = (int)strtol(end+1, &end, 10); // AFTER
+            if (*end || triggers.before < 0 || triggers.before > MAX_HISTORY || triggers.after < 0) { // BEFORE within the history ring, AFTER >= 0
+                fprintf(stderr, "Bad %s\n", argv[a]); return 6; // rejected
+            }
+        }
+        else if (strncmp(argv[a],"--timeline-csv=",15)==0) stage_file = argv[a]+15; // simulator's CSV layout
+        else if (strncmp(argv[a],"--summary-json=",15)==0) summary_file = argv[a]+15; // run totals
+        else if (strncmp(argv[a],"--o3pipeview=",13)==0) o3_file = argv[a]+13; // gem5 O3PipeView log
+        else if (strncmp(argv[a],"--o3-ticks=",11)==0) {  // ticks per cycle in the O3PipeView log
+            o3_ticks = atoi(argv[a]+11);
+            if (o3_ticks < 1) { fprintf(stderr, "Bad %s\n", argv[a]); return 6; }
+        }
+        else if (strcmp(argv[a],"--async-out")==0 || strcmp(argv[a],"--async-out=uring")==0) out_mode = OUT_URING; // thread if io_uring is missing
+        else if (strcmp(argv[a],"--async-out=thread")==0) out_mode = OUT_THREAD; // writer thread even if io_uring exists
+        else if (strcmp(argv[a],"--gzip")==0) gz_level = 6; // pipeline_cycles.csv.gz
+        else if (strncmp(argv[a],"--gzip=",7)==0) {     // compression level 1..9
+            gz_level = atoi(argv[a]+7);
+            if (gz_level < 1 || gz_level > 9) { fprintf(stderr, "Bad %s\n", argv[a]); return 6; }
+        }
+        else if (strncmp(argv[a],"--out-bufs=",11)==0) { // buffers per output file
+            out_bufs = atoi(argv[a]+11);                // buffer count
+            if (out_bufs < 2 || out_bufs > MAX_OUT_BUFS) { fprintf(stderr, "Bad %s\n", argv[a]); return 6; } // need at least double buffering
+        }
+        else if (strncmp(argv[a],"--out-buf-kb=",13)==0) { // size of each buffer
+            out_kb = atoi(argv[a]+13);                  // buffer size in KiB
+            if (out_kb < 4 || out_kb > 1 << 20) { fprintf(stderr, "Bad %s\n", argv[a]); return 6; } // 4 KiB to 1 GiB
+        }
+        else if (strncmp(argv[a],"--index=",8)==0) {    // checkpoint interval of pipeline_cycles.idx
+            index_every = atoi(argv[a]+8);
+            if (index_every < 0) { fprintf(stderr, "Bad %s\n", argv[a]); return 6; }
+        }
+        else if (strncmp(argv[a],"--query=",8)==0) {    // print cycles A..B from the last run's CSV
+            char *end;
+            query_first = query_last = strtol(argv[a]+8, &end, 10);
+            if (*end == ':') query_last = strtol(end+1, &end, 10);
+            if (*end || query_first < 1 || query_last < query_first) { fprintf(stderr, "Bad %s\n", argv[a]); return 6; }
+        }
+        else if (strcmp(argv[a],"--stream")==0) stream = 1; // constant-memory run over any input length
+        else if (strncmp(argv[a],"--trace-out=",12)==0) trace_out = argv[a]+12; // convert the input, no simulation
+        else if (strncmp(argv[a],"--segments=",11)==0) { // speculative parallel run
+            segments = atoi(argv[a]+11);                // number of pieces
+            if (segments < 1 || segments > MAX_SEGMENTS) { fprintf(stderr, "Bad %s\n", argv[a]); return 6; } // 1 to MAX_SEGMENTS
+        }
+        else if (strncmp(argv[a],"--batch=",8)==0) { batch_file = argv[a]+8; batch_args++; } // lockstep batch of programs
+        else if (strncmp(argv[a],"--batch-lanes=",14)==0) { // programs advanced together
+            batch_lanes = atoi(argv[a]+14); batch_args++; // lanes in lockstep
+            if (batch_lanes < 1 || batch_lanes > MAX_BATCH_LANES) { fprintf(stderr, "Bad %s\n", argv[a]); return 6; } // 1 to MAX_BATCH_LANES
+        }
+        else if (strcmp(argv[a],"--batch-bench")==0) { batch_bench = 1; batch_args++; } // compare with the scalar engine
+        else if (strcmp(argv[a],"--energy")==0) energy = 1; // default energy table
+        else if (strncmp(argv[a],"--energy=",9)==0) {   // per-event energy overrides
+            if (parse_energy(argv[a]+9, &et)) { fprintf(stderr, "Bad energy list %s\n", argv[a]); return 6; }
+            energy = 1;
+        }
+        else if (strncmp(argv[a],"--freq=",7)==0) {     // clock frequency in GHz
+            et.ghz = atof(argv[a]+7);
+            if (et.ghz <= 0 || et.ghz > 100) { fprintf(stderr, "Bad %s\n", argv[a]); return 6; }
+        }
+        else if (strncmp(argv[a],"--lat=",6)==0) {      // FP / vector unit latencies
+            if (parse_unit_latencies(argv[a]+6, &res)) { fprintf(stderr, "Bad latency list %s\n", argv[a]); return 6; }
+        }
+        else if (strncmp(argv[a],"--",2)==0) {          // unknown option -> usage and exit
+            fprintf(stderr, "Unknown option %s\n"
+                            "Usage: %s [--move-elim] [--zero-idiom] [--fuse[=rule,...]]\n"
+                            "          [--unified-mem] [--rf-read-ports=N] [--rf-write-ports=M] [--rf-banks=B]\n"
+                            "          [--lat=N|op:N,...] [--vlen=BITS] [--lanes=N] [--no-chain]\n"
+                            "          [--dcache-lat=N] [--sb=N] [--sb-drain=eager|full]\n"
+                            "          [--itlb=E[:W]] [--dtlb=E[:W]] [--l2tlb=E[:W]] [--l2tlb-lat=N] [--walk-lat=N]\n"
+                            "          [--page=4k|2m|1g] [--harts=N] [--hart-stride=BYTES] [--hart-threads]\n"
+                            "          [--l2-lat=N] [--c2c-lat=N] [--upgrade-lat=N]\n"
+                            "          [--energy[=event:pJ,...]] [--freq=GHz]\n"
+                            "          [--kanata=FILE] [--o3pipeview=FILE] [--o3-ticks=N] [--perfetto=FILE]\n"
+                            "          [--timeline-csv=FILE] [--summary-json=FILE]\n"
+                            "          [--trigger=stall>=N[:TEXT]|cycle=A[..B]|every=N ...] [--window=BEFORE[:AFTER]]\n"
+                            "          [--async-out[=uring|thread]] [--out-bufs=N] [--out-buf-kb=K] [--gzip[=LEVEL]]\n"
+                            "          [--index=N] [--segments=K] [--stream] [--cache=DIR] [--cache-max-mb=N] [input]\n"
+                            "       %s --query=CYCLE[:LAST]\n"
+                            "       %s --batch=LIST [--batch-lanes=N] [--batch-bench]\n"
+                            "       %s --trace-out=FILE [input]\n"
+                            "input: FILE | trace:FILE | commit:FILE | synth:N[:SEED] | loop:N:input\n",
+                    argv[a], argv[0], argv[0], argv[0], argv[0]);
+            return 6;
+        }
+        else infile = argv[a];                          // positional argument is the input file
+    }
+    size_t tl_len = timeline_file ? strlen(timeline_file) : 0;
+    int timeline_gz = tl_len > 3 && strcmp(timeline_file + tl_len - 3, ".gz") == 0; // compressed trace
+#if !defined(WITH_ZLIB) || !defined(HAVE_ASYNC_OUT)
+    if (gz_level || timeline_gz) { fprintf(stderr, "Error: compressed output needs zlib (-DWITH_ZLIB) and the asynchronous sink (Linux, pthreads)\n"); return 6; }
+#endif
+    if (res.tlb.entries[TLB_L2] && !res.tlb.entries[TLB_I] && !res.tlb.entries[TLB_D]) { // only L1 misses reach it
+        fprintf(stderr, "Error: --l2tlb needs --itlb or --dtlb\n");
+        return 6;
+    }
+    if (segments > 1 && res.coh.harts) { fprintf(stderr, "Error: --segments and --harts cannot be combined\n"); return 6; } // harts share state across every piece
+    if (stream && (res.coh.harts || segments > 1 || kanata_file || o3_file || timeline_file || stage_file || triggers.ntrig)) {
+        fprintf(stderr, "Error: --stream cannot be combined with --harts, --segments, --kanata, --o3pipeview, --perfetto, --timeline-csv or --trigger\n");
+        return 6;                                       // these keep per-instruction state or need the whole program
+    }
+    if (batch_file && batch_args != argc - 1) { fprintf(stderr, "Error: --batch runs the base model and takes no other options\n"); return 6; } // the base model only
+    if (batch_file) return run_batch(batch_file, batch_lanes, batch_bench, &res); // batch mode: no single run
+    if (query_first) return query_cycles("pipeline_cycles.csv", "pipeline_cycles.idx", query_first, query_last); // no simulation
+
+    InstrSource in;                                     // text file, trace, commit log, generator ...
+    int err = source_open(&in, infile);                 // open the input (.gz too with zlib)
+    if (err) return err;                                // reported by source_open
+    if (trace_out) { err = write_trace(&in, trace_out); source_close(&in); return err; } // conversion only
+
+    Instr prog[MAX_INSTR];                              // array to hold parsed instructions
+    Instr extra;                                        // one past MAX_INSTR, to detect an overflow
+    int n=0;                                            // n = count parsed
+    int has_fpu = 0, has_vec = 0, uses_fp = 0;          // FP / vector unit columns, FP registers touched
+    int movs = 0, zeros = 0;                            // how often each decode-stage optimization could apply
+
+    for (;;) {                                          // one batch per call, straight into prog[]
+        Instr *b = stream ? prog : n < MAX_INSTR ? prog + n : &extra; // a streaming run reuses the start of prog[]
+        int got = in.next(&in, b, stream ? SOURCE_BATCH : n < MAX_INSTR ? MAX_INSTR - n : 1); // a batch, or what still fits in prog[]
+        if (got < 0) { source_close(&in); return -got; } // parse error (2) and the like
+        if (got == 0) break;                            // end of the input
+        if (b == &extra) { fprintf(stderr, "Too many instructions\n"); source_close(&in); return 3; } // overflow guard
+        for (int i=0;i<got;i++) {                       // traits used by the reports
+            const Instr *ins = &b[i];                   // next decoded instruction
+            has_fpu |= op_info[ins->op].fp_unit; has_vec |= op_info[ins->op].vec_unit != VU_NONE; // FP / vector unit columns
+            uses_fp |= ins->rd_id >= 0 && IS_FP_REG(ins->rd_id); // FP destination
+            for (int k=0;k<ins->rs_count;k++) uses_fp |= IS_FP_REG(ins->rs_id[k]); // FP sources
+            movs += (ins->op==OP_MOV); zeros += is_zero_idiom(ins); // decode-stage optimizations that could apply
+        }
+        n += got;                                       // a streaming run only counts them
+    }
+    source_close(&in);                                  // close input after reading
+    if (n == 0) { fprintf(stderr, "No instructions parsed.\n"); return 4; } // nothing to simulate -> exit
+    if (!stream) {                                      // a streaming run decodes as it goes
+        assign_vl(prog, n, res.vec.vlen);               // vl in effect for every vector op
+        assign_addresses(prog, n);                      // symbolic addresses for store-buffer lookups
+    }
+    const char *src = stream ? infile : NULL;           // comparison runs re-read the input when streaming
+
+    /* When optimizations are on, first run the plain model and each optimization alone
+       (silently) so the summary can report how many cycles each one saves. */
+    int plain_cycles = 0, elim_cycles = 0, zero_cycles = 0; // cycle counts of the comparison runs
+    RunStats plain_st, elim_st, zero_st;                // activity of the comparison runs (for the energy report)
+    if (opts) {                                         // comparisons are unfused
+        plain_cycles = run_config(prog, n, src, 0, 0, has_fpu, has_vec, &res, &plain_st); // plain last-writer dependences
+        elim_cycles = run_config(prog, n, src, OPT_MOVE_ELIM, 0, has_fpu, has_vec, &res, &elim_st); // move elimination only
+        zero_cycles = run_config(prog, n, src, OPT_ZERO_IDIOM, 0, has_fpu, has_vec, &res, &zero_st); // zero idioms only
+    }
+    /* Fusion is compared against the unfused run with the same decode-stage options */
+    int unfused_cycles = 0;                             // cycles of the unfused comparison run
+    RunStats unfused;                                   // stalls of the unfused comparison run
+    memset(&unfused, 0, sizeof(unfused));
+    if (rules) unfused_cycles = run_config(prog, n, src, opts, 0, has_fpu, has_vec, &res, &unfused); // no pairs
+    int pairs = 0;                                      // fused pairs of the reported run
+    if (!stream) {
+        pairs = fuse_pairs(prog, n, rules);             // slots for the reported run
+        resolve_producers(prog, n, opts);               // dependences for the reported run
+    }
+
+    OutSink csv_sink, trace_sink;                       // output buffering of the CSV and the trace
+    const char *csv_name = gz_level ? "pipeline_cycles.csv.gz" : "pipeline_cycles.csv";
+    remove(gz_level ? "pipeline_cycles.csv" : "pipeline_cycles.csv.gz"); // --query must not find a stale copy
+    FILE *csv = sink_open(&csv_sink, csv_name, "w", out_mode, out_bufs, (size_t)out_kb << 10, gz_level); // open CSV output for writing
+    if (!csv) { fprintf(stderr, "Error: cannot write %s\n", csv_name); return 5; } // error if cannot open
+    fprintf(csv, "cycle,IF,ID,EX,%s%sMEM,WB,stalls_pending\n", has_fpu ? "FP," : "", has_vec ? "V," : ""); // CSV header row describing columns
+    CycleIndex ix;                                      // checkpoints into the CSV
+    if (index_every && index_open(&ix, "pipeline_cycles.idx", index_every)) { fprintf(stderr, "Error: cannot write pipeline_cycles.idx\n"); return 5; }
+    int empty_pipe[5] = { -1, -1, -1, -1, -1 };
+    if (index_every) index_checkpoint(&ix, 1, ftell(csv), empty_pipe, 0); // first row
+    else remove("pipeline_cycles.idx");                 // an older index would not match this CSV
+
+    printf("Starting cycle-by-cycle simulation (no-forwarding model)\n"); // human-readable header
+    printf("Total instructions: %d\n\n", n);             // print number of instructions parsed
+
+    PipeView pv;                                        // viewer logs of the reported run
+    int pv_on = kanata_file || o3_file;
+    if (pv_on && pipeview_open(&pv, kanata_file, o3_file, n)) { fprintf(stderr, "Error: cannot write the pipeline-viewer logs\n"); return 5; }
+    if (pv_on) pv.ticks = o3_ticks;
+    TraceOut timeline;                                  // Perfetto / Chrome trace of the reported run
+    if (timeline_file && trace_open(&timeline, timeline_file, &trace_sink, out_mode, out_bufs, (size_t)out_kb << 10,
+                                    timeline_gz ? (gz_level ? gz_level : 6) : 0)) { fprintf(stderr, "Error: cannot write %s\n", timeline_file); return 5; }
+    EngineSink sinks[MAX_SINKS], *attached[MAX_SINKS];  // outputs fed by the reported run
+    int nsinks = 0;
+    memset(sinks, 0, sizeof(sinks));
+    if (triggers.ntrig) {                               // only windows around trigger firings
+        triggers.csv = csv;                             // triggered rows go to the CSV
+        triggers.hist = malloc(sizeof(Snapshot) * (size_t)(triggers.before + 1)); // ring of before + 1 snapshots
+        if (!triggers.hist) { fprintf(stderr, "Out of memory\n"); return 5; } // no room for the ring
+        sinks[nsinks].cycle_end = trigger_sink_cycle; sinks[nsinks++].ctx = &triggers; // triggered CSV writer
+    }
+    else { sinks[nsinks].cycle_end = csv_sink_cycle; sinks[nsinks++].ctx = csv; } // every cycle into the CSV
+    if (index_every) { ix.csv = csv; sinks[nsinks].cycle_end = index_sink_cycle; sinks[nsinks++].ctx = &ix; }
+    if (pv_on) { sinks[nsinks].cycle_end = pipeview_sink_cycle; sinks[nsinks++].ctx = &pv; }
+    StageLog sl;                                        // --timeline-csv
+    if (stage_file) {
+        sl.f = fopen(stage_file, "w");
+        sl.at = calloc((size_t)n, sizeof(*sl.at)); sl.stalls = calloc((size_t)n, sizeof(int));
+        if (!sl.f) { fprintf(stderr, "Error: cannot write %s\n", stage_file); return 5; }
+        if (!sl.at || !sl.stalls) { fprintf(stderr, "Out of memory\n"); return 5; }
+        sinks[nsinks].cycle_end = stagelog_cycle; sinks[nsinks].stall = stagelog_stall;
+        sinks[nsinks].run_end = stagelog_end; sinks[nsinks++].ctx = &sl;
+    }
+    RunSummary summary;                                 // --summary-json
+    if (summary_file) {
+        memset(&summary, 0, sizeof(summary));
+        if (!(summary.f = fopen(summary_file, "w"))) { fprintf(stderr, "Error: cannot write %s\n", summary_file); return 5; }
+        sinks[nsinks].retired = summary_retired; sinks[nsinks].stall = summary_stall;
+        sinks[nsinks].run_end = summary_end; sinks[nsinks++].ctx = &summary;
+    }
+    for (int k=0;k<nsinks;k++) attached[k] = &sinks[k];
+    RunStats st;                                        // stall accounting of the reported run
+    RunStats hart_st[MAX_HARTS];                        // per-hart accounting of a multicore run
+    int hart_cycles[MAX_HARTS];
+    Coherence co;                                       // directory of a multicore run
+    memset(&co, 0, sizeof(co));
+    int cycle;                                          // cycles of the reported run
+    if (res.coh.harts) {                                // lockstep multicore run; hart 0 is traced
+#ifndef HAVE_PTHREADS
+        res.coh.threads = 0;                            // no threads on this platform: step harts in turn
+#endif
+        printf("Running %d hart(s) in lockstep%s; trace, CSV and stall breakdown are hart 0's\n\n",
+               res.coh.harts, res.coh.threads ? " (one host thread each)" : "");
+        cycle = run_harts(prog, n, &res, !triggers.ntrig, attached, nsinks, timeline_file ? &timeline : NULL, hart_st, hart_cycles, &co); // lockstep harts
+        st = hart_st[0];
+    }
+    else if (stream) {                                  // bounded window, refilled from the input
+        printf("Streaming through a %d-instruction window; the text trace is off\n\n", STREAM_WINDOW); // no input name: cached reports are shared across names
+        cycle = run_stream(infile, opts, rules, has_fpu, has_vec, &res, &st, attached, nsinks, &pairs);
+        if (cycle < 0) return -cycle;
+    }
+    else if (segments > 1 && seg_possible(prog, n, &res)) { // pieces on threads, reconciled in order
+        printf("Running %d speculative segments in parallel; the text trace is off\n\n", segments); // announce the mode
+        cycle = run_segments(prog, n, &res, &st, attached, nsinks, timeline_file ? &timeline : NULL, segments); // guessed pieces, reconciled
+    }
+    else {                                              // whole-program run
+        if (segments > 1) printf("Not segmented: vector unit, TLB or store-buffer state outlives a segment boundary\n\n"); // say why the run was not segmented
+        cycle = run_pipeline(prog, n, &res, !triggers.ntrig, &st, attached, nsinks, timeline_file ? &timeline : NULL); // traced run that writes the CSV
+    }
+    long total_stalls = st.stalls;                      // count of bubble cycles inserted overall
 
     fclose(csv);                                        // close CSV file now that simulation completed
+    if (index_every) fclose(ix.f);
+    if (pv_on) pipeview_close(&pv);                     // and the viewer logs
+    if (timeline_file) trace_close(&timeline);
+    if (stage_file) { fclose(sl.f); free(sl.at); free(sl.stalls); }
+    if (summary_file) fclose(summary.f);
 
     printf("\nSimulation finished in %d cycles.\n", cycle); // print summary: total cycles
     printf("Total stalls (bubble cycles inserted): %ld\n", total_stalls); // total bubble count
     printf("Base cycles (N+4): %d\n", n + 4);            // theoretical base cycles without hazards
     printf("Total cycles with stalls: %d\n", cycle);    // actual cycles used by simulation
-    printf("CSV written to pipeline_cycles.csv\n");     // indicate location of CSV output
+    if (triggers.ntrig) {                               // what the windows kept
+        printf("Triggered tracing: %ld window(s), %ld of %d cycles recorded (%d before, %d after each firing)\n",
+               triggers.windows, triggers.recorded, res.coh.harts ? hart_cycles[0] : cycle, triggers.before, triggers.after);
+        free(triggers.hist);                            // snapshot ring
+    }
+    if (structural) {                                   // structural hazard breakdown
+        printf("Structural stalls: register read ports %ld, register write ports %ld, memory port %ld\n",
+               st.rf_read, st.rf_write, st.mem_port);
+        printf("  Resources: %s memory, %d read / %d write ports per bank (0 = unlimited), %d bank(s)\n",
+               res.unified_mem ? "unified" : "split", res.rf_read_ports, res.rf_write_ports, res.rf_banks);
+    }
+    if (uses_fp) {                                      // split data-hazard bubbles by producer type
+        printf("Stalls by producer: integer %ld, FP %ld\n", st.raw_int, st.raw_fp);
+        printf("Issue stalls (WAW / write-back slot): %ld\n", st.fp_issue);
+        printf("  FP unit latency:");
+        for (int o=0;o<OP_BAD;o++) if (op_info[o].fp_unit) printf(" %s=%d", op_info[o].name, res.unit_lat[o]);
+        printf("\n");
+    }
+    if (memory) {                                       // data-cache and store-buffer breakdown
+        printf("Memory: data cache %d cycle(s) per access, ", res.dcache_lat);
+        if (res.sb_entries) printf("%d-entry store buffer (%s drain)\n", res.sb_entries, res.sb_drain == SB_EAGER ? "eager" : "when full");
+        else printf("no store buffer\n");
+        printf("  Memory stalls: cache access %ld, store buffer full %ld, partial overlap %ld\n",
+               st.mem_cache, st.sb_full, st.sb_partial);
+        if (res.sb_entries)
+            printf("  Store-to-load forwarding: %ld of %ld loads; occupancy peak %d, average %.2f\n",
+                   st.forwards, st.loads, st.sb_peak, (double)st.sb_occupancy / cycle);
+    }
+    if (res.coh.harts) {                                // per-hart cycles and coherence traffic
+        printf("Multicore: %d hart(s), data %d bytes apart, MESI directory at the shared L2\n", res.coh.harts, res.coh.hart_stride);
+        printf("  Latencies: L1D hit %d, L2 %d, cache-to-cache %d, upgrade %d\n",
+               res.dcache_lat, res.coh.l2_lat, res.coh.c2c_lat, res.coh.upgrade_lat);
+        for (int h=0;h<res.coh.harts;h++)
+            printf("  Hart %d: %d cycles, %ld stalls, %ld waiting for L1D misses or upgrades\n", h,
+                   hart_cycles[h], hart_st[h].stalls, hart_st[h].coh);
+        printf("  Traffic: %ld L2 fills, %ld cache-to-cache transfers, %ld upgrades, %ld writebacks\n",
+               co.l2_fills, co.c2c, co.upgrades, co.writebacks);
+        printf("  Invalidations: %ld, of which false sharing %ld\n", co.invalidations, co.false_sharing);
+    }
+    if (res.tlb.entries[TLB_I] || res.tlb.entries[TLB_D]) { // address translation breakdown
+        static const char *tlb_names[] = { "ITLB", "DTLB", "L2 TLB" };
+        printf("Translation:");
+        for (int t=0;t<TLB_COUNT;t++) {
+            if (res.tlb.entries[t] == 0) printf("%s %s off", t ? "," : "", tlb_names[t]);
+            else if (res.tlb.ways[t] == res.tlb.entries[t]) printf("%s %s %d entries (fully assoc.)", t ? "," : "", tlb_names[t], res.tlb.entries[t]);
+            else printf("%s %s %d entries (%d-way)", t ? "," : "", tlb_names[t], res.tlb.entries[t], res.tlb.ways[t]);
+        }
+        printf("; %s data pages\n", res.tlb.data_page_shift == 12 ? "4 KiB" : res.tlb.data_page_shift == 21 ? "2 MiB" : "1 GiB");
+        printf("  Lookups:");
+        for (int t=0;t<TLB_COUNT;t++) if (res.tlb.entries[t])
+            printf(" %s %ld hit / %ld miss;", tlb_names[t], st.tlb_hits[t], st.tlb_misses[t]);
+        printf(" page walks %ld (%.1f cycles each)\n", st.walks, st.walks ? (double)st.walk_cycles / st.walks : 0.0);
+        printf("  Translation stalls: ITLB %ld, DTLB %ld (%.3f of CPI %.3f)\n", st.itlb, st.dtlb,
+               (double)(st.itlb + st.dtlb) / n, (double)cycle / n);
+    }
+    if (has_vec) {                                      // vector unit activity next to the scalar metrics
+        long busy = 0;                                  // element-group cycles over all units
+        for (int u=1;u<VU_COUNT;u++) busy += st.vec.busy[u];
+        printf("Vector unit: VLEN=%d, %d lanes, chaining %s; %d ops, %ld elements\n",
+               res.vec.vlen, res.vec.lanes, res.vec.chain ? "on" : "off", st.vec.ops, st.vec.elems);
+        printf("  Utilization of %d cycles:", cycle);
+        for (int u=1;u<VU_COUNT;u++)                    // busy fraction per unit
+            printf("%s %s %ld busy (%.1f%%)", u>1 ? "," : "", vu_names[u], st.vec.busy[u], 100.0*st.vec.busy[u]/cycle);
+        printf("\n  Lane utilization: %.1f%% of lane slots in busy cycles\n", busy ? 100.0*st.vec.elems/(busy*res.vec.lanes) : 0.0);
+        printf("  Chained starts: %d; cycles waiting for vector operands or a free unit: %ld\n", st.vec.chained, st.vec.wait);
+    }
+    if (opts) {                                         // report savings of decode-stage optimizations
+        printf("Decode-stage optimizations (cycles saved vs. plain model, each measured alone):\n");
+        printf("  Move elimination: %d movs, saves %d cycles%s\n", movs, plain_cycles - elim_cycles,
+               (opts & OPT_MOVE_ELIM) ? "" : " (not enabled)");
+        printf("  Zero idioms:      %d found, saves %d cycles%s\n", zeros, plain_cycles - zero_cycles,
+               (opts & OPT_ZERO_IDIOM) ? "" : " (not enabled)");
+        if (!rules) printf("  Enabled together: saves %d cycles\n", plain_cycles - cycle);
+    }
+    if (rules) {                                        // report fusion rate and savings
+        printf("Macro-op fusion: %d pairs, fusion rate %.1f%% of instructions\n", pairs, 100.0*2*pairs/n);
+        printf("  Stalls: %ld unfused -> %ld fused (%+ld)\n", unfused.stalls, total_stalls, total_stalls - unfused.stalls);
+        printf("  Cycles: %d unfused -> %d fused (%+d)\n", unfused_cycles, cycle, cycle - unfused_cycles);
+    }
+    if (energy) {                                       // energy, power and EDP per configuration
+        long ev[EV_COUNT];
+        activity(&st, ev);
+        printf("Energy at %.2f GHz, %.1f pJ static per cycle%s:\n", et.ghz, et.static_pj, res.coh.harts ? " (hart 0)" : "");
+        printf("  Events:");
+        for (int e=0;e<EV_COUNT;e++) printf("%s %s %ld x %.1f", e ? "," : "", ev_names[e], ev[e], et.pj[e]);
+        printf("\n");
+        print_energy("reported", &st, res.coh.harts ? hart_cycles[0] : cycle, &et);
+        if (opts) {                                     // the comparison runs are the other configurations
+            print_energy("plain", &plain_st, plain_cycles, &et);
+            print_energy("move-elim", &elim_st, elim_cycles, &et);
+            print_energy("zero-idiom", &zero_st, zero_cycles, &et);
+        }
+        if (rules) print_energy("unfused", &unfused, unfused_cycles, &et);
+    }
+    if (out_mode != OUT_SYNC || gz_level || timeline_gz) { // queue depth and stalls of the asynchronous writes
+        printf("Output sinks:\n");                      // heading
+        print_sink(csv_name, &csv_sink);
+        if (timeline_file) print_sink(timeline_file, &trace_sink); // timeline trace, if written
+    }
+    printf("CSV written to %s\n", csv_name);            // indicate location of CSV output
 
     return 0;                                           // normal program exit
+}                                                      // end simulate
+
+/* Content-addressed result cache (--cache=DIR). The key is the SHA-256 of the normalized program
+   (each instruction's canonical text), every option in order and the build, so a hit is a run that would
+   print exactly the same report. An entry holds the report, the CSV and its index (deflated
+   when built with zlib). Entries are written to a temporary name and renamed into place, so concurrent
+   jobs never see half an entry; the directory is trimmed to --cache-max-mb by evicting the least
+   recently used entries (a hit refreshes its entry's mtime). */
+#ifdef HAVE_RESULT_CACHE
+#define CACHE_MAGIC "PSIMRES1"                          // 8-byte entry signature
+#define MODEL_VERSION 2                                 // bump when the timing model, its defaults or the report change
+#define STR_(x) #x                                      // stringize
+#define STR(x) STR_(x)                                  // MODEL_VERSION as a string
+#define CACHE_SALT "extended_simulator model " STR(MODEL_VERSION) ", built " __DATE__ " " __TIME__ "\n" // a rebuilt binary never replays old results
+typedef struct { unsigned h[8]; unsigned char blk[64]; size_t fill; unsigned long long bytes; } Sha256; // running hash
+
+static void sha256_block(Sha256 *s, const unsigned char *p) { // one 64-byte block
+    static const unsigned k[64] = {                     // FIPS 180-4 round constants
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
+#define ROR(x, n) ((x) >> (n) | (x) << (32 - (n)))      // rotate right
+    unsigned w[64], v[8];                               // message schedule, working variables
+    for (int i=0;i<16;i++) w[i] = (unsigned)p[4*i] << 24 | (unsigned)p[4*i+1] << 16 | (unsigned)p[4*i+2] << 8 | p[4*i+3]; // big-endian words of the block
+    for (int i=16;i<64;i++)                             // expand to 64 words
+        w[i] = w[i-16] + (ROR(w[i-15], 7) ^ ROR(w[i-15], 18) ^ w[i-15] >> 3) + w[i-7] + (ROR(w[i-2], 17) ^ ROR(w[i-2], 19) ^ w[i-2] >> 10); // sigma0 and sigma1
+    memcpy(v, s->h, sizeof(v));                         // working variables from the state
+    for (int i=0;i<64;i++) {                            // 64 rounds
+        unsigned t1 = v[7] + (ROR(v[4], 6) ^ ROR(v[4], 11) ^ ROR(v[4], 25)) + ((v[4] & v[5]) ^ (~v[4] & v[6])) + k[i] + w[i]; // Sigma1, Ch
+        unsigned t2 = (ROR(v[0], 2) ^ ROR(v[0], 13) ^ ROR(v[0], 22)) + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2])); // Sigma0, Maj
+        memmove(v + 1, v, sizeof(unsigned) * 7);        // shift the variables down by one
+        v[4] += t1; v[0] = t1 + t2;                     // new e and a
+    }
+#undef ROR
+    for (int i=0;i<8;i++) s->h[i] += v[i];              // add the block's result to the state
+}                                                      // end sha256_block
+
+static void sha256_init(Sha256 *s) {                   // FIPS 180-4 initial value
+    static const unsigned h0[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 }; // from the square roots of the first 8 primes
+    memcpy(s->h, h0, sizeof(h0)); s->fill = 0; s->bytes = 0; // empty message
+}                                                      // end sha256_init
+
+static void sha256_add(Sha256 *s, const void *data, size_t len) { // absorb bytes
+    const unsigned char *p = data;                      // bytes to absorb
+    s->bytes += len;                                    // total length, for the padding
+    while (len--) { s->blk[s->fill++] = *p++; if (s->fill == 64) { sha256_block(s, s->blk); s->fill = 0; } } // buffer, hash each full block
+}                                                      // end sha256_add
+
+static void sha256_hex(Sha256 *s, char out[65]) {     // pad, finish, print as hex
+    unsigned long long bits = s->bytes * 8;             // message length in bits
+    unsigned char pad = 0x80, len[8];                   // padding byte, length field
+    sha256_add(s, &pad, 1); pad = 0;                    // a 1 bit, then zeros
+    while (s->fill != 56) sha256_add(s, &pad, 1);       // until 8 bytes are left in the block
+    for (int i=0;i<8;i++) len[i] = (unsigned char)(bits >> (56 - 8*i)); // length, big-endian
+    sha256_add(s, len, 8);                              // completes the last block
+    for (int i=0;i<8;i++) sprintf(out + 8*i, "%08x", s->h[i]); // state words as 64 hex digits
+}                                                      // end sha256_hex
+
+static int cache_put_blob(FILE *f, const void *p, unsigned long long len) { // length-prefixed bytes
+    return fwrite(&len, sizeof(len), 1, f) == 1 && (!len || fwrite(p, 1, (size_t)len, f) == len) ? 0 : -1; // length, then the bytes
+}                                                      // end cache_put_blob
+
+static char *cache_get_blob(FILE *f, unsigned long long *len) { // NULL on a short entry
+    if (fread(len, sizeof(*len), 1, f) != 1 || *len > (1ULL << 40)) return NULL; // length; anything over 1 TiB is a broken entry
+    char *p = malloc((size_t)*len + 1);                 // room for a terminating NUL
+    if (p && *len && fread(p, 1, (size_t)*len, f) != *len) { free(p); return NULL; } // short read: broken entry
+    if (p) p[*len] = '\0';                              // terminate, so a name can be used as a string
+    return p;                                           // the bytes, or NULL
+}                                                      // end cache_get_blob
+
+static int cache_put_data(FILE *f, const char *data, unsigned long long len) { // raw size, then the (deflated) bytes
+    unsigned long long zipped = 0;                      // raw size when deflated, else 0
+    const char *stored = data;                          // bytes to write
+    unsigned long long stored_len = len;                // and their length
+#ifdef WITH_ZLIB
+    uLongf zlen = compressBound((uLong)len);            // worst-case deflated size
+    char *z = malloc(zlen);                             // deflate buffer
+    if (z && compress2((Bytef *)z, &zlen, (const Bytef *)data, (uLong)len, 6) == Z_OK && zlen < len) { // keep it only if it is smaller
+        stored = z; stored_len = zlen; zipped = len;    // write the deflated bytes
+    }
+#endif
+    int err = fwrite(&zipped, sizeof(zipped), 1, f) != 1 || cache_put_blob(f, stored, stored_len); // raw size, then the blob
+#ifdef WITH_ZLIB
+    free(z);                                            // deflate buffer
+#endif
+    return err ? -1 : 0;                                // 0 if written
+}                                                      // end cache_put_data
+
+static char *cache_get_data(FILE *f, unsigned long long *len) { // inverse of cache_put_data
+    unsigned long long zipped;                          // raw size, 0 if stored as is
+    if (fread(&zipped, sizeof(zipped), 1, f) != 1) return NULL; // short entry
+    char *data = cache_get_blob(f, len);                // the stored bytes
+    if (!data || !zipped) return data;                  // stored as is, or unreadable
+#ifdef WITH_ZLIB
+    uLongf out = (uLongf)zipped;                        // inflated size
+    char *raw = malloc((size_t)zipped + 1);             // inflate buffer, with room for a NUL
+    if (raw && uncompress((Bytef *)raw, &out, (const Bytef *)data, (uLong)*len) == Z_OK && out == zipped) *len = zipped; // must inflate to exactly the raw size
+    else { free(raw); raw = NULL; }                     // corrupt entry
+    free(data);                                         // deflated bytes
+    return raw;                                         // the raw bytes, or NULL
+#else
+    free(data);                                         // written by a zlib build
+    return NULL;                                        // cannot inflate here: treated as a miss
+#endif
+}                                                      // end cache_get_data
+
+static char *slurp(const char *path, unsigned long long *len) { // whole file, NULL if missing
+    FILE *f = fopen(path, "rb");                        // open the file for reading
+    if (!f) return NULL;                                // missing: nothing to store
+    fseek(f, 0, SEEK_END); *len = (unsigned long long)ftell(f); fseek(f, 0, SEEK_SET); // its size
+    char *p = malloc((size_t)*len + 1);                 // room for a terminating NUL
+    if (p && *len && fread(p, 1, (size_t)*len, f) != *len) { free(p); p = NULL; } // short read: do not store it
+    fclose(f);                                          // close the file
+    return p;                                           // the contents, or NULL
+}                                                      // end slurp
+
+/* Entry: magic, report, file count, then each file's name and contents. Every payload is its raw
+   size (0 if stored as is) followed by the length-prefixed bytes. */
+static int cache_store(const char *dir, const char *key, const char *report, size_t report_len, const char **files, int nfiles) { // write one entry
+    char tmp[4200], path[4200];                         // temporary and final name of the entry
+    snprintf(tmp, sizeof(tmp), "%s/%s.tmp.%ld", dir, key, (long)getpid()); // unique per process
+    snprintf(path, sizeof(path), "%s/%s.res", dir, key); // "<key>.res"
+    char *data[4];                                      // the files, read before anything is written
+    unsigned long long len[4], count = 0;               // file sizes, files present
+    for (int k=0;k<nfiles;k++) if ((data[k] = slurp(files[k], &len[k]))) count++; // read every file that exists
+    FILE *f = fopen(tmp, "wb");                         // open the temporary entry
+    int err = !f || fwrite(CACHE_MAGIC, 1, 8, f) != 8 || cache_put_data(f, report, report_len) // signature, report
+              || fwrite(&count, sizeof(count), 1, f) != 1; // number of files
+    for (int k=0;k<nfiles;k++) {                        // each file present: name, then contents
+        if (data[k] && !err) err = cache_put_blob(f, files[k], strlen(files[k])) || cache_put_data(f, data[k], len[k]); // skipped once a write failed
+        free(data[k]);                                  // file contents
+    }
+    if (!f) return -1;                                  // could not create the entry
+    if (fclose(f) || err || rename(tmp, path)) { remove(tmp); return -1; } // rename is atomic: whole entry or none
+    return 0;                                           // entry stored
+}                                                      // end cache_store
+
+/* Replay a hit: print the report, drop the outputs the run would have removed, recreate the stored
+   files. Returns -1, having changed nothing, if there is no usable entry. */
+static int cache_load(const char *dir, const char *key) { // replay one entry
+    char path[4200], magic[8];                          // entry name, signature
+    char *report = NULL, *name[4] = { NULL }, *data[4] = { NULL }; // what the entry holds
+    unsigned long long len, count = 0, nlen, dlen[4];   // report size, file count, name size, file sizes
+    snprintf(path, sizeof(path), "%s/%s.res", dir, key); // "<key>.res"
+    FILE *f = fopen(path, "rb");                        // open the entry for reading
+    if (!f) return -1;                                  // no entry: a miss
+    int ok = fread(magic, 1, 8, f) == 8 && memcmp(magic, CACHE_MAGIC, 8) == 0 && (report = cache_get_data(f, &len)) // signature, report
+             && fread(&count, sizeof(count), 1, f) == 1 && count <= 4; // number of files
+    for (unsigned long long k=0;ok && k<count;k++)      // every file's name and contents
+        ok = (name[k] = cache_get_blob(f, &nlen)) && (data[k] = cache_get_data(f, &dlen[k])); // both must be readable
+    fclose(f);                                          // entry read completely
+    if (ok) {                                           // usable entry: replay it
+        remove("pipeline_cycles.idx");                  // as the run would: no stale index or gzipped CSV
+        remove("pipeline_cycles.csv.gz");               // beside the restored pipeline_cycles.csv
+        for (unsigned long long k=0;k<count;k++) {      // recreate the stored files
+            FILE *o = fopen(name[k], "wb");             // overwrite any older copy
+            if (o) { fwrite(data[k], 1, (size_t)dlen[k], o); fclose(o); } // write its contents
+        }
+        fwrite(report, 1, (size_t)len, stdout);         // print the report
+        utime(path, NULL);                              // most recently used
+    }
+    for (int k=0;k<4;k++) { free(name[k]); free(data[k]); } // names and contents
+    free(report);                                       // report
+    return ok ? 0 : -1;                                 // 0 on a hit
+}                                                      // end cache_load
+
+typedef struct { char name[300]; long long size; time_t used; } CacheFile; // one entry during eviction
+static int cache_older(const void *a, const void *b) { // least recently used first
+    time_t x = ((const CacheFile *)a)->used, y = ((const CacheFile *)b)->used; // last use of each entry
+    return x < y ? -1 : x > y;                          // -1, 0 or 1
+}                                                      // end cache_older
+
+static void cache_evict(const char *dir, long long max_bytes) { // trim the directory to max_bytes
+    DIR *d = opendir(dir);                              // open the cache directory
+    if (!d) return;                                     // no directory: nothing to trim
+    CacheFile *files = NULL; int n = 0, cap = 0;        // entries found, their number and capacity
+    long long total = 0;                                // bytes used by all entries
+    struct dirent *e;                                   // directory entry
+    char path[4200];                                    // full name of an entry
+    while ((e = readdir(d))) {                          // every file in the directory
+        size_t len = strlen(e->d_name);                 // length of its name
+        struct stat sb;                                 // its size and last use
+        if (len < 5 || len >= sizeof(files->name) || strcmp(e->d_name + len - 4, ".res")) continue; // only "<key>.res" entries
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name); // full name
+        if (stat(path, &sb)) continue;                  // gone meanwhile
+        if (n == cap && !(files = realloc(files, sizeof(CacheFile) * (size_t)(cap = cap ? 2*cap : 64)))) break; // grow the list
+        memcpy(files[n].name, e->d_name, len + 1);      // remember the entry
+        files[n].size = (long long)sb.st_size; files[n].used = sb.st_mtime; // size and last use
+        total += files[n++].size;                       // bytes used so far
+    }
+    closedir(d);                                        // done reading the directory
+    if (files) qsort(files, (size_t)n, sizeof(CacheFile), cache_older); // least recently used first
+    for (int k=0;k<n && total > max_bytes;k++) {        // evict until under the limit
+        snprintf(path, sizeof(path), "%s/%s", dir, files[k].name); // full name
+        if (remove(path) == 0) total -= files[k].size;  // another job may have removed it already
+    }
+    free(files);                                        // entry list
+}                                                      // end cache_evict
+
+/* Key of a run: normalized program plus every option except the cache's own and the input name.
+   Returns 0 if the run can be cached. */
+static int cache_key(int argc, char **argv, char key[65]) { // SHA-256 of the run; 0 if it can be cached
+    static const char *uncached[] = { "--kanata=", "--o3pipeview=", "--perfetto=", "--timeline-csv=", "--summary-json=",
+                                      "--query=", "--async-out", "--gzip", "--batch", "--trace-out=" }; // other files, or timing-dependent reports
+    const char *infile = "instructions.txt";            // input name, as simulate picks it
+    Sha256 s;                                           // running hash
+    sha256_init(&s);                                    // start the hash
+    sha256_add(&s, CACHE_SALT, strlen(CACHE_SALT));     // which model produced the result
+    for (int a=1;a<argc;a++) {                          // every argument
+        if (strncmp(argv[a], "--", 2)) { infile = argv[a]; continue; } // the input is hashed by content, not name
+        for (size_t u=0;u<sizeof(uncached)/sizeof(uncached[0]);u++) // options the cache does not handle
+            if (strncmp(argv[a], uncached[u], strlen(uncached[u])) == 0) return -1; // do not cache this run
+        sha256_add(&s, argv[a], strlen(argv[a]) + 1); // options in order, NUL-separated
+    }
+    InstrSource in;                                     // input of the run
+    Instr *buf = malloc(sizeof(Instr) * SOURCE_BATCH);  // one batch of instructions
+    int got = 0, bad = 0, quiet = open("/dev/null", O_WRONLY), err = dup(2); // instructions per batch, bad input, stderr saved around the read
+    fflush(stderr);                                     // pending messages go to the real stderr
+    if (quiet >= 0 && err >= 0) dup2(quiet, 2);        // a bad input is reported once, by the run itself
+    if (!buf || source_open(&in, infile)) bad = 1;     // let the run report it
+    else {                                              // hash every instruction
+        while ((got = in.next(&in, buf, SOURCE_BATCH)) > 0) // canonical text: spacing, comments, source format do not matter
+            for (int i=0;i<got;i++) {                   // text plus the fields it may not spell out
+                char norm[200];                         // one instruction as text
+                int len = snprintf(norm, sizeof(norm), "\n%s|%ld|%d", buf[i].text, buf[i].imm, buf[i].sew); // text plus imm and element width
+                sha256_add(&s, norm, (size_t)len);      // absorb it
+            }
+        bad = got < 0;                                  // a parse error: do not cache
+        source_close(&in);                              // close the input
+    }
+    free(buf);                                          // batch buffer
+    fflush(stderr);                                     // input messages go to /dev/null
+    if (quiet >= 0 && err >= 0) dup2(err, 2);           // restore stderr
+    if (quiet >= 0) close(quiet);                       // close /dev/null
+    if (err >= 0) close(err);                           // close the saved stderr
+    if (bad) return -1;                                 // not cacheable: run uncached
+    sha256_hex(&s, key);                                // the key as 64 hex digits
+    return 0;                                           // cacheable
+}                                                      // end cache_key
+
+static FILE *cache_cap;                                 // tmpfile holding fd 1 during a miss, NULL otherwise
+static int cache_stdout = -1;                           // the real stdout meanwhile
+
+/* End the capture of a miss: put fd 1 back and print the report. Returns the report (malloc'd, for
+   the caller to store) or NULL. */
+static char *cache_release(long *len) {                 // restores stdout; returns the report or NULL
+    if (!cache_cap) return NULL;                        // not capturing
+    fflush(stdout);                                     // the run's last buffered lines
+    dup2(cache_stdout, 1); close(cache_stdout);         // stdout is the terminal or file again
+    *len = (long)lseek(fileno(cache_cap), 0, SEEK_END); // fd 1 shared the tmpfile's offset
+    char *report = *len >= 0 ? malloc((size_t)*len + 1) : NULL; // room for the whole report
+    lseek(fileno(cache_cap), 0, SEEK_SET);              // from the start of the report
+    if (report && read(fileno(cache_cap), report, (size_t)*len) == *len) fwrite(report, 1, (size_t)*len, stdout); // read it back and print it
+    else { free(report); report = NULL; }               // lost report: nothing to print or store
+    fclose(cache_cap); cache_cap = NULL;                // tmpfile no longer needed
+    return report;                                      // for the caller to store, or NULL
+}                                                      // end cache_release
+
+static void cache_at_exit(void) {                      // exit() inside simulate(): print the report, store nothing
+    long len;                                           // report size
+    free(cache_release(&len));                          // print it, store nothing
+}                                                      // end cache_at_exit
+
+static int cache_miss(const char *dir, const char *key, long long max_mb, int argc, char **argv) { // run, then store
+    fflush(stdout);                                     // nothing buffered may go into the capture
+    cache_cap = tmpfile();                              // anonymous file for the report
+    cache_stdout = dup(1);                              // save the real stdout
+    if (atexit(cache_at_exit) || !cache_cap || cache_stdout < 0 || dup2(fileno(cache_cap), 1) < 0) { // run uncached
+        if (cache_cap) fclose(cache_cap);               // close the tmpfile
+        if (cache_stdout >= 0) close(cache_stdout);     // close the saved stdout
+        cache_cap = NULL;                               // nothing captured
+        return simulate(argc, argv);                    // run without caching
+    }
+    int rc = simulate(argc, argv);                      // stdout captured
+    long len;                                           // report size
+    char *report = cache_release(&len);                 // restore stdout, print the report
+    const char *files[] = { "pipeline_cycles.csv", "pipeline_cycles.idx" }; // outputs the hit restores
+    if (report && rc == 0 && cache_store(dir, key, report, (size_t)len, files, 2) == 0) // only a successful run is stored
+        cache_evict(dir, max_mb << 20);                 // trim the directory to --cache-max-mb
+    free(report);                                       // the report
+    return rc;                                          // exit code of the run
+}                                                      // end cache_miss
+#endif
+
+int main(int argc, char **argv) {                       // program entry point: result cache around simulate()
+    const char *dir = NULL;                             // --cache directory
+    long long max_mb = 256;                             // --cache-max-mb
+    char **args = malloc(sizeof(char *) * (size_t)(argc + 1)); // arguments for simulate
+    int nargs = 0, rc;                                  // number of them, exit code
+    if (!args) { fprintf(stderr, "Out of memory\n"); return 5; } // cannot even copy the arguments
+    for (int a=0;a<argc;a++) {                          // the cache's own options stay here
+        if (a && strncmp(argv[a], "--cache=", 8) == 0) { // --cache=DIR
+            dir = argv[a] + 8;                          // directory name
+            if (!*dir) { fprintf(stderr, "Bad %s\n", argv[a]); free(args); return 6; } // empty directory name
+        }
+        else if (a && strncmp(argv[a], "--cache-max-mb=", 15) == 0) { // --cache-max-mb=N
+            max_mb = atoll(argv[a] + 15);               // limit in MiB
+            if (max_mb < 1) { fprintf(stderr, "Bad %s\n", argv[a]); free(args); return 6; } // need at least 1
+        }
+        else args[nargs++] = argv[a];                   // everything else goes to simulate
+    }
+    args[nargs] = NULL;                                 // argv-style terminator
+#ifndef HAVE_RESULT_CACHE
+    if (dir) { fprintf(stderr, "Error: --cache needs a POSIX system\n"); rc = 6; } // no cache without POSIX
+    else rc = simulate(nargs, args);                    // run without caching
+#else
+    char key[65];                                       // SHA-256 of the run as hex
+    if (!dir || cache_key(nargs, args, key)) rc = simulate(nargs, args); // no --cache, or a run it cannot handle
+    else {                                              // cached run
+        mkdir(dir, 0777);                               // may already exist
+        if (cache_load(dir, key) == 0) rc = 0;          // hit: the report and files as the first run left them
+        else rc = cache_miss(dir, key, max_mb, nargs, args); // miss: run with stdout captured
+    }
+#endif
+    free(args);                                         // argument copy
+    return rc;                                          // exit code of the run
 }                                                      // end main and end of file
@@ -1,17 +1,161 @@
+#ifndef _WIN32
+#define _XOPEN_SOURCE 700                   /* pwrite, fork and execvp under -std=c11 */
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#define HAVE_PWRITE 1                       /* parallel CSV writer (--csv-threads) */
+#define HAVE_FORK 1                         /* --shards runs each shard as a child process */
+#endif
+#ifdef WITH_ZLIB
+#include <zlib.h>                           /* gzip CSV (--gzip) and inputs; build with -DWITH_ZLIB ... -lz */
+#endif
+#if defined(__has_include) && !defined(NO_USDT)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>                        /* USDT probes, a NOP each until a tracer attaches */
+#define HAVE_USDT 1
+#endif
+#endif
+
+/* static tracepoints around each phase, provider "simulator" (argument layouts in README) */
+#ifdef HAVE_USDT
+#define PROBE0(name)          DTRACE_PROBE(simulator, name)
+#define PROBE1(name, a)       DTRACE_PROBE1(simulator, name, a)
+#define PROBE2(name, a, b)    DTRACE_PROBE2(simulator, name, a, b)
+#else
+#define PROBE0(name)          ((void)0)
+#define PROBE1(name, a)       ((void)0)
+#define PROBE2(name, a, b)    ((void)0)
+#endif
 
 #define MAX_INSTR  4096
 #define MAX_LINE   4096
+#define REGS_PER_FILE 32                    /* x0..x31, f0..f31 and v0..v31 */
+#define NUM_REGS   (3*REGS_PER_FILE)        /* register ids: x<n> is n, f<n> is 32+n, v<n> is 64+n */
+#define MAX_SRCS   3                        /* fmadd and vfmacc read three registers */
+#define CSV_ROW_MAX 384                     /* longest pipeline_timeline.csv row */
+#define MAX_CSV_THREADS 64
+
+/* input files: with zlib, gzip-compressed and plain files are both read through a gzFile */
+#ifdef WITH_ZLIB
+typedef gzFile InFile;
+#define in_open(path)        gzopen(path, "rb")
+#define in_gets(buf, len, f) gzgets(f, buf, (int)(len))
+#define in_seek(f, off)      gzseek(f, off, SEEK_SET)
+#define in_close(f)          gzclose(f)
+#else
+typedef FILE *InFile;
+#define in_open(path)        fopen(path, "r")
+#define in_gets(buf, len, f) fgets(buf, (int)(len), f)
+#define in_seek(f, off)      fseek(f, off, SEEK_SET)
+#define in_close(f)          fclose(f)
+#endif
+
+/* optional decode-stage optimizations (off by default) */
+#define OPT_MOVE_ELIM   1   /* mov rd, rs: rd aliases rs's producer, mov itself has no dependency */
+#define OPT_ZERO_IDIOM  2   /* sub rd, rs, rs: writes zero, depends on nothing */
+
+typedef enum { OP_ADD, OP_SUB, OP_MOV, OP_LD, OP_SD,
+               OP_FADD, OP_FMUL, OP_FDIV, OP_FMADD, OP_FLD, OP_FSD,
+               OP_VSETVLI, OP_VSETIVLI, OP_VLE, OP_VSE, OP_VADD, OP_VMUL, OP_VFMACC, OP_BAD } Op;
+
+/* vector functional units; each processes one element group (lanes elements) per cycle */
+enum { VU_NONE, VU_LSU, VU_ALU, VU_FMA, VU_COUNT };
+static const char *vu_names[VU_COUNT] = { "", "load/store", "alu", "fma" };
+
+/* operand signature per opcode: x = integer reg, f = FP reg, v = vector reg, V = vector reg that
+   is both destination and source, m = imm(x-base) memory operand, i = immediate, e = element
+   width (e8/e16/e32/e64). The first operand is the destination, except for stores where it is
+   the data source. */
+typedef struct {
+    const char *name;
+    const char *operands;
+    int  fp_unit;           /* executes on the pipelined FP unit */
+    int  vec_unit;          /* VU_* unit it is dispatched to after EX, VU_NONE for scalar ops */
+} OpInfo;
+static const OpInfo op_info[OP_BAD] = {
+    { "add",   "xxx",  0, VU_NONE }, { "sub",   "xxx",  0, VU_NONE }, { "mov",   "xx",   0, VU_NONE },
+    { "ld",    "xm",   0, VU_NONE }, { "sd",    "xm",   0, VU_NONE },
+    { "fadd",  "fff",  1, VU_NONE }, { "fmul",  "fff",  1, VU_NONE }, { "fdiv",  "fff",  1, VU_NONE },
+    { "fmadd", "ffff", 1, VU_NONE }, { "fld",   "fm",   0, VU_NONE }, { "fsd",   "fm",   0, VU_NONE },
+    { "vsetvli", "xxe", 0, VU_NONE }, { "vsetivli", "xie", 0, VU_NONE },
+    { "vle",   "vm",   0, VU_LSU  }, { "vse",   "vm",   0, VU_LSU  },
+    { "vadd",  "vvv",  0, VU_ALU  }, { "vmul",  "vvv",  0, VU_ALU  }, { "vfmacc", "Vvv", 0, VU_FMA },
+};
+#define IS_STORE(op)  ((op)==OP_SD || (op)==OP_FSD || (op)==OP_VSE)
+#define IS_MEM(op)    ((op)==OP_LD || (op)==OP_SD || (op)==OP_FLD || (op)==OP_FSD)
+#define IS_FP_REG(r)  ((r) >= REGS_PER_FILE && (r) < 2*REGS_PER_FILE)
+#define IS_VEC_REG(r) ((r) >= 2*REGS_PER_FILE)
+
+/* macro-op fusion rules: a dependent pair (second reads first's rd) issues as one slot
+   and executes as a single EX operation (a mov is a wire, two chained adds are a 3-input add) */
+typedef struct {
+    const char *name;
+    Op   first, second;
+    int  same_rd;           /* second must also overwrite first's rd */
+} FuseRule;
+static const FuseRule fuse_rules[] = {
+    { "mov-add", OP_MOV, OP_ADD, 0 },
+    { "mov-sub", OP_MOV, OP_SUB, 0 },
+    { "add-add", OP_ADD, OP_ADD, 1 },
+    { "add-sub", OP_ADD, OP_SUB, 1 },
+    { "sub-add", OP_SUB, OP_ADD, 1 },
+    { "sub-sub", OP_SUB, OP_SUB, 1 },
+};
+#define NUM_FUSE_RULES ((int)(sizeof(fuse_rules)/sizeof(fuse_rules[0])))
+
+enum { FUSED_NONE, FUSED_HEAD, FUSED_TAIL };
+
+/* scoreboard timing configuration: pipelined EX latency per opcode and MEM depth */
+typedef struct {
+    int ex_lat[OP_BAD];     /* EX (or FP unit) cycles per opcode; memory ops: address generation */
+    int mem_stages;         /* cycles between EX and WB (1 in the classic 5-stage pipe) */
+} Timing;
+
+/* vector unit configuration; latencies are cycles from an element group entering a unit
+   until its result can be read */
+typedef struct {
+    int vlen;               /* bits per vector register */
+    int lanes;              /* elements processed per cycle by each unit */
+    int chain;              /* consumers may start once the first element group is produced */
+    const int *lat;         /* per opcode */
+} VecConfig;
+
+/* vector unit activity of one run */
+typedef struct {
+    int  ops, chained;      /* vector ops, and starts that overlapped a producer still running */
+    long busy[VU_COUNT];    /* cycles each unit accepted an element group */
+    long elems;             /* elements processed */
+    long wait;              /* cycles ops waited after dispatch for operands or a free unit */
+} VecStats;
+
+/* per-instruction schedule produced by either engine, with the stall split */
+typedef struct {
+    int *stalls, *IF, *ID, *EX, *MEM, *WB;
+    long raw_int, raw_fp;   /* RAW stalls waiting on integer / FP register producers */
+    long issue;             /* scoreboard issue stalls: WAW and write-back slot conflicts */
+    VecStats vec;
+} Timeline;
 
-typedef enum { OP_ADD, OP_SUB, OP_MOV, OP_BAD } Op;
 typedef struct {
     Op   op;
     char rd[16];
-    char rs[2][16];
+    char rs[MAX_SRCS][16];
     int  rs_count;
+    int  rd_id, rs_id[MAX_SRCS]; /* register ids, -1 if unused (stores have no rd) */
+    long imm;               /* memory offset, or vsetivli's AVL */
+    int  sew;               /* vsetvli/vsetivli element width in bits */
+    int  vl;                /* vector ops: elements, set by the preceding vsetvli */
+    int  vstart, vend;      /* vector ops: first cycle in the vector unit, last result written */
+    int  prod[MAX_SRCS];    /* producing instruction of each source after renaming, -1 = ready */
+    int  fused;             /* FUSED_HEAD/FUSED_TAIL when part of a fused pair */
+    int  slot;              /* pipeline slot number; both halves of a fused pair share one */
     char text[128];
 } Instr;
 
@@ -35,7 +179,7 @@ static int is_blank_ascii(const char *s) {
     return 1;
 }
 
-/* find op token "add"/"sub"/"mov" ignoring case; returns enum or OP_BAD */
+/* find the first word naming a known opcode, ignoring case; returns enum or OP_BAD */
 static Op find_opcode(const char *s) {
     const char *p = s;
     while (*p) {
@@ -45,32 +189,72 @@ static Op find_opcode(const char *s) {
         char w[16]; int j=0;
         while (*q && isalpha((unsigned char)*q) && j<15) w[j++] = (char)tolower((unsigned char)*q), q++;
         w[j]='\0';
-        if (strcmp(w,"add")==0) return OP_ADD;
-        if (strcmp(w,"sub")==0) return OP_SUB;
-        if (strcmp(w,"mov")==0) return OP_MOV;
+        for (int o=0;o<OP_BAD;o++) if (strcmp(w, op_info[o].name)==0) return (Op)o;
         p = q;
     }
     return OP_BAD;
 }
 
-/* scan next ASCII register x[0-9]+ anywhere; returns pointer after match, or NULL if none */
-static const char* find_next_reg(const char *p, char out[16]) {
+/* scan next ASCII register [xfv][0-9]+ anywhere; stores its file letter in *kind.
+   returns pointer after match, or NULL if none */
+static const char* find_next_reg(const char *p, char out[16], char *kind) {
     while (*p) {
-        if (*p=='x' || *p=='X') {
+        char c = (char)tolower((unsigned char)*p);
+        if (c=='x' || c=='f' || c=='v') {
             const char *q = p+1;
             int j=0;
             while (*q && isdigit((unsigned char)*q)) {
                 if (j<14) out[j++] = *q;
                 q++;
             }
-            if (j>0) { out[j]='\0'; return q; }
+            if (j>0) { out[j]='\0'; *kind=c; return q; }
         }
         p++;
     }
     return NULL;
 }
 
-/* tolerant line parser: finds opcode, then collects registers by scanning x[0-9]+ */
+/* fill ins from operands in signature order; ids[k] = -1 for an immediate or element width */
+static void build_instr(Instr *ins, Op op, char regs[][16], const int *ids, long imm, int sew) {
+    const char *sig = op_info[op].operands;
+    int nops = (int)strlen(sig);
+    ins->op = op;
+    ins->imm = imm;
+    ins->sew = sew;
+    ins->vl = 0;
+    for (int k=0;k<MAX_SRCS;k++) { ins->rs_id[k] = -1; ins->rs[k][0] = '\0'; }
+    if (IS_STORE(op)) {         /* sources: base, data */
+        ins->rd[0]='\0';
+        ins->rd_id = -1;
+        snprintf(ins->rs[0],sizeof(ins->rs[0]),"%s", regs[1]); ins->rs_id[0] = ids[1];
+        snprintf(ins->rs[1],sizeof(ins->rs[1]),"%s", regs[0]); ins->rs_id[1] = ids[0];
+        ins->rs_count=2;
+    } else {
+        snprintf(ins->rd,  sizeof(ins->rd),  "%s", regs[0]);
+        ins->rd_id = ids[0];
+        ins->rs_count=0;
+        for (int k=1;k<nops;k++) {
+            if (ids[k] < 0) continue;          /* immediate or element width */
+            snprintf(ins->rs[ins->rs_count],sizeof(ins->rs[0]),"%s", regs[k]);
+            ins->rs_id[ins->rs_count++] = ids[k];
+        }
+        if (sig[0]=='V') {                     /* accumulator: destination is read as well */
+            snprintf(ins->rs[ins->rs_count],sizeof(ins->rs[0]),"%s", regs[0]);
+            ins->rs_id[ins->rs_count++] = ids[0];
+        }
+    }
+    if (strchr(sig, 'm'))
+        snprintf(ins->text,sizeof(ins->text),"%s %s, %ld(%s)",op_info[op].name,regs[0],imm,regs[1]);
+    else {
+        int len = snprintf(ins->text,sizeof(ins->text),"%s %s",op_info[op].name,regs[0]);
+        for (int k=1;k<nops;k++)
+            len += snprintf(ins->text+len,sizeof(ins->text)-len,", %s",regs[k]);
+    }
+}
+
+/* tolerant line parser: finds opcode, then collects registers by scanning [xfv][0-9]+ in the
+   order given by the opcode's operand signature. Memory operands are "imm(base)"; the base is
+   looked up inside the parentheses so a hex offset such as 0x10 is not mistaken for a register. */
 static int parse_line(const char *line_in, Instr *ins, int lineno) {
     char buf[MAX_LINE];
     strncpy(buf, line_in, sizeof(buf)-1); buf[sizeof(buf)-1]='\0';
@@ -86,76 +270,1274 @@ static int parse_line(const char *line_in, Instr *ins, int lineno) {
         return 0;
     }
 
-    char regs[3][16]; int rcount=0;
+    const char *sig = op_info[op].operands;
+    int nops = (int)strlen(sig);
+    char regs[MAX_SRCS+1][16]; int ids[MAX_SRCS+1]; int rcount=0;
     const char *p = buf;
-    while (rcount < 3) {
-        char digits[16];
-        const char *np = find_next_reg(p, digits);
+    long imm = 0;
+    int sew = 0;
+    while (rcount < nops) {
+        char digits[16], kind;
+        if (sig[rcount]=='i' || sig[rcount]=='e') {   /* non-register operand after the next comma */
+            const char *c = strchr(p, ',');
+            if (!c) break;
+            c += strspn(c+1, " \t") + 1;
+            char *end;
+            if (sig[rcount]=='i') imm = strtol(c, &end, 0);
+            else if (tolower((unsigned char)*c)=='e') sew = (int)strtol(c+1, &end, 10);
+            else break;
+            if (end==c || (sig[rcount]=='e' && sew!=8 && sew!=16 && sew!=32 && sew!=64)) {
+                fprintf(stderr, "Parse error on line %d: bad %s for %s  |  line: \"%s\"\n",
+                        lineno, sig[rcount]=='i' ? "immediate" : "element width (e8/e16/e32/e64)", op_info[op].name, buf);
+                return -1;
+            }
+            snprintf(regs[rcount], sizeof(regs[rcount]), "%.*s", (int)(end-c), c);
+            ids[rcount++] = -1;
+            p = end;
+            continue;
+        }
+        if (sig[rcount]=='m') {
+            const char *comma = strchr(buf, ',');
+            const char *paren = comma ? strchr(comma, '(') : NULL;
+            if (!paren) break;
+            imm = strtol(comma+1, NULL, 0);
+            p = paren;
+        }
+        const char *np = find_next_reg(p, digits, &kind);
         if (!np) break;
-        snprintf(regs[rcount], sizeof(regs[rcount]), "x%s", digits);
+        char want = (sig[rcount]=='m' ? 'x' : (char)tolower((unsigned char)sig[rcount]));
+        if (kind != want) {
+            fprintf(stderr, "Parse error on line %d: operand %d of %s must be an %c register  |  line: \"%s\"\n",
+                    lineno, rcount+1, op_info[op].name, want, buf);
+            return -1;
+        }
+        if (strlen(digits) > 2 || atoi(digits) >= REGS_PER_FILE) {
+            fprintf(stderr, "Parse error on line %d: register %c%s out of range (%c0..%c%d)  |  line: \"%s\"\n",
+                    lineno, kind, digits, kind, kind, REGS_PER_FILE-1, buf);
+            return -1;
+        }
+        snprintf(regs[rcount], sizeof(regs[rcount]), "%c%s", kind, digits);
+        ids[rcount] = atoi(digits) + (kind=='f' ? REGS_PER_FILE : kind=='v' ? 2*REGS_PER_FILE : 0);
         rcount++;
         p = np;
     }
 
-    if ((op==OP_ADD || op==OP_SUB) && rcount != 3) {
-        fprintf(stderr, "Parse error on line %d: need 3 regs for %s; got %d  |  line: \"%s\"\n",
-                lineno, (op==OP_ADD?"add":"sub"), rcount, buf);
+    if (rcount != nops) {
+        if (strchr(sig, 'm'))
+            fprintf(stderr, "Parse error on line %d: need \"reg, imm(base)\" for %s  |  line: \"%s\"\n",
+                    lineno, op_info[op].name, buf);
+        else
+            fprintf(stderr, "Parse error on line %d: need %d regs for %s; got %d  |  line: \"%s\"\n",
+                    lineno, nops, op_info[op].name, rcount, buf);
         return -1;
     }
-    if (op==OP_MOV && rcount != 2) {
-        fprintf(stderr, "Parse error on line %d: need 2 regs for mov; got %d  |  line: \"%s\"\n",
-                lineno, rcount, buf);
-        return -1;
+
+    build_instr(ins, op, regs, ids, imm, sew);
+    return 1;
+}
+
+/* instruction sources: the engine pulls decoded instructions one batch per call, from
+     FILE            text, one instruction per line (.gz too with zlib)
+     trace:FILE      binary trace (extended_simulator --trace-out)
+     commit:FILE     commit log with disassembly, as printed by spike -l
+     synth:N[:SEED]  N pseudo-random scalar instructions
+     loop:N:SOURCE   another source's instructions, N times over
+   next() returns how many it decoded into buf (at most max), 0 at the end, or minus an exit code */
+#define SOURCE_BATCH 256
+#define TRACE_MAGIC  "PSIMTRC1"
+#define TRACE_RECORD 16
+typedef struct InstrSource {
+    int  (*next)(struct InstrSource *s, Instr *buf, int max);
+    const char *name;
+    InFile f; FILE *bin;
+    int  lineno;                /* lines or records read */
+    long left;                  /* synth: instructions still to make */
+    unsigned long long seed;
+    Instr *kernel; int kn, kpos; long iters;   /* loop */
+} InstrSource;
+
+static int text_input(const char *spec) {
+    static const char *kinds[] = { "trace:", "commit:", "synth:", "loop:" };
+    for (size_t k=0;k<sizeof(kinds)/sizeof(kinds[0]);k++)
+        if (strncmp(spec, kinds[k], strlen(kinds[k])) == 0) return 0;
+    return 1;
+}
+
+static int text_next(InstrSource *s, Instr *buf, int max) {
+    char line[MAX_LINE];
+    int got = 0;
+    while (got < max && in_gets(line, sizeof(line), s->f)) {
+        int r = parse_line(line, &buf[got], ++s->lineno);
+        if (r < 0) return -2;
+        got += r;
     }
+    return got;
+}
 
-    ins->op = op;
-    if (op == OP_MOV) {
-        snprintf(ins->rd,  sizeof(ins->rd),  "%s", regs[0]);
-        snprintf(ins->rs[0],sizeof(ins->rs[0]),"%s", regs[1]);
-        ins->rs[1][0]='\0';
-        ins->rs_count=1;
-        snprintf(ins->text,sizeof(ins->text),"mov %s, %s",ins->rd,ins->rs[0]);
-    } else {
-        snprintf(ins->rd,  sizeof(ins->rd),  "%s", regs[0]);
-        snprintf(ins->rs[0],sizeof(ins->rs[0]),"%s", regs[1]);
-        snprintf(ins->rs[1],sizeof(ins->rs[1]),"%s", regs[2]);
-        ins->rs_count=2;
-        snprintf(ins->text,sizeof(ins->text),"%s %s, %s, %s",
-                 (op==OP_ADD?"add":"sub"),ins->rd,ins->rs[0],ins->rs[1]);
+static const char *abi_x[REGS_PER_FILE] = { "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "s0", "s1",
+    "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11",
+    "t3", "t4", "t5", "t6" };
+static const char *abi_f[REGS_PER_FILE] = { "ft0", "ft1", "ft2", "ft3", "ft4", "ft5", "ft6", "ft7", "fs0", "fs1",
+    "fa0", "fa1", "fa2", "fa3", "fa4", "fa5", "fa6", "fa7", "fs2", "fs3", "fs4", "fs5", "fs6", "fs7", "fs8", "fs9",
+    "fs10", "fs11", "ft8", "ft9", "ft10", "ft11" };
+
+/* disassembly -> input syntax: no "c." prefix, mv as mov, c.add/c.sub widened, ABI names as x<n>/f<n> */
+static void commit_text(const char *dis, char *out, size_t size) {
+    char mn[16], ops[MAX_LINE];
+    int j = 0;
+    size_t len = 0;
+    dis += strspn(dis, " \t");
+    while (*dis && !isspace((unsigned char)*dis) && j < 15) mn[j++] = (char)tolower((unsigned char)*dis++);
+    mn[j] = '\0';
+    int compressed = strncmp(mn, "c.", 2) == 0;
+    const char *m = compressed ? mn + 2 : mn;
+    if (strcmp(m, "mv") == 0) m = "mov";
+    for (const char *p = dis; *p && len + 24 < sizeof(ops); ) {
+        if (isalpha((unsigned char)*p)) {
+            char w[16], file = 'x'; int k = 0, r;
+            while (isalnum((unsigned char)*p) && k < 15) w[k++] = (char)tolower((unsigned char)*p++);
+            w[k] = '\0';
+            r = strcmp(w, "fp") ? -1 : 8;               /* frame pointer = s0 */
+            for (int i=0;i<REGS_PER_FILE && r < 0;i++)
+                if (!strcmp(w, abi_x[i]) || !strcmp(w, abi_f[i])) { r = i; file = w[0]=='f' ? 'f' : 'x'; }
+            if (r >= 0) len += (size_t)snprintf(ops + len, sizeof(ops) - len, "%c%d", file, r);
+            else len += (size_t)snprintf(ops + len, sizeof(ops) - len, "%s", w);
+        }
+        else if (isdigit((unsigned char)*p))           /* keep 0x10 in one piece */
+            while (isalnum((unsigned char)*p) && len + 1 < sizeof(ops)) ops[len++] = *p++;
+        else ops[len++] = *p++;
     }
-    return 1;
+    ops[len] = '\0';
+    const char *o = ops + strspn(ops, " \t"), *comma = strchr(o, ',');
+    if (compressed && comma && !strchr(comma + 1, ',') && (!strcmp(m, "add") || !strcmp(m, "sub")))
+        snprintf(out, size, "%s %.*s, %s", m, (int)(comma - o), o, o);
+    else snprintf(out, size, "%s %s", m, o);
+}
+
+static int commit_next(InstrSource *s, Instr *buf, int max) {
+    char line[MAX_LINE], text[MAX_LINE];
+    int got = 0;
+    while (got < max && in_gets(line, sizeof(line), s->f)) {
+        const char *word = strstr(line, "(0x");
+        const char *dis = word ? strchr(word, ')') : NULL;
+        s->lineno++;
+        if (!dis || strncmp(line + strspn(line, " \t"), "core", 4)) continue;
+        commit_text(dis + 1, text, sizeof(text));
+        int r = parse_line(text, &buf[got], s->lineno);
+        if (r < 0) return -2;
+        got += r;
+    }
+    return got;
 }
 
-static int reg_in_sources(const char *reg, const Instr *ins) {
-    for (int i=0;i<ins->rs_count;i++) if (strcmp(reg, ins->rs[i])==0) return 1;
+/* trace record: opcode, operands in signature order as register id + 1 (0 = immediate or width),
+   element width, 2 zero bytes, immediate as 8 little-endian bytes */
+static int trace_decode(const unsigned char *rec, Instr *ins) {
+    if (rec[0] >= OP_BAD) return -1;
+    Op op = (Op)rec[0];
+    const char *sig = op_info[op].operands;
+    char regs[MAX_SRCS+1][16]; int ids[MAX_SRCS+1];
+    unsigned long long u = 0;
+    for (int b=7;b>=0;b--) u = u << 8 | rec[8+b];
+    long imm = (long)(long long)u;
+    int sew = rec[5];
+    if (imm < -(1L << 31) || imm >= (1L << 31)) return -1;
+    for (int k=0;sig[k];k++) {
+        int id = rec[1+k] - 1;
+        char want = sig[k]=='m' ? 'x' : (char)tolower((unsigned char)sig[k]);
+        ids[k] = -1;
+        if (sig[k]=='i') snprintf(regs[k], sizeof(regs[k]), "%d", (int)imm);
+        else if (sig[k]=='e') {
+            if (sew!=8 && sew!=16 && sew!=32 && sew!=64) return -1;
+            snprintf(regs[k], sizeof(regs[k]), "e%d", sew);
+        }
+        else if (id < 0 || id >= NUM_REGS || "xfv"[id / REGS_PER_FILE] != want) return -1;
+        else { snprintf(regs[k], sizeof(regs[k]), "%c%d", want, id % REGS_PER_FILE); ids[k] = id; }
+    }
+    build_instr(ins, op, regs, ids, imm, sew);
     return 0;
 }
 
-int main(int argc, char **argv) {
-    const char *infile = (argc>=2? argv[1] : "instructions.txt");
-    const char *csvout = (argc>=3? argv[2] : "pipeline_timeline.csv");
+static int trace_next(InstrSource *s, Instr *buf, int max) {
+    unsigned char raw[64 * TRACE_RECORD];
+    int got = 0;
+    while (got < max) {
+        int want = max - got < 64 ? max - got : 64;
+        size_t bytes = fread(raw, 1, (size_t)want * TRACE_RECORD, s->bin);
+        int k = (int)(bytes / TRACE_RECORD);
+        for (int i=0;i<k;i++, got++)
+            if (trace_decode(raw + i * TRACE_RECORD, &buf[got])) {
+                fprintf(stderr, "Error: bad record %d in %s\n", s->lineno + i + 1, s->name);
+                return -2;
+            }
+        s->lineno += k;
+        if (bytes % TRACE_RECORD) {
+            fprintf(stderr, "Error: truncated record %d in %s\n", s->lineno + 1, s->name);
+            return -2;
+        }
+        if (k < want) break;
+    }
+    return got;
+}
 
-    FILE *f = fopen(infile, "r");
-    if (!f) { fprintf(stderr, "Error: cannot open %s\n", infile); return 1; }
+/* same generator as extended_simulator's, so synth:N:SEED is the same program in both */
+static int synth_next(InstrSource *s, Instr *buf, int max) {
+    static const Op mix[16] = { OP_ADD, OP_ADD, OP_ADD, OP_ADD, OP_SUB, OP_MOV, OP_MOV, OP_LD, OP_LD, OP_LD,
+                                OP_SD, OP_SD, OP_FADD, OP_FMUL, OP_FLD, OP_FSD };
+    int got = 0;
+    for (; got < max && s->left > 0; got++, s->left--) {
+        char regs[MAX_SRCS+1][16]; int ids[MAX_SRCS+1];
+        s->seed ^= s->seed >> 12; s->seed ^= s->seed << 25; s->seed ^= s->seed >> 27;
+        unsigned long long r = s->seed * 2685821657736338717ull;
+        Op op = mix[r & 15];
+        const char *sig = op_info[op].operands;
+        r >>= 4;
+        for (int k=0;sig[k];k++, r >>= 4) {
+            int reg = sig[k]=='m' ? 1 + (int)(r & 3) : sig[k]=='f' ? (int)(r & 15) : 1 + (int)(r % 15);
+            snprintf(regs[k], sizeof(regs[k]), "%c%d", sig[k]=='f' ? 'f' : 'x', reg);
+            ids[k] = reg + (sig[k]=='f' ? REGS_PER_FILE : 0);
+        }
+        build_instr(&buf[got], op, regs, ids, 8 * (long)(r & 31), 0);
+    }
+    return got;
+}
 
-    Instr prog[MAX_INSTR];
-    int n=0, lineno=0;
+static int loop_next(InstrSource *s, Instr *buf, int max) {
+    int got = 0;
+    while (got < max && s->iters > 0) {
+        int k = s->kn - s->kpos < max - got ? s->kn - s->kpos : max - got;
+        memcpy(buf + got, s->kernel + s->kpos, sizeof(Instr) * (size_t)k);
+        got += k; s->kpos += k;
+        if (s->kpos == s->kn) { s->kpos = 0; s->iters--; }
+    }
+    return got;
+}
+
+static void source_close(InstrSource *s) {
+    if (s->f) in_close(s->f);
+    if (s->bin) fclose(s->bin);
+    free(s->kernel);
+    s->f = NULL; s->bin = NULL; s->kernel = NULL;
+}
+
+/* returns 0 or an exit code */
+static int source_open(InstrSource *s, const char *spec) {
+    char *end;
+    memset(s, 0, sizeof(*s));
+    s->name = spec;
+    if (strncmp(spec, "synth:", 6) == 0) {
+        s->left = strtol(spec + 6, &end, 10);
+        s->seed = *end == ':' ? strtoull(end + 1, &end, 10) : 1;
+        if (s->left < 1 || *end) { fprintf(stderr, "Bad source %s (synth:N[:SEED])\n", spec); return 7; }
+        s->seed += 0x9E3779B97F4A7C15ull;
+        s->next = synth_next;
+        return 0;
+    }
+    if (strncmp(spec, "loop:", 5) == 0) {
+        InstrSource k;
+        int cap = 0, got, err;
+        s->iters = strtol(spec + 5, &end, 10);
+        if (s->iters < 1 || *end != ':') { fprintf(stderr, "Bad source %s (loop:N:SOURCE)\n", spec); return 7; }
+        if ((err = source_open(&k, end + 1))) return err;
+        do {
+            if (s->kn + SOURCE_BATCH > cap) {
+                Instr *w = realloc(s->kernel, sizeof(Instr) * (size_t)(cap += cap + SOURCE_BATCH));
+                if (!w) { fprintf(stderr, "OOM\n"); source_close(&k); source_close(s); return 5; }
+                s->kernel = w;
+            }
+            got = k.next(&k, s->kernel + s->kn, SOURCE_BATCH);
+            if (got > 0) s->kn += got;
+        } while (got > 0);
+        source_close(&k);
+        if (got < 0) { source_close(s); return -got; }
+        s->next = loop_next;
+        return 0;
+    }
+    if (strncmp(spec, "trace:", 6) == 0) {
+        char magic[8];
+        s->name = spec + 6;
+        if (!(s->bin = fopen(s->name, "rb"))) { fprintf(stderr, "Error: cannot open %s\n", s->name); return 1; }
+        if (fread(magic, 1, 8, s->bin) != 8 || memcmp(magic, TRACE_MAGIC, 8)) {
+            fprintf(stderr, "Error: %s is not a binary trace\n", s->name);
+            source_close(s);
+            return 2;
+        }
+        s->next = trace_next;
+        return 0;
+    }
+    if (strncmp(spec, "commit:", 7) == 0) s->name = spec + 7;
+    if (!(s->f = in_open(s->name))) { fprintf(stderr, "Error: cannot open %s\n", s->name); return 1; }
+    s->next = s->name == spec ? text_next : commit_next;
+    return 0;
+}
+
+static int is_zero_idiom(const Instr *ins) {
+    return ins->op==OP_SUB && ins->rs_id[0]==ins->rs_id[1];
+}
+
+/* whether b consumes a's result and an enabled rule (bit r of rules enables fuse_rules[r]) pairs them */
+static int fusable(const Instr *a, const Instr *b, unsigned rules) {
+    int dep = 0;
+    for (int k=0;k<b->rs_count && a->rd_id >= 0;k++) dep |= (b->rs_id[k]==a->rd_id);
+    for (int r=0;r<NUM_FUSE_RULES && dep;r++) {
+        if (!(rules & (1u<<r))) continue;
+        if (a->op!=fuse_rules[r].first || b->op!=fuse_rules[r].second) continue;
+        if (fuse_rules[r].same_rd && b->rd_id!=a->rd_id) continue;
+        return 1;
+    }
+    return 0;
+}
+
+/* fusion stage between IF and ID: pair up adjacent instructions matching an enabled rule,
+   greedily from the front; returns the number of fused pairs */
+static int fuse_pairs(Instr *prog, int n, unsigned rules) {
+    int pairs=0, slot=0;
+    for (int i=0;i<n;i++) { prog[i].fused = FUSED_NONE; }
+    for (int i=0;i<n;i++) {
+        prog[i].slot = slot++;
+        if (i+1 >= n) break;
+        if (fusable(&prog[i], &prog[i+1], rules)) {
+            prog[i].fused = FUSED_HEAD;
+            prog[i+1].fused = FUSED_TAIL;
+            prog[i+1].slot = prog[i].slot;
+            pairs++; i++;
+        }
+    }
+    return pairs;
+}
+
+/* parse "--fuse" (all rules) or "--fuse=name,name,..." into a rule mask; returns -1 on unknown name */
+static long parse_fuse_rules(const char *arg) {
+    if (strcmp(arg, "--fuse")==0) return (1L<<NUM_FUSE_RULES)-1;
+    unsigned mask=0;
+    const char *p = arg + strlen("--fuse=");
+    while (*p) {
+        size_t len = strcspn(p, ",");
+        int found=0;
+        for (int r=0;r<NUM_FUSE_RULES;r++)
+            if (strlen(fuse_rules[r].name)==len && strncmp(p, fuse_rules[r].name, len)==0) { mask |= 1u<<r; found=1; }
+        if (!found) return -1;
+        p += len;
+        if (*p==',') p++;
+    }
+    return mask;
+}
+
+/* rename pass: record which earlier instruction produces each source.
+   With OPT_MOVE_ELIM a mov produces nothing; its rd aliases the producer of its source.
+   With OPT_ZERO_IDIOM "sub rd, rs, rs" reads nothing and leaves rd ready. */
+static void resolve_producers(Instr *prog, int n, int opts) {
+    int producer[NUM_REGS];
+    for (int r=0;r<NUM_REGS;r++) producer[r] = -1;
+    for (int i=0;i<n;i++) {
+        Instr *in = &prog[i];
+        for (int k=0;k<MAX_SRCS;k++) in->prod[k] = -1;
+        if ((opts & OPT_ZERO_IDIOM) && !in->fused && is_zero_idiom(in)) { producer[in->rd_id] = -1; continue; }
+        if ((opts & OPT_MOVE_ELIM) && !in->fused && in->op == OP_MOV) { producer[in->rd_id] = producer[in->rs_id[0]]; continue; }
+        for (int k=0;k<in->rs_count;k++)
+            if (!IS_VEC_REG(in->rs_id[k])) in->prod[k] = producer[in->rs_id[k]]; /* vector unit tracks its own */
+        if (in->rd_id >= 0) producer[in->rd_id] = i;
+    }
+}
+
+/* vl seen by each vector op: set by the latest vsetvli/vsetivli. The AVL register's value is
+   not known statically, so vsetvli grants VLMAX = VLEN/SEW; vsetivli grants min(imm, VLMAX).
+   Before the first vsetvli, e32 with vl = VLMAX is assumed. */
+static void assign_vl(Instr *prog, int n, int vlen) {
+    int vl = vlen / 32;
+    for (int i=0;i<n;i++) {
+        Instr *in = &prog[i];
+        if (in->op == OP_VSETVLI) vl = vlen / in->sew;
+        else if (in->op == OP_VSETIVLI) vl = (in->imm < vlen / in->sew) ? (int)in->imm : vlen / in->sew;
+        in->vl = vl;
+    }
+}
+
+/* No-forwarding hazard model: a producer 1 slot back costs 2 stalls, 2 slots back costs 1.
+   A fused pair stalls as one slot (charged to its head); a producer in the same slot is internal. */
+static long compute_stalls(Instr *prog, int n, int opts, unsigned rules, int *stalls) {
+    long sum=0;
+    fuse_pairs(prog, n, rules);
+    resolve_producers(prog, n, opts);
+    for (int i=0;i<n;i++) {
+        int s=0;
+        for (int k=0;k<MAX_SRCS;k++) {
+            int p = prog[i].prod[k];
+            if (p < 0) continue;
+            int d = prog[i].slot - prog[p].slot;
+            if (d == 1) s=2;
+            else if (d == 2) s = (s>1? s:1);
+        }
+        stalls[i]=s;
+        if (prog[i].fused == FUSED_TAIL) {
+            if (s > stalls[i-1]) { sum += s - stalls[i-1]; stalls[i-1] = s; }
+            stalls[i]=0;
+        } else sum+=s;
+    }
+    return sum;
+}
+
+/* whether an FP register is among the sources that make slot i wait in the distance engine */
+static int fp_bound(const Instr *prog, int i) {
+    int last = i + (prog[i].fused == FUSED_HEAD);
+    for (int j=i;j<=last;j++)
+        for (int k=0;k<prog[j].rs_count;k++)
+            if (prog[j].prod[k] >= 0 && IS_FP_REG(prog[j].rs_id[k]) && prog[j].slot - prog[prog[j].prod[k]].slot <= 2) return 1;
+    return 0;
+}
+
+/* distance engine: apply compute_stalls and lay out IF..WB in the classic 5-stage pipe */
+static int distance_schedule(Instr *prog, int n, int opts, unsigned rules, Timeline *tl, long *sum_stalls) {
+    *sum_stalls = compute_stalls(prog, n, opts, rules, tl->stalls);
+    tl->raw_int = tl->raw_fp = tl->issue = 0;
+    for (int i=0;i<n;i++) {
+        if (fp_bound(prog, i)) tl->raw_fp += tl->stalls[i]; else tl->raw_int += tl->stalls[i];
+    }
+    int curIF=1;
+    for (int i=0;i<n;i++) {
+        if (prog[i].fused == FUSED_TAIL) {
+            tl->IF[i]=tl->IF[i-1]; tl->ID[i]=tl->ID[i-1]; tl->EX[i]=tl->EX[i-1];
+            tl->MEM[i]=tl->MEM[i-1]; tl->WB[i]=tl->WB[i-1];
+            continue;
+        }
+        int start_if=curIF+tl->stalls[i];
+        tl->IF[i]=start_if; tl->ID[i]=start_if+1; tl->EX[i]=start_if+2; tl->MEM[i]=start_if+3; tl->WB[i]=start_if+4;
+        curIF = start_if + 1;
+    }
+    return tl->WB[n-1];
+}
+
+static int eliminated(const Instr *in, int opts) {
+    if (in->fused) return 0;
+    return ((opts & OPT_ZERO_IDIOM) && is_zero_idiom(in)) || ((opts & OPT_MOVE_ELIM) && in->op == OP_MOV);
+}
+
+/* Scoreboard engine: ready[r] is the first cycle an instruction may sit in ID and read r
+   (no forwarding, so the producer's WB cycle). Integer and FP registers share the table.
+   A slot enters ID at max(previous ID + 1, ready[src]), which is O(1) per instruction for
+   any latency. Units are pipelined, so a slot then only waits at issue when
+   - WAW: its write would land before an older pending write to the same register, or
+   - its MEM entry cycle is already taken by an older, longer-latency op (one result per cycle). */
+#define MEM_RING 2048       /* > largest latency, so ring entries cannot alias */
+static int scoreboard_schedule(Instr *prog, int n, int opts, unsigned rules, const Timing *tm,
+                               Timeline *tl, long *sum_stalls) {
+    int ready[NUM_REGS];
+    for (int r=0;r<NUM_REGS;r++) ready[r]=0;
+    static int mem_taken[MEM_RING];
+    for (int c=0;c<MEM_RING;c++) mem_taken[c]=-1;
+    int id_prev=1, total=0;
+    long sum=0;
+    tl->raw_int = tl->raw_fp = tl->issue = 0;
+    fuse_pairs(prog, n, rules);
+    for (int i=0;i<n;i++) {
+        const Instr *head=&prog[i];
+        int last = i + (head->fused == FUSED_HEAD);
+        int id = id_prev+1, lat=0, bind=-1;
+        for (int j=i;j<=last;j++) {
+            const Instr *u=&prog[j];
+            int l = op_info[u->op].vec_unit ? 1 : tm->ex_lat[u->op];   /* vector ops only dispatch */
+            if (l > lat) lat = l;
+            if (eliminated(u, opts)) continue;
+            for (int k=0;k<u->rs_count;k++) {
+                int r=u->rs_id[k];
+                if (j>i && r==head->rd_id) continue;   /* forwarded inside the fused op */
+                if (ready[r] > id) { id = ready[r]; bind = r; }
+            }
+        }
+        if (bind >= 0 && IS_FP_REG(bind)) tl->raw_fp += id-(id_prev+1);
+        else tl->raw_int += id-(id_prev+1);
+        int wb_off = 1 + lat + tm->mem_stages, raw_id = id;
+        for (int moved=1; moved; ) {
+            moved = 0;
+            for (int j=i;j<=last;j++)
+                if (!eliminated(&prog[j], opts) && prog[j].rd_id >= 0 && id + wb_off <= ready[prog[j].rd_id]) {
+                    id = ready[prog[j].rd_id] - wb_off + 1;
+                    moved = 1;
+                }
+            if (mem_taken[(id+1+lat) % MEM_RING] == id+1+lat) { id++; moved = 1; }
+        }
+        mem_taken[(id+1+lat) % MEM_RING] = id+1+lat;
+        tl->issue += id - raw_id;
+        int wb = id + wb_off;
+        for (int j=i;j<=last;j++) {
+            const Instr *u=&prog[j];
+            if ((opts & OPT_ZERO_IDIOM) && eliminated(u, opts) && is_zero_idiom(u)) ready[u->rd_id] = 0;
+            else if (eliminated(u, opts)) ready[u->rd_id] = ready[u->rs_id[0]];
+            else if (u->rd_id >= 0 && !IS_VEC_REG(u->rd_id)) ready[u->rd_id] = wb;
+            tl->stalls[j] = (j==i ? id-(id_prev+1) : 0);
+            tl->IF[j]=id-1; tl->ID[j]=id; tl->EX[j]=id+1; tl->MEM[j]=id+1+lat; tl->WB[j]=wb;
+        }
+        sum += id-(id_prev+1);
+        if (wb > total) total = wb;
+        id_prev = id;
+        i = last;
+    }
+    *sum_stalls = sum;
+    return total;
+}
+
+/* vector unit state. Ops issue in order, at most one per cycle, each to its own unit where it
+   occupies ceil(vl/lanes) cycles. Without chaining a consumer waits for every element group of
+   its vector sources; with chaining it starts once the first group is readable, and then stays
+   behind the producer group by group because both process one group per cycle. */
+typedef struct {
+    int unit_free[VU_COUNT];    /* first cycle each unit can accept a new op */
+    int first[REGS_PER_FILE];   /* per vector register: cycle its first element group can be read */
+    int done[REGS_PER_FILE];    /* per vector register: cycle all of its groups can be read */
+    int last_start;
+} VecState;
+
+/* start a vector op dispatched from EX in cycle `dispatch`; returns the cycle its last result is written */
+static int vector_issue(Instr *in, int dispatch, const VecConfig *vc, VecState *vs, VecStats *st) {
+    int unit = op_info[in->op].vec_unit, lat = vc->lat[in->op];
+    int groups = in->vl > vc->lanes ? (in->vl + vc->lanes - 1) / vc->lanes : 1;
+    int start = dispatch, chained = 0;
+    if (start <= vs->last_start) start = vs->last_start + 1;
+    if (start < vs->unit_free[unit]) start = vs->unit_free[unit];
+    for (int k=0;k<in->rs_count;k++) {
+        if (!IS_VEC_REG(in->rs_id[k])) continue;
+        int v = in->rs_id[k] - 2*REGS_PER_FILE;
+        int need = vc->chain ? vs->first[v] : vs->done[v];
+        if (start < need) start = need;
+    }
+    int vd = (in->rd_id >= 0 && IS_VEC_REG(in->rd_id)) ? in->rd_id - 2*REGS_PER_FILE : -1;
+    if (vd >= 0 && start + groups - 1 + lat <= vs->done[vd])   /* WAW: finish after the older write */
+        start = vs->done[vd] - groups - lat + 2;
+    for (int k=0;k<in->rs_count;k++)
+        if (IS_VEC_REG(in->rs_id[k]) && start < vs->done[in->rs_id[k] - 2*REGS_PER_FILE]) chained = 1;
+    in->vstart = start;
+    in->vend = start + groups + lat - 2;
+    vs->unit_free[unit] = start + groups;
+    vs->last_start = start;
+    if (vd >= 0) { vs->first[vd] = start + lat; vs->done[vd] = start + groups - 1 + lat; }
+    st->ops++; st->chained += chained;
+    st->busy[unit] += groups; st->elems += in->vl; st->wait += start - dispatch;
+    return in->vend;
+}
+
+/* run the vector ops through the vector unit, each dispatched in its EX cycle;
+   returns the last cycle a vector result is written (0 without vector ops) */
+static int vector_schedule(Instr *prog, int n, const VecConfig *vc, const int *EX, VecStats *st) {
+    VecState vs;
+    memset(&vs, 0, sizeof(vs));
+    memset(st, 0, sizeof(*st));
+    int end = 0;
+    for (int i=0;i<n;i++) {
+        if (!op_info[prog[i].op].vec_unit) continue;
+        int e = vector_issue(&prog[i], EX[i], vc, &vs, st);
+        if (e > end) end = e;
+    }
+    return end;
+}
+
+/* run the selected engine; tm==NULL selects the distance model. The vector unit runs
+   decoupled behind EX, so the program ends when both the scalar pipe and the unit are done. */
+static int schedule(Instr *prog, int n, int opts, unsigned rules, const Timing *tm, const VecConfig *vc,
+                    Timeline *tl, long *sum_stalls) {
+    PROBE2(schedule_start, opts, rules);
+    int total = tm ? scoreboard_schedule(prog, n, opts, rules, tm, tl, sum_stalls)
+                   : distance_schedule(prog, n, opts, rules, tl, sum_stalls);
+    int vend = vector_schedule(prog, n, vc, tl->EX, &tl->vec);
+    if (vend > total) total = vend;
+    PROBE2(schedule_done, total, *sum_stalls);
+    return total;
+}
+
+/* Timeline trace for Perfetto and chrome://tracing (same layout as extended_simulator's --perfetto):
+   one thread track per stage, FP-unit lane and vector unit, one slice per occupancy or bubble,
+   1 cycle = 1 ns. *.json gets Chrome JSON, anything else the Perfetto protobuf format. */
+typedef struct {
+    FILE *f;
+    int proto;
+    long packets;
+} TraceOut;
+
+static void pb_varint(unsigned char **p, unsigned long long v) {
+    while (v >= 0x80) { *(*p)++ = (unsigned char)(v | 0x80); v >>= 7; }
+    *(*p)++ = (unsigned char)v;
+}
+static void pb_uint(unsigned char **p, int field, unsigned long long v) {
+    pb_varint(p, (unsigned long long)field << 3); pb_varint(p, v);
+}
+static void pb_bytes(unsigned char **p, int field, const void *b, size_t len) {
+    pb_varint(p, (unsigned long long)field << 3 | 2); pb_varint(p, len);
+    memcpy(*p, b, len); *p += len;
+}
+static void trace_packet(TraceOut *t, const unsigned char *body, size_t len) {
+    unsigned char head[16], *p = head;
+    pb_varint(&p, 1 << 3 | 2); pb_varint(&p, len);
+    fwrite(head, 1, (size_t)(p - head), t->f); fwrite(body, 1, len, t->f);
+    t->packets++;
+}
+static void json_name(FILE *f, const char *s) {
+    fputc('"', f);
+    for (;*s;s++) fputc((*s == '"' || *s == '\\' || (unsigned char)*s < 32) ? ' ' : *s, f);
+    fputc('"', f);
+}
+
+static int trace_open(TraceOut *t, const char *path) {
+    size_t len = strlen(path);
+    t->proto = !(len >= 5 && strcmp(path + len - 5, ".json") == 0);
+    t->packets = 0;
+    t->f = fopen(path, t->proto ? "wb" : "w");
+    if (!t->f) return -1;
+    if (!t->proto) fprintf(t->f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    return 0;
+}
+static void trace_close(TraceOut *t) {
+    if (!t->proto) fprintf(t->f, "\n]}\n");
+    fclose(t->f);
+}
+
+/* name a process (tid 0) or one of its thread tracks */
+static void trace_track(TraceOut *t, int pid, int tid, const char *name) {
+    if (!t->proto) {
+        fprintf(t->f, "%s\n{\"name\":\"%s_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", t->packets++ ? "," : "",
+                tid ? "thread" : "process", pid, tid);
+        json_name(t->f, name);
+        fprintf(t->f, "}}");
+        if (tid) fprintf(t->f, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"sort_index\":%d}}", pid, tid, tid);
+        return;
+    }
+    unsigned char desc[256], body[320], who[160], *d = desc, *b = body, *w = who;
+    size_t nlen = strlen(name) < 100 ? strlen(name) : 100;
+    pb_uint(&w, 1, (unsigned long long)pid);
+    if (tid) { pb_uint(&w, 2, (unsigned long long)tid); pb_bytes(&w, 5, name, nlen); }
+    else pb_bytes(&w, 6, name, nlen);
+    pb_uint(&d, 1, (unsigned long long)pid << 16 | (unsigned)tid);
+    pb_bytes(&d, tid ? 4 : 3, who, (size_t)(w - who));
+    if (t->packets == 0) pb_uint(&b, 13, 1);           /* SEQ_INCREMENTAL_STATE_CLEARED */
+    pb_uint(&b, 10, 1);
+    pb_bytes(&b, 60, desc, (size_t)(d - desc));
+    trace_packet(t, body, (size_t)(b - body));
+}
+
+static void trace_slice(TraceOut *t, int pid, int tid, const char *name, int begin, int end) {
+    if (!t->proto) {
+        fprintf(t->f, "%s\n{\"name\":", t->packets++ ? "," : "");
+        json_name(t->f, name);
+        fprintf(t->f, ",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", pid, tid, begin / 1000.0, (end - begin) / 1000.0);
+        return;
+    }
+    for (int k=0;k<2;k++) {                            /* SLICE_BEGIN, SLICE_END */
+        unsigned char ev[320], body[400], *e = ev, *b = body;
+        pb_uint(&e, 9, (unsigned long long)(k + 1));
+        pb_uint(&e, 11, (unsigned long long)pid << 16 | (unsigned)tid);
+        if (k == 0) pb_bytes(&e, 23, name, strlen(name) < 250 ? strlen(name) : 250);
+        pb_uint(&b, 8, (unsigned long long)(k ? end : begin));
+        pb_uint(&b, 10, 1);
+        pb_bytes(&b, 11, ev, (size_t)(e - ev));
+        trace_packet(t, body, (size_t)(b - body));
+    }
+}
+
+#define TR_FP      8                                   /* thread id of FP-unit lane 0 */
+#define TR_VEC     (TR_FP + 64)                        /* thread id of vector unit 1 */
+#define TR_TRACKS  (TR_VEC + VU_COUNT)
+
+/* slice on track tid, clipped so slices of one track never overlap; names the track on first use */
+static void put_slice(TraceOut *t, int *last, int tid, const char *name, int b, int e) {
+    static const char *stage_names[] = { "", "IF", "ID", "EX", "MEM", "WB" };
+    if (b < last[tid]) b = last[tid];
+    if (e <= b) return;
+    if (last[tid] == 0) {
+        char tname[32];
+        if (tid < TR_FP) snprintf(tname, sizeof(tname), "%s", stage_names[tid]);
+        else if (tid < TR_VEC) snprintf(tname, sizeof(tname), "FP lane %d", tid - TR_FP);
+        else snprintf(tname, sizeof(tname), "V %s", vu_names[tid - TR_VEC]);
+        trace_track(t, 1, tid, tname);
+    }
+    trace_slice(t, 1, tid, name, b, e);
+    last[tid] = e;
+}
+
+/* stream the schedule instruction by instruction: a stage lasts until the next stage starts,
+   FP-unit ops take the lowest free lane, stalls are a bubble in EX before the op enters it */
+static void export_timeline(TraceOut *t, const Instr *prog, int n, const Timeline *tl, int lanes) {
+    int last[TR_TRACKS] = { 0 };
+    char name[300];
+    trace_track(t, 1, 0, "simulator");
+    for (int i=0;i<n;i++) {
+        if (prog[i].fused == FUSED_TAIL) continue;     /* travels in its head's slot */
+        if (prog[i].fused == FUSED_HEAD) snprintf(name, sizeof(name), "%s + %s", prog[i].text, prog[i+1].text);
+        else snprintf(name, sizeof(name), "%s", prog[i].text);
+        put_slice(t, last, 1, name, tl->IF[i], tl->ID[i]);
+        put_slice(t, last, 2, name, tl->ID[i], tl->EX[i]);
+        if (tl->stalls[i] > 0) put_slice(t, last, 3, "bubble", tl->EX[i] - tl->stalls[i], tl->EX[i]);
+        if (op_info[prog[i].op].fp_unit) {
+            int l = 0;
+            while (l < 63 && last[TR_FP + l] > tl->EX[i]) l++;
+            put_slice(t, last, TR_FP + l, name, tl->EX[i], tl->MEM[i]);
+        }
+        else put_slice(t, last, 3, name, tl->EX[i], tl->MEM[i]);
+        put_slice(t, last, 4, name, tl->MEM[i], tl->WB[i]);
+        put_slice(t, last, 5, name, tl->WB[i], tl->WB[i] + 1);
+        if (op_info[prog[i].op].vec_unit)
+            put_slice(t, last, TR_VEC + op_info[prog[i].op].vec_unit, name, prog[i].vstart, prog[i].vstart + (prog[i].vl + lanes - 1) / lanes);
+    }
+}
+
+/* one pipeline_timeline.csv row; returns its length */
+static int csv_row(char *buf, const Instr *in, int i, const Timeline *tl, int uses_vec) {
+    int len = snprintf(buf, CSV_ROW_MAX, "%d,%s,%d,%d,%d,%d,%d,%d",
+                       i, in->text, tl->IF[i], tl->ID[i], tl->EX[i], tl->MEM[i], tl->WB[i], tl->stalls[i]);
+    if (uses_vec && op_info[in->op].vec_unit) len += snprintf(buf + len, CSV_ROW_MAX - len, ",%d,%d", in->vstart, in->vend);
+    else if (uses_vec) len += snprintf(buf + len, CSV_ROW_MAX - len, ",,");
+    buf[len++] = '\n';
+    return len;
+}
+
+#ifdef HAVE_PWRITE
+/* parallel writer: each thread formats a contiguous block of rows into its own buffer, a prefix
+   sum over the block lengths gives every block its file offset, and the blocks are written with
+   pwrite in any order; the bytes are the serial writer's. With gz each block is compressed on its
+   thread into one gzip member; members back to back are a valid .gz file. */
+typedef struct {
+    const Instr *prog;
+    const Timeline *tl;
+    const char *header;     /* written at the start of block 0 */
+    int uses_vec, lo, hi;   /* rows lo..hi-1 */
+    int gz;                 /* gzip level, 0 = plain */
+    char *buf;
+    size_t len;
+    off_t off;
+    int fd, err;
+} CsvBlock;
+
+static void *csv_format_block(void *p) {
+    CsvBlock *b = p;
+    if (b->header) { b->len = strlen(b->header); memcpy(b->buf, b->header, b->len); }
+    for (int i=b->lo;i<b->hi;i++) b->len += (size_t)csv_row(b->buf + b->len, &b->prog[i], i, b->tl, b->uses_vec);
+#ifdef WITH_ZLIB
+    if (b->gz) {
+        z_stream z;
+        memset(&z, 0, sizeof(z));
+        if (deflateInit2(&z, b->gz, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) { b->err = 1; return NULL; }
+        size_t cap = deflateBound(&z, (uLong)b->len);
+        unsigned char *out = malloc(cap);
+        z.next_in = (Bytef *)b->buf; z.avail_in = (uInt)b->len;
+        z.next_out = out; z.avail_out = (uInt)cap;
+        if (!out || deflate(&z, Z_FINISH) != Z_STREAM_END) b->err = 1;
+        deflateEnd(&z);
+        free(b->buf);
+        b->buf = (char *)out; b->len = b->err ? 0 : cap - z.avail_out;
+    }
+#endif
+    return NULL;
+}
+
+static void *csv_write_block(void *p) {
+    CsvBlock *b = p;
+    for (size_t done = 0; done < b->len; ) {
+        ssize_t w = pwrite(b->fd, b->buf + done, b->len - done, b->off + (off_t)done);
+        if (w <= 0) { b->err = 1; break; }
+        done += (size_t)w;
+    }
+    return NULL;
+}
+
+static int write_csv_parallel(const char *path, const char *header, const Instr *prog, int n,
+                              const Timeline *tl, int uses_vec, int threads, int gz) {
+    CsvBlock blk[MAX_CSV_THREADS];
+    pthread_t tid[MAX_CSV_THREADS];
+    int started[MAX_CSV_THREADS];       /* 0: the block was done inline, the thread failed to start */
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666), err = 0;
+    if (fd < 0) return -1;
+    if (threads > n) threads = n;
+    off_t off = 0;
+    for (int t=0;t<threads;t++) {
+        CsvBlock *b = &blk[t];
+        memset(b, 0, sizeof(*b));
+        b->prog = prog; b->tl = tl; b->uses_vec = uses_vec; b->fd = fd; b->gz = gz;
+        b->header = t ? NULL : header;
+        b->lo = (int)((long)n * t / threads); b->hi = (int)((long)n * (t+1) / threads);
+        b->buf = malloc((size_t)(b->hi - b->lo) * CSV_ROW_MAX + strlen(header));
+        if (!b->buf) { fprintf(stderr, "OOM\n"); exit(5); }
+        if (!(started[t] = pthread_create(&tid[t], NULL, csv_format_block, b) == 0)) csv_format_block(b);
+    }
+    for (int t=0;t<threads;t++) { if (started[t]) pthread_join(tid[t], NULL); err |= blk[t].err; }
+    for (int t=0;t<threads;t++) { blk[t].off = off; off += (off_t)blk[t].len; }
+    for (int t=0;t<threads;t++)
+        if (!(started[t] = pthread_create(&tid[t], NULL, csv_write_block, &blk[t]) == 0)) csv_write_block(&blk[t]);
+    for (int t=0;t<threads;t++) { if (started[t]) pthread_join(tid[t], NULL); err |= blk[t].err; free(blk[t].buf); }
+    if (close(fd)) err = 1;
+    return err ? -1 : 0;
+}
+#endif
+
+/* parse "--lat=N" (every opcode) or "--lat=op:N,op:N"; returns 0 on success */
+static int parse_latencies(const char *list, Timing *tm) {
+    while (*list) {
+        char *end;
+        int op=-1;
+        for (int o=0;o<OP_BAD && op<0;o++) {
+            size_t len = strlen(op_info[o].name);
+            if (strncmp(list, op_info[o].name, len)==0 && list[len]==':') { op=o; list+=len+1; }
+        }
+        long v = strtol(list, &end, 10);
+        if (end==list || v < 1 || v > 1000) return -1;
+        for (int o=0;o<OP_BAD;o++) if (op<0 || o==op) tm->ex_lat[o]=(int)v;
+        list = end;
+        if (*list==',') list++;
+        else if (*list) return -1;
+    }
+    return 0;
+}
+
+/* report figures that do not depend on the engine; the cycle fields are totals for a run and
+   fetch-cursor advances in a shard summary */
+typedef struct {
+    long first, n;              /* global index of the first instruction, count */
+    int  opts, uses_fp;
+    unsigned rules;
+    long stalls, raw_int, raw_fp, unfused_stalls;
+    long movs, zeros, pairs;
+    long cycles, plain, elim, zero, unfused;
+} RunSummary;
+
+/* one text layout serves both fprintf and fscanf */
+#define SUMMARY_FMT "first %ld\nn %ld\nopts %d\nrules %u\nuses_fp %d\nstalls %ld\nraw_int %ld\nraw_fp %ld\n" \
+                    "unfused_stalls %ld\nmovs %ld\nzeros %ld\npairs %ld\n" \
+                    "cycles %ld\nplain %ld\nelim %ld\nzero %ld\nunfused %ld\n"
+
+static void count_ops(const Instr *prog, int lo, int hi, RunSummary *s) {
+    for (int i=lo;i<hi;i++) {
+        s->movs += (prog[i].op==OP_MOV);
+        s->zeros += is_zero_idiom(&prog[i]);
+        s->pairs += (prog[i].fused == FUSED_HEAD);
+        s->uses_fp |= (prog[i].rd_id >= 0 && IS_FP_REG(prog[i].rd_id));
+    }
+}
+
+static void print_savings(const RunSummary *s) {
+    if (s->opts) {
+        printf("Decode-stage optimizations (cycles saved vs. plain model, each measured alone):\n");
+        printf("  Move elimination: %ld movs, saves %ld cycles%s\n", s->movs, s->plain - s->elim,
+               (s->opts & OPT_MOVE_ELIM) ? "" : " (not enabled)");
+        printf("  Zero idioms:      %ld found, saves %ld cycles%s\n", s->zeros, s->plain - s->zero,
+               (s->opts & OPT_ZERO_IDIOM) ? "" : " (not enabled)");
+        if (!s->rules) printf("  Enabled together: saves %ld cycles\n", s->plain - s->cycles);
+    }
+    if (s->rules) {
+        printf("Macro-op fusion: %ld pairs, fusion rate %.1f%% of instructions\n", s->pairs, 100.0*2*s->pairs/s->n);
+        printf("  Stalls: %ld unfused -> %ld fused (%+ld)\n", s->unfused_stalls, s->stalls, s->stalls - s->unfused_stalls);
+        printf("  Cycles: %ld unfused -> %ld fused (%+ld)\n", s->unfused, s->cycles, s->cycles - s->unfused);
+    }
+}
+
+/* Sharded runs of the distance engine. A shard is a range of instructions plus the two slots
+   before it as context: without forwarding a producer 3 or more slots back never stalls, so the
+   context settles every stall in the range. Ranges start at a slot head, so greedy fusion pairs
+   the same instructions as a single run. A shard writes its rows with indices and cycles relative
+   to its start and a summary of fetch-cursor advances; the merge offsets each shard by the prefix
+   sum of the advances before it. */
+#define MAX_SHARDS 256
+#define SHARD_PLAN "shards.txt"
+
+static int shardable(const Instr *in) {
+    if (!op_info[in->op].fp_unit && !op_info[in->op].vec_unit) return 1;
+    fprintf(stderr, "Error: %s needs the scoreboard or the vector unit; only distance-engine programs can be sharded\n", in->text);
+    return 0;
+}
+
+/* distance-schedule prog[0..n-1], whose first c instructions are context; returns the advance of
+   the fetch cursor over prog[c..n-1] and stores their stall sum */
+static long shard_pass(Instr *prog, int c, int n, int opts, unsigned rules, Timeline *tl, long *stalls) {
+    long ignored;
+    distance_schedule(prog, n, opts, rules, tl, &ignored);
+    *stalls = 0;
+    for (int i=c;i<n;i++) *stalls += tl->stalls[i];
+    return tl->IF[n-1] - (c ? tl->IF[c-1] : 0);
+}
+
+/* split the input into k ranges of about equal instruction count and write one
+   --shard=FIRST,CTX,OFF,END line per range to SHARD_PLAN: FIRST is the index of its first
+   instruction, CTX and OFF the byte offsets of its context and of its first line, END where it
+   stops (-1 = end of file) */
+static int plan_shards(const char *infile, int k, int opts, unsigned rules, int verbose) {
     char line[MAX_LINE];
+    Instr prev, cur;
+    long total=0, lineno=0;
+    InFile f = in_open(infile);
+    if (!f) { fprintf(stderr, "Error: cannot open %s\n", infile); return 1; }
+    while (in_gets(line, sizeof(line), f)) {
+        int r = parse_line(line, &cur, (int)++lineno);
+        if (r < 0) { in_close(f); return 2; }
+        if (r == 1 && !shardable(&cur)) { in_close(f); return 7; }
+        total += r;
+    }
+    in_close(f);
+    if (total == 0) { fprintf(stderr, "No instructions parsed.\n"); return 4; }
+    if (k > total) k = (int)total;
 
-    while (fgets(line, sizeof(line), f)) {
-        lineno++;
-        Instr ins;
-        int r = parse_line(line, &ins, lineno);
-        if (r < 0) { fclose(f); return 2; }
-        if (r == 1) {
-            if (n >= MAX_INSTR) { fprintf(stderr, "Too many instructions\n"); fclose(f); return 3; }
-            prog[n++] = ins;
+    FILE *out = fopen(SHARD_PLAN, "w");
+    if (!out) { fprintf(stderr, "Error: cannot write %s\n", SHARD_PLAN); return 6; }
+    fprintf(out, "# %ld instructions, opts %d, rules %u\n", total, opts, rules);
+    f = in_open(infile);
+    if (!f) { fprintf(stderr, "Error: cannot open %s\n", infile); fclose(out); return 1; }
+    long head_off[2] = { -1, -1 }, head_idx[2] = { 0, 0 };   /* the last two slot heads, older first */
+    long i=0, pos=0, first=0, ctx=0, ctx_idx=0, off=0;
+    int shard=0, prev_tail=0, err=0;
+    lineno = 0;
+    while (!err && in_gets(line, sizeof(line), f)) {
+        long at = pos;
+        pos += (long)strlen(line);
+        if (parse_line(line, &cur, (int)++lineno) != 1) continue;
+        int tail = i>0 && !prev_tail && fusable(&prev, &cur, rules);
+        if (!tail) {
+            if (shard+1 < k && i >= total*(shard+1)/k) {
+                fprintf(out, "--shard=%ld,%ld,%ld,%ld\n", first, ctx, off, at);
+                if (i - ctx_idx > MAX_INSTR) err = 1;
+                int older = head_off[0] >= 0 ? 0 : 1;
+                first = i; off = at; ctx = head_off[older]; ctx_idx = head_idx[older];
+                shard++;
+            }
+            head_off[0] = head_off[1]; head_idx[0] = head_idx[1];
+            head_off[1] = at; head_idx[1] = i;
         }
+        prev = cur; prev_tail = tail; i++;
+    }
+    in_close(f);
+    fprintf(out, "--shard=%ld,%ld,%ld,-1\n", first, ctx, off);
+    if (total - ctx_idx > MAX_INSTR) err = 1;
+    if (fclose(out)) { fprintf(stderr, "Error: cannot write %s\n", SHARD_PLAN); return 6; }
+    if (err) { fprintf(stderr, "Too many instructions per shard (max %d with context); use more shards\n", MAX_INSTR); return 3; }
+    if (verbose) printf("Shard plan: %ld instructions in %d shards -> %s\n", total, shard+1, SHARD_PLAN);
+    return 0;
+}
+
+/* simulate one planned range; writes shard_FIRST.csv and shard_FIRST.sum */
+static int run_shard(const char *spec, const char *infile, int opts, unsigned rules, int verbose) {
+    static Instr prog[MAX_INSTR];
+    static int cyc[6][MAX_INSTR];
+    long first, ctx, off, end, ignored;
+    if (sscanf(spec, "%ld,%ld,%ld,%ld", &first, &ctx, &off, &end) != 4 || first < 0 || ctx < 0 || ctx > off) {
+        fprintf(stderr, "Bad --shard=%s\n", spec);
+        return 7;
+    }
+    InFile f = in_open(infile);
+    if (!f) { fprintf(stderr, "Error: cannot open %s\n", infile); return 1; }
+    if (in_seek(f, ctx) < 0) { fprintf(stderr, "Error: cannot seek in %s\n", infile); in_close(f); return 1; }
+    int n=0, c=0, lineno=0;
+    char line[MAX_LINE];
+    for (long pos=ctx; (end < 0 || pos < end) && in_gets(line, sizeof(line), f); pos += (long)strlen(line)) {
+        Instr ins;
+        int r = parse_line(line, &ins, ++lineno);
+        if (r < 0) { in_close(f); return 2; }
+        if (r == 0) continue;
+        if (n >= MAX_INSTR) { fprintf(stderr, "Too many instructions\n"); in_close(f); return 3; }
+        if (!shardable(&ins)) { in_close(f); return 7; }
+        prog[n++] = ins;
+        c += (pos < off);
+    }
+    in_close(f);
+    if (n == c) { fprintf(stderr, "No instructions parsed.\n"); return 4; }
+
+    Timeline tl = { cyc[0], cyc[1], cyc[2], cyc[3], cyc[4], cyc[5], 0, 0, 0, { 0 } };
+    RunSummary s;
+    memset(&s, 0, sizeof(s));
+    s.first = first; s.n = n - c; s.opts = opts; s.rules = rules;
+    if (opts) {
+        s.plain = shard_pass(prog, c, n, 0, 0, &tl, &ignored);
+        s.elim  = shard_pass(prog, c, n, OPT_MOVE_ELIM, 0, &tl, &ignored);
+        s.zero  = shard_pass(prog, c, n, OPT_ZERO_IDIOM, 0, &tl, &ignored);
+    }
+    if (rules) s.unfused = shard_pass(prog, c, n, opts, 0, &tl, &s.unfused_stalls);
+    s.cycles = shard_pass(prog, c, n, opts, rules, &tl, &s.stalls);
+    if (c && prog[c].fused == FUSED_TAIL) { fprintf(stderr, "Error: shard %ld starts inside a fused pair; plan with the same --fuse rules\n", first); return 7; }
+    count_ops(prog, c, n, &s);
+    for (int i=c;i<n;i++) {
+        if (fp_bound(prog, i)) s.raw_fp += tl.stalls[i]; else s.raw_int += tl.stalls[i];
+    }
+
+    int base = c ? tl.IF[c-1] + 1 : 1;
+    for (int i=c;i<n;i++) { tl.IF[i] -= base; tl.ID[i] -= base; tl.EX[i] -= base; tl.MEM[i] -= base; tl.WB[i] -= base; }
+    Timeline rel = { tl.stalls + c, tl.IF + c, tl.ID + c, tl.EX + c, tl.MEM + c, tl.WB + c, 0, 0, 0, { 0 } };
+    char path[64], row[CSV_ROW_MAX];
+    snprintf(path, sizeof(path), "shard_%ld.csv", first);
+    FILE *csv = fopen(path, "w");
+    if (!csv) { fprintf(stderr, "Error: cannot write %s\n", path); return 6; }
+    for (int i=c;i<n;i++) fwrite(row, 1, (size_t)csv_row(row, &prog[i], i - c, &rel, 0), csv);
+    if (fclose(csv)) { fprintf(stderr, "Error: cannot write %s\n", path); return 6; }
+    snprintf(path, sizeof(path), "shard_%ld.sum", first);
+    FILE *sum = fopen(path, "w");
+    if (!sum) { fprintf(stderr, "Error: cannot write %s\n", path); return 6; }
+    fprintf(sum, SUMMARY_FMT, s.first, s.n, s.opts, s.rules, s.uses_fp, s.stalls, s.raw_int, s.raw_fp,
+            s.unfused_stalls, s.movs, s.zeros, s.pairs, s.cycles, s.plain, s.elim, s.zero, s.unfused);
+    if (fclose(sum)) { fprintf(stderr, "Error: cannot write %s\n", path); return 6; }
+    if (verbose) printf("Shard %ld: %ld instructions (+%d context), %ld stalls, advance %ld cycles -> shard_%ld.csv\n",
+                        first, s.n, c, s.stalls, s.cycles, first);
+    return 0;
+}
+
+/* read the planned --shard= arguments; returns their count or -1 */
+static int read_plan(const char *plan, long *total, int *opts, unsigned *rules, char specs[][80]) {
+    FILE *f = fopen(plan, "r");
+    char line[MAX_LINE];
+    int k = 0;
+    if (!f) { fprintf(stderr, "Error: cannot open %s\n", plan); return -1; }
+    if (fscanf(f, "# %ld instructions, opts %d, rules %u\n", total, opts, rules) != 3) k = -1;
+    while (k >= 0 && fgets(line, sizeof(line), f)) {
+        rtrim_ascii(line);
+        if (strncmp(line, "--shard=", 8) != 0) continue;
+        if (k == MAX_SHARDS) { k = -1; break; }
+        snprintf(specs[k++], 80, "%.79s", line + 8);
     }
     fclose(f);
+    if (k <= 0) fprintf(stderr, "Error: %s is not a shard plan\n", plan);
+    return k > 0 ? k : -1;
+}
+
+/* stitch the shard outputs of a plan into one timeline and report */
+static int merge_shards(const char *plan, const char *csvout) {
+    static char specs[MAX_SHARDS][80];
+    static long firsts[MAX_SHARDS], G[MAX_SHARDS];
+    long total;
+    int opts, k;
+    unsigned rules;
+    if ((k = read_plan(plan, &total, &opts, &rules, specs)) < 0) return 1;
+    RunSummary m;
+    memset(&m, 0, sizeof(m));
+    m.opts = opts; m.rules = rules;
+    long g = 1, plain = 1, elim = 1, zero = 1, unfused = 1;   /* fetch cursor of each variant */
+    char path[64];
+    for (int j=0;j<k;j++) {
+        RunSummary s;
+        firsts[j] = atol(specs[j]);
+        snprintf(path, sizeof(path), "shard_%ld.sum", firsts[j]);
+        FILE *f = fopen(path, "r");
+        if (!f) { fprintf(stderr, "Error: cannot open %s\n", path); return 1; }
+        int got = fscanf(f, SUMMARY_FMT, &s.first, &s.n, &s.opts, &s.rules, &s.uses_fp, &s.stalls, &s.raw_int, &s.raw_fp,
+                         &s.unfused_stalls, &s.movs, &s.zeros, &s.pairs, &s.cycles, &s.plain, &s.elim, &s.zero, &s.unfused);
+        fclose(f);
+        if (got != 17 || s.first != m.n || s.first != firsts[j] || s.opts != opts || s.rules != rules) {
+            fprintf(stderr, "Error: %s does not continue the plan in %s with the same options\n", path, plan);
+            return 2;
+        }
+        G[j] = g;
+        g += s.cycles; plain += s.plain; elim += s.elim; zero += s.zero; unfused += s.unfused;
+        m.n += s.n; m.stalls += s.stalls; m.raw_int += s.raw_int; m.raw_fp += s.raw_fp;
+        m.unfused_stalls += s.unfused_stalls; m.movs += s.movs; m.zeros += s.zeros; m.pairs += s.pairs;
+        m.uses_fp |= s.uses_fp;
+    }
+    if (m.n != total) { fprintf(stderr, "Error: shards cover %ld of %ld instructions\n", m.n, total); return 2; }
+    m.cycles = g + 3; m.plain = plain + 3; m.elim = elim + 3; m.zero = zero + 3; m.unfused = unfused + 3;
+
+    printf("Instructions: %ld\n", m.n);
+    printf("Base cycles (N+4): %ld\n", m.n + 4);
+    printf("Total stalls: %ld\n", m.stalls);
+    printf("Total cycles with stalls: %ld\n", m.cycles);
+    if (m.uses_fp) printf("Stalls by producer: integer %ld, FP %ld\n", m.raw_int, m.raw_fp);
+    printf("Per-instruction stalls (index:stalls):\n");
+    FILE *csv = fopen(csvout, "w");
+    if (!csv) { fprintf(stderr, "Error: cannot write %s\n", csvout); return 6; }
+    fputs("idx,instruction,IF,ID,EX,MEM,WB,stalls_here\n", csv);
+    char row[MAX_LINE];
+    for (int j=0;j<k;j++) {
+        snprintf(path, sizeof(path), "shard_%ld.csv", firsts[j]);
+        FILE *f = fopen(path, "r");
+        if (!f) { fprintf(stderr, "Error: cannot open %s\n", path); fclose(csv); return 1; }
+        while (fgets(row, sizeof(row), f)) {
+            long v[6];                                  /* the text may hold commas: take cycles from the right */
+            char *comma = NULL;
+            rtrim_ascii(row);
+            for (int q=5;q>=0;q--) {
+                if (!(comma = strrchr(row, ','))) break;
+                v[q] = atol(comma + 1);
+                *comma = '\0';
+            }
+            char *text = strchr(row, ',');
+            if (!comma || !text) { fprintf(stderr, "Error: bad row in %s\n", path); fclose(f); fclose(csv); return 2; }
+            long idx = firsts[j] + atol(row);
+            fprintf(csv, "%ld,%s,%ld,%ld,%ld,%ld,%ld,%ld\n", idx, text + 1, v[0] + G[j], v[1] + G[j], v[2] + G[j], v[3] + G[j], v[4] + G[j], v[5]);
+            printf("%ld:%ld%s", idx, v[5], (idx == total-1) ? "\n" : ", ");
+        }
+        fclose(f);
+    }
+    if (fclose(csv)) { fprintf(stderr, "Error: cannot write %s\n", csvout); return 6; }
+    print_savings(&m);
+    return 0;
+}
+
+/* --shards=K: plan, run every shard as a child process standing in for a node (in turn, where
+   there is no fork), then merge. Children run argv with --shards=K replaced by their --shard= */
+static int run_sharded(int argc, char **argv, int karg, int k, const char *infile, const char *csvout,
+                       int opts, unsigned rules) {
+    static char specs[MAX_SHARDS][80];
+    long total;
+    int r = plan_shards(infile, k, opts, rules, 0);
+    if (r) return r;
+    if ((k = read_plan(SHARD_PLAN, &total, &opts, &rules, specs)) < 0) return 1;
+#ifdef HAVE_FORK
+    static pid_t pids[MAX_SHARDS];
+    char **cargv = malloc((size_t)(argc + 1) * sizeof(char *));
+    char arg[96];
+    if (!cargv) { fprintf(stderr, "OOM\n"); return 5; }
+    fflush(stdout);
+    for (int j=0;j<k;j++) {
+        snprintf(arg, sizeof(arg), "--shard=%s", specs[j]);
+        for (int a=0;a<argc;a++) cargv[a] = (a == karg) ? arg : argv[a];
+        cargv[argc] = NULL;
+        pids[j] = fork();
+        if (pids[j] == 0) {
+            int null = open("/dev/null", O_WRONLY);
+            if (null >= 0) dup2(null, 1);
+            execvp(argv[0], cargv);
+            _exit(127);
+        }
+        if (pids[j] < 0) { fprintf(stderr, "Error: cannot start shard %d\n", j); k = j; r = 1; break; }
+    }
+    free(cargv);
+    for (int j=0;j<k;j++) {
+        int st = 0;
+        pid_t w = waitpid(pids[j], &st, 0);
+        if (w < 0 || !WIFEXITED(st) || WEXITSTATUS(st)) {
+            if (!r) r = (w >= 0 && WIFEXITED(st) && WEXITSTATUS(st) != 127) ? WEXITSTATUS(st) : 1;
+            fprintf(stderr, "Error: shard %s failed\n", specs[j]);
+        }
+    }
+#else
+    (void)argc; (void)argv; (void)karg;
+    for (int j=0;j<k && !r;j++) r = run_shard(specs[j], infile, opts, rules, 0);
+#endif
+    return r ? r : merge_shards(SHARD_PLAN, csvout);
+}
+
+int main(int argc, char **argv) {
+    const char *infile = "instructions.txt";
+    const char *csvout = "pipeline_timeline.csv";
+    const char *timeline_file = NULL;
+    const char *shard_spec = NULL, *merge_plan = NULL;
+    int opts = 0, npos = 0, csv_threads = 1, gz = 0, plan_k = 0, shards_k = 0, shards_arg = 0;
+    unsigned rules = 0;
+    Timing timing;
+    for (int o=0;o<OP_BAD;o++) timing.ex_lat[o] = 1;
+    timing.ex_lat[OP_FADD] = 4; timing.ex_lat[OP_FMUL] = 4;      /* pipelined FP unit defaults */
+    timing.ex_lat[OP_FDIV] = 12; timing.ex_lat[OP_FMADD] = 5;
+    timing.ex_lat[OP_VLE] = 2; timing.ex_lat[OP_VMUL] = 3;       /* vector unit defaults */
+    timing.ex_lat[OP_VFMACC] = 4;
+    timing.mem_stages = 1;
+    const Timing *tm = NULL;
+    VecConfig vc = { 512, 4, 1, timing.ex_lat };
+    for (int a=1;a<argc;a++) {
+        if (strcmp(argv[a],"--move-elim")==0) opts |= OPT_MOVE_ELIM;
+        else if (strcmp(argv[a],"--scoreboard")==0) tm = &timing;
+        else if (strncmp(argv[a],"--lat=",6)==0) {
+            if (parse_latencies(argv[a]+6, &timing)) { fprintf(stderr, "Bad latency list %s\n", argv[a]); return 7; }
+            tm = &timing;
+        }
+        else if (strncmp(argv[a],"--mem-stages=",13)==0) {
+            timing.mem_stages = atoi(argv[a]+13);
+            if (timing.mem_stages < 1) { fprintf(stderr, "Bad %s\n", argv[a]); return 7; }
+            tm = &timing;
+        }
+        else if (strncmp(argv[a],"--vlen=",7)==0) {
+            vc.vlen = atoi(argv[a]+7);
+            if (vc.vlen < 64 || vc.vlen > 65536 || (vc.vlen & (vc.vlen-1))) { fprintf(stderr, "Bad %s\n", argv[a]); return 7; }
+        }
+        else if (strncmp(argv[a],"--lanes=",8)==0) {
+            vc.lanes = atoi(argv[a]+8);
+            if (vc.lanes < 1) { fprintf(stderr, "Bad %s\n", argv[a]); return 7; }
+        }
+        else if (strcmp(argv[a],"--no-chain")==0) vc.chain = 0;
+        else if (strncmp(argv[a],"--perfetto=",11)==0) timeline_file = argv[a]+11;
+        else if (strncmp(argv[a],"--csv-threads=",14)==0) {
+            csv_threads = atoi(argv[a]+14);
+            if (csv_threads < 1 || csv_threads > MAX_CSV_THREADS) { fprintf(stderr, "Bad %s\n", argv[a]); return 7; }
+        }
+        else if (strcmp(argv[a],"--gzip")==0) gz = 6;
+        else if (strncmp(argv[a],"--gzip=",7)==0) {
+            gz = atoi(argv[a]+7);
+            if (gz < 1 || gz > 9) { fprintf(stderr, "Bad %s\n", argv[a]); return 7; }
+        }
+        else if (strncmp(argv[a],"--shard-plan=",13)==0 || strncmp(argv[a],"--shards=",9)==0) {
+            int k = atoi(strchr(argv[a], '=')+1);
+            if (k < 1 || k > MAX_SHARDS) { fprintf(stderr, "Bad %s\n", argv[a]); return 7; }
+            if (argv[a][7] == '-') plan_k = k; else { shards_k = k; shards_arg = a; }
+        }
+        else if (strncmp(argv[a],"--shard=",8)==0) shard_spec = argv[a]+8;
+        else if (strncmp(argv[a],"--merge=",8)==0) merge_plan = argv[a]+8;
+        else if (strcmp(argv[a],"--zero-idiom")==0) opts |= OPT_ZERO_IDIOM;
+        else if (strcmp(argv[a],"--fuse")==0 || strncmp(argv[a],"--fuse=",7)==0) {
+            long m = parse_fuse_rules(argv[a]);
+            if (m < 0) {
+                fprintf(stderr, "Unknown fusion rule in %s; rules:", argv[a]);
+                for (int r=0;r<NUM_FUSE_RULES;r++) fprintf(stderr, " %s", fuse_rules[r].name);
+                fprintf(stderr, "\n");
+                return 7;
+            }
+            rules |= (unsigned)m;
+        }
+        else if (strncmp(argv[a],"--",2)==0) {
+            fprintf(stderr, "Unknown option %s\n"
+                            "Usage: %s [--move-elim] [--zero-idiom] [--fuse[=rule,...]]\n"
+                            "          [--scoreboard] [--lat=N|op:N,...] [--mem-stages=N]\n"
+                            "          [--vlen=BITS] [--lanes=N] [--no-chain] [--perfetto=FILE]\n"
+                            "          [--csv-threads=N] [--gzip[=LEVEL]] [input] [csv]\n"
+                            "       %s [--move-elim] [--zero-idiom] [--fuse[=rule,...]]\n"
+                            "          --shards=K | --shard-plan=K | --shard=FIRST,CTX,OFF,END [input] [csv]\n"
+                            "       %s --merge=PLAN [csv]\n"
+                            "input: FILE | trace:FILE | commit:FILE | synth:N[:SEED] | loop:N:input\n",
+                    argv[a], argv[0], argv[0], argv[0]);
+            return 7;
+        }
+        else if (npos==0) { infile = argv[a]; npos++; }
+        else if (npos==1) { csvout = argv[a]; npos++; }
+    }
+#if !defined(WITH_ZLIB) || !defined(HAVE_PWRITE)
+    if (gz) { fprintf(stderr, "Error: --gzip needs zlib (-DWITH_ZLIB) and pthreads\n"); return 7; }
+#endif
+    if (!!shard_spec + !!merge_plan + !!plan_k + !!shards_k > 1) { fprintf(stderr, "Error: use one of --shards, --shard-plan, --shard and --merge\n"); return 7; }
+    if ((shard_spec || merge_plan || plan_k || shards_k) && (tm || gz || csv_threads > 1 || timeline_file)) {
+        fprintf(stderr, "Error: sharded runs use the distance engine and a plain CSV; drop --scoreboard, --lat, --mem-stages, --perfetto, --csv-threads and --gzip\n");
+        return 7;
+    }
+    if ((plan_k || shard_spec || shards_k) && !text_input(infile)) {
+        fprintf(stderr, "Error: shards are byte ranges of a text input; %s is not one\n", infile);
+        return 7;
+    }
+    if (merge_plan) return merge_shards(merge_plan, npos ? infile : csvout);   /* its only positional argument is the CSV */
+    if (plan_k) return plan_shards(infile, plan_k, opts, rules, 1);
+    if (shard_spec) return run_shard(shard_spec, infile, opts, rules, 1);
+    if (shards_k) return run_sharded(argc, argv, shards_arg, shards_k, infile, csvout, opts, rules);
+    char gzout[MAX_LINE];
+    if (gz && (strlen(csvout) < 3 || strcmp(csvout + strlen(csvout) - 3, ".gz"))) {
+        snprintf(gzout, sizeof(gzout), "%s.gz", csvout);
+        csvout = gzout;
+    }
+
+    PROBE0(parse_start);
+    InstrSource in;
+    int err = source_open(&in, infile);
+    if (err) return err;
+
+    Instr prog[MAX_INSTR];
+    Instr extra;                /* one past MAX_INSTR, to detect an overflow */
+    int n=0;
+
+    for (;;) {                  /* a batch per call, straight into prog[] */
+        Instr *b = n < MAX_INSTR ? prog + n : &extra;
+        int got = in.next(&in, b, n < MAX_INSTR ? MAX_INSTR - n : 1);
+        if (got < 0) { source_close(&in); return -got; }
+        if (got == 0) break;
+        if (b == &extra) { fprintf(stderr, "Too many instructions\n"); source_close(&in); return 3; }
+        n += got;
+    }
+    source_close(&in);
+    PROBE1(parse_done, n);
     if (n == 0) { fprintf(stderr, "No instructions parsed.\n"); return 4; }
 
-    // No-forwarding hazard model
+    // the distance window cannot express multi-cycle FP latencies, so FP code uses the scoreboard
+    int uses_fp=0, uses_fpu=0, uses_vec=0;
+    for (int i=0;i<n;i++) {
+        uses_fpu |= op_info[prog[i].op].fp_unit;
+        uses_vec |= op_info[prog[i].op].vec_unit != VU_NONE;
+        uses_fp |= (prog[i].rd_id >= 0 && IS_FP_REG(prog[i].rd_id));
+    }
+    if (uses_fpu && !tm) tm = &timing;
+    assign_vl(prog, n, vc.vlen);
+
+    // No-forwarding hazard model (distance window, or the scoreboard when configured)
     int *stalls = (int*)calloc(n, sizeof(int));
     int *IFc  = (int*)malloc(n*sizeof(int));
     int *IDc  = (int*)malloc(n*sizeof(int));
@@ -163,43 +1545,83 @@ int main(int argc, char **argv) {
     int *MEMc = (int*)malloc(n*sizeof(int));
     int *WBc  = (int*)malloc(n*sizeof(int));
     if (!stalls || !IFc || !IDc || !EXc || !MEMc || !WBc) { fprintf(stderr, "OOM\n"); return 5; }
+    Timeline tl = { stalls, IFc, IDc, EXc, MEMc, WBc, 0, 0, 0, { 0 } };
 
-    char d1[16]="", d2[16]="";
-    for (int i=0;i<n;i++) {
-        int s=0;
-        if (d1[0] && reg_in_sources(d1, &prog[i])) s=2;
-        if (d2[0] && reg_in_sources(d2, &prog[i])) s = (s>1? s:1);
-        stalls[i]=s;
-        snprintf(d2,sizeof(d2),"%s",d1);
-        snprintf(d1,sizeof(d1),"%s",prog[i].rd);
-    }
-
-    int curIF=1;
-    for (int i=0;i<n;i++) {
-        int s=stalls[i];
-        int start_if=curIF+s;
-        IFc[i]=start_if; IDc[i]=start_if+1; EXc[i]=start_if+2; MEMc[i]=start_if+3; WBc[i]=start_if+4;
-        curIF = start_if + 1;
+    // each optimization alone against the plain model, so the report can attribute savings
+    int plain_cycles=0, elim_cycles=0, zero_cycles=0, unfused_cycles=0;
+    long unfused_stalls=0, ignored;
+    if (opts) {
+        plain_cycles = schedule(prog, n, 0, 0, tm, &vc, &tl, &ignored);
+        elim_cycles  = schedule(prog, n, OPT_MOVE_ELIM, 0, tm, &vc, &tl, &ignored);
+        zero_cycles  = schedule(prog, n, OPT_ZERO_IDIOM, 0, tm, &vc, &tl, &ignored);
     }
+    if (rules) unfused_cycles = schedule(prog, n, opts, 0, tm, &vc, &tl, &unfused_stalls);
+    long sum_stalls;
+    int total_cycles = schedule(prog, n, opts, rules, tm, &vc, &tl, &sum_stalls);
 
-    long sum_stalls=0; for (int i=0;i<n;i++) sum_stalls+=stalls[i];
     int base_cycles = n + 4;
-    int total_cycles = WBc[n-1];
 
+    if (tm) {
+        printf("Scoreboard engine: EX latency");
+        for (int o=0;o<OP_BAD;o++) printf(" %s=%d", op_info[o].name, tm->ex_lat[o]);
+        printf(", MEM stages=%d\n", tm->mem_stages);
+    }
     printf("Instructions: %d\n", n);
     printf("Base cycles (N+4): %d\n", base_cycles);
     printf("Total stalls: %ld\n", sum_stalls);
     printf("Total cycles with stalls: %d\n", total_cycles);
+    if (uses_fp) {
+        printf("Stalls by producer: integer %ld, FP %ld\n", tl.raw_int, tl.raw_fp);
+        if (tm) printf("Issue stalls (WAW / write-back slot): %ld\n", tl.issue);
+    }
+    if (uses_vec) {
+        const VecStats *vs = &tl.vec;
+        long busy = 0;
+        for (int u=1;u<VU_COUNT;u++) busy += vs->busy[u];
+        printf("Vector unit: VLEN=%d, %d lanes, chaining %s; %d ops, %ld elements\n",
+               vc.vlen, vc.lanes, vc.chain ? "on" : "off", vs->ops, vs->elems);
+        printf("  Utilization of %d cycles:", total_cycles);
+        for (int u=1;u<VU_COUNT;u++)
+            printf("%s %s %ld busy (%.1f%%)", u>1 ? "," : "", vu_names[u], vs->busy[u], 100.0*vs->busy[u]/total_cycles);
+        printf("\n  Lane utilization: %.1f%% of lane slots in busy cycles\n", busy ? 100.0*vs->elems/(busy*vc.lanes) : 0.0);
+        printf("  Chained starts: %d; cycles waiting for vector operands or a free unit: %ld\n", vs->chained, vs->wait);
+    }
     printf("Per-instruction stalls (index:stalls):\n");
     for (int i=0;i<n;i++) printf("%d:%d%s", i, stalls[i], (i==n-1) ? "\n" : ", ");
+    RunSummary rs;
+    memset(&rs, 0, sizeof(rs));
+    rs.n = n; rs.opts = opts; rs.rules = rules;
+    rs.stalls = sum_stalls; rs.unfused_stalls = unfused_stalls;
+    rs.cycles = total_cycles; rs.plain = plain_cycles; rs.elim = elim_cycles; rs.zero = zero_cycles; rs.unfused = unfused_cycles;
+    count_ops(prog, 0, n, &rs);
+    print_savings(&rs);
 
-    FILE *csv = fopen(csvout, "w");
-    if (!csv) { fprintf(stderr, "Error: cannot write %s\n", csvout); return 6; }
-    fprintf(csv, "idx,instruction,IF,ID,EX,MEM,WB,stalls_here\n");
-    for (int i=0;i<n;i++)
-        fprintf(csv, "%d,%s,%d,%d,%d,%d,%d,%d\n",
-                i, prog[i].text, IFc[i], IDc[i], EXc[i], MEMc[i], WBc[i], stalls[i]);
-    fclose(csv);
+    PROBE1(csv_start, csv_threads);
+    char header[64], row[CSV_ROW_MAX];
+    snprintf(header, sizeof(header), "idx,instruction,IF,ID,EX,MEM,WB,stalls_here%s\n", uses_vec ? ",VSTART,VEND" : "");
+#ifdef HAVE_PWRITE
+    if (csv_threads > 1 || gz) {                         /* compression always runs on the writer threads */
+        if (write_csv_parallel(csvout, header, prog, n, &tl, uses_vec, csv_threads, gz)) { fprintf(stderr, "Error: cannot write %s\n", csvout); return 6; }
+    }
+    else
+#endif
+    {
+        FILE *csv = fopen(csvout, "w");
+        if (!csv) { fprintf(stderr, "Error: cannot write %s\n", csvout); return 6; }
+        fputs(header, csv);
+        for (int i=0;i<n;i++) fwrite(row, 1, (size_t)csv_row(row, &prog[i], i, &tl, uses_vec), csv);
+        fclose(csv);
+    }
+
+    PROBE1(csv_done, n);
+    if (timeline_file) {
+        PROBE0(trace_start);
+        TraceOut t;
+        if (trace_open(&t, timeline_file)) { fprintf(stderr, "Error: cannot write %s\n", timeline_file); return 6; }
+        export_timeline(&t, prog, n, &tl, vc.lanes);
+        trace_close(&t);
+        PROBE1(trace_done, t.packets);
+    }
 
     free(stalls); free(IFc); free(IDc); free(EXc); free(MEMc); free(WBc);
     return 0;